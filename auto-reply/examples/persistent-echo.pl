@@ -0,0 +1,27 @@
+#!/usr/bin/perl
+# Example responder for persistent mode (Persistent=1), echoes the message
+# back to the sender.
+#
+# Each request is a header line followed by the arguments and the message:
+#   <id> <argument length> <message length>\n<arguments><message>
+# Each response must be a header line followed by the reply:
+#   <id> <status> <reply length>\n<reply>
+# Lengths are in bytes, a non-zero status means no reply should be sent.
+
+use strict;
+use warnings;
+
+binmode(STDIN);
+binmode(STDOUT);
+$| = 1;
+
+while (my $header = <STDIN>)
+{
+  my ($id, $argLength, $msgLength) = split(' ', $header);
+  my ($args, $message) = ('', '');
+  read(STDIN, $args, $argLength) if $argLength > 0;
+  read(STDIN, $message, $msgLength) if $msgLength > 0;
+
+  my $reply = "You said: $message";
+  print "$id 0 " . length($reply) . "\n" . $reply;
+}
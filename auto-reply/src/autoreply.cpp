@@ -31,6 +31,7 @@
 #include <cerrno>
 
 #include "autoreply.h"
+#include "responder.h"
 
 #include <licq/logging/log.h>
 #include <licq/contactlist/owner.h>
@@ -49,15 +50,27 @@ using Licq::UserId;
 using Licq::gLog;
 using Licq::gProtocolManager;
 using Licq::gUserManager;
+using LicqAutoReply::Responder;
 
 const unsigned short SUBJ_CHARS = 20;
+const unsigned MAX_RESPONDERS = 16;
+
+// A responder that fails sooner than this after being started is restarted
+// with a doubled delay, after too many such failures persistent mode is given up
+const time_t RESPONDER_MIN_UPTIME = 10;
+const unsigned MAX_RESPONDER_FAILURES = 5;
 
 /*---------------------------------------------------------------------------
  * CLicqAutoReply::Constructor
  *-------------------------------------------------------------------------*/
 CLicqAutoReply::CLicqAutoReply()
   : myIsEnabled(false),
-    myMarkAsRead(false)
+    myMarkAsRead(false),
+    myPersistent(false),
+    myNumResponders(1),
+    myTimeout(10),
+    myRespondersFailed(false),
+    myNextRequestId(1)
 {
   m_bExit = false;
 }
@@ -68,6 +81,7 @@ CLicqAutoReply::CLicqAutoReply()
  *-------------------------------------------------------------------------*/
 CLicqAutoReply::~CLicqAutoReply()
 {
+  stopResponders();
 }
 
 bool CLicqAutoReply::init(int argc, char** argv)
@@ -118,6 +132,28 @@ int CLicqAutoReply::run()
   conf.get("SendThroughServer", m_bSendThroughServer, true);
   conf.get("StartEnabled", myIsEnabled, myIsEnabled);
   conf.get("DeleteMessage", myMarkAsRead, myMarkAsRead);
+  conf.get("Persistent", myPersistent, false);
+  conf.get("Processes", myNumResponders, 1);
+  conf.get("Timeout", myTimeout, 10);
+
+  if (myPersistent)
+  {
+    if (myNumResponders < 1)
+      myNumResponders = 1;
+    else if (myNumResponders > MAX_RESPONDERS)
+    {
+      gLog.warning("Too many processes configured, starting %u",
+          MAX_RESPONDERS);
+      myNumResponders = MAX_RESPONDERS;
+    }
+    myResponders.reserve(myNumResponders);
+    myResponderStates.resize(myNumResponders);
+    for (unsigned i = 0; i < myNumResponders; ++i)
+    {
+      myResponders.push_back(new Responder(myProgram));
+      startResponder(i);
+    }
+  }
 
   // Log on if necessary
   if (!myStartupStatus.empty())
@@ -141,16 +177,51 @@ int CLicqAutoReply::run()
   }
 
   fd_set fdSet;
+  fd_set writeSet;
   int nResult;
 
   while (!m_bExit)
   {
     FD_ZERO(&fdSet);
+    FD_ZERO(&writeSet);
     FD_SET(m_nPipe, &fdSet);
+    int maxFd = m_nPipe;
 
-    nResult = select(m_nPipe + 1, &fdSet, NULL, NULL, NULL);
+    for (size_t i = 0; i < myResponders.size(); ++i)
+    {
+      if (!myResponders[i]->isRunning())
+        continue;
+      int fd = myResponders[i]->readFd();
+      FD_SET(fd, &fdSet);
+      if (fd > maxFd)
+        maxFd = fd;
+
+      // Wait for room to pass on requests the process hasn't taken yet
+      if (myResponders[i]->hasQueuedRequests())
+      {
+        fd = myResponders[i]->writeFd();
+        FD_SET(fd, &writeSet);
+        if (fd > maxFd)
+          maxFd = fd;
+      }
+    }
+
+    // Wake up in time to fail requests that didn't get a response and to
+    // start responders again
+    time_t now = time(NULL);
+    time_t deadline = expireReplies(now);
+    time_t restart = startResponders(now);
+    if (restart != 0 && (deadline == 0 || restart < deadline))
+      deadline = restart;
+    struct timeval tv;
+    tv.tv_sec = (deadline > now ? deadline - now : 0);
+    tv.tv_usec = 0;
+
+    nResult = select(maxFd + 1, &fdSet, &writeSet, NULL, deadline != 0 ? &tv : NULL);
     if (nResult == -1)
     {
+      if (errno == EINTR)
+        continue;
       gLog.error("Error in select(): %s", strerror(errno));
       m_bExit = true;
     }
@@ -158,9 +229,36 @@ int CLicqAutoReply::run()
     {
       if (FD_ISSET(m_nPipe, &fdSet))
         ProcessPipe();
+
+      for (size_t i = 0; i < myResponders.size(); ++i)
+      {
+        if (!myResponders[i]->isRunning())
+          continue;
+
+        // Read responses first so a process blocked writing them can go on
+        if (FD_ISSET(myResponders[i]->readFd(), &fdSet))
+          processResponder(i);
+
+        if (myResponders[i]->isRunning() &&
+            myResponders[i]->hasQueuedRequests() &&
+            FD_ISSET(myResponders[i]->writeFd(), &writeSet) &&
+            !myResponders[i]->sendQueuedRequests())
+          restartResponder(i, false);
+      }
+    }
+
+    if (myRespondersFailed)
+    {
+      // Responders keep failing, run program for each message instead
+      gLog.error("%s keeps failing, no longer keeping it running",
+          myProgram.c_str());
+      stopResponders();
+      myPersistent = false;
+      myRespondersFailed = false;
     }
   }
   gLog.info("Shutting down auto reply");
+  stopResponders();
   return 0;
 }
 
@@ -283,11 +381,24 @@ void CLicqAutoReply::processUserEvent(const UserId& userId, unsigned long nId)
     return;
   }
 
+  if (myPersistent)
+  {
+    queueReply(userId, e, nId);
+    return;
+  }
+
   bool r = autoReplyEvent(userId, e);
-  if (myMarkAsRead && r)
+  finishReply(userId, nId, r);
+}
+
+void CLicqAutoReply::finishReply(const UserId& userId, unsigned long eventId,
+    bool success)
+{
+  if (myMarkAsRead && success)
   {
     Licq::UserWriteGuard u(userId);
-    u->EventClearId(nId);
+    if (u.isLocked())
+      u->EventClearId(eventId);
   }
 }
 
@@ -320,6 +431,11 @@ bool CLicqAutoReply::autoReplyEvent(const UserId& userId, const Licq::UserEvent*
     return false;
   }
 
+  return sendReply(userId, message);
+}
+
+bool CLicqAutoReply::sendReply(const UserId& userId, const std::string& message)
+{
   unsigned flags = Licq::ProtocolSignal::SendUrgent;
   if (!m_bSendThroughServer)
     flags |= Licq::ProtocolSignal::SendDirect;
@@ -344,3 +460,196 @@ bool CLicqAutoReply::autoReplyEvent(const UserId& userId, const Licq::UserEvent*
 
   return tag != 0;
 }
+
+void CLicqAutoReply::queueReply(const UserId& userId,
+    const Licq::UserEvent* event, unsigned long eventId)
+{
+  std::string arguments;
+  {
+    Licq::UserReadGuard u(userId);
+    if (!u.isLocked())
+      return;
+    arguments = u->usprintf(myArguments);
+  }
+
+  // Use the running responder with the fewest outstanding requests
+  std::vector<unsigned> load(myResponders.size(), 0);
+  std::map<unsigned long, PendingReply>::const_iterator iter;
+  for (iter = myPendingReplies.begin(); iter != myPendingReplies.end(); ++iter)
+    ++load[iter->second.responder];
+
+  size_t index = myResponders.size();
+  for (size_t i = 0; i < myResponders.size(); ++i)
+    if (myResponders[i]->isRunning() &&
+        (index == myResponders.size() || load[i] < load[index]))
+      index = i;
+
+  if (index == myResponders.size())
+  {
+    // All responders are waiting to be restarted, don't leave event unanswered
+    bool r = autoReplyEvent(userId, event);
+    finishReply(userId, eventId, r);
+    return;
+  }
+
+  unsigned long id = myNextRequestId++;
+  if (!myResponders[index]->sendRequest(id, arguments, event->textLoc()))
+  {
+    restartResponder(index, false);
+    return;
+  }
+
+  PendingReply& pending(myPendingReplies[id]);
+  pending.userId = userId;
+  pending.eventId = eventId;
+  pending.responder = index;
+  pending.deadline = time(NULL) + myTimeout;
+}
+
+void CLicqAutoReply::processResponder(size_t index)
+{
+  Responder* responder = myResponders[index];
+
+  std::list<Responder::Response> responses;
+  bool open = responder->readResponses(responses);
+
+  // Process is answering, forget about earlier failures
+  if (!responses.empty())
+    myResponderStates[index].failures = 0;
+
+  BOOST_FOREACH(const Responder::Response& response, responses)
+  {
+    std::map<unsigned long, PendingReply>::iterator iter =
+        myPendingReplies.find(response.id);
+    if (iter == myPendingReplies.end())
+      // Request has already timed out
+      continue;
+
+    PendingReply pending = iter->second;
+    myPendingReplies.erase(iter);
+
+    bool r;
+    if (response.status != 0 && m_bFailOnExitCode)
+    {
+      gLog.warning("%s returned abnormally: status %d", myProgram.c_str(),
+          response.status);
+      r = !m_bAbortDeleteOnExitCode;
+    }
+    else
+      r = sendReply(pending.userId, response.text);
+    finishReply(pending.userId, pending.eventId, r);
+  }
+
+  if (!open)
+    restartResponder(index, true);
+}
+
+void CLicqAutoReply::startResponder(size_t index)
+{
+  ResponderState& state(myResponderStates[index]);
+  state.started = time(NULL);
+  state.restartTime = 0;
+
+  if (!myResponders[index]->start())
+  {
+    gLog.warning("Could not execute %s", myProgram.c_str());
+    scheduleRestart(index);
+  }
+}
+
+time_t CLicqAutoReply::startResponders(time_t now)
+{
+  time_t next = 0;
+  for (size_t i = 0; i < myResponders.size(); ++i)
+  {
+    time_t restartTime = myResponderStates[i].restartTime;
+    if (restartTime == 0)
+      continue;
+
+    if (restartTime <= now)
+    {
+      startResponder(i);
+      restartTime = myResponderStates[i].restartTime;
+      if (restartTime == 0)
+        continue;
+    }
+
+    if (next == 0 || restartTime < next)
+      next = restartTime;
+  }
+  return next;
+}
+
+void CLicqAutoReply::scheduleRestart(size_t index)
+{
+  ResponderState& state(myResponderStates[index]);
+  time_t now = time(NULL);
+
+  // Only failures soon after starting count towards giving up
+  if (now - state.started < RESPONDER_MIN_UPTIME)
+    ++state.failures;
+  else
+    state.failures = 1;
+
+  if (state.failures > MAX_RESPONDER_FAILURES)
+  {
+    myRespondersFailed = true;
+    return;
+  }
+
+  unsigned delay = 1 << (state.failures - 1);
+  gLog.info("Starting %s again in %u seconds", myProgram.c_str(), delay);
+  state.restartTime = now + delay;
+}
+
+void CLicqAutoReply::restartResponder(size_t index, bool exited)
+{
+  Responder* responder = myResponders[index];
+
+  // Drop requests of the process and start a new one later
+  if (exited)
+    gLog.warning("%s exited unexpectedly", myProgram.c_str());
+  else
+    gLog.warning("Could not pass request to %s", myProgram.c_str());
+  responder->stop();
+
+  std::map<unsigned long, PendingReply>::iterator iter = myPendingReplies.begin();
+  while (iter != myPendingReplies.end())
+  {
+    if (iter->second.responder == index)
+      myPendingReplies.erase(iter++);
+    else
+      ++iter;
+  }
+
+  scheduleRestart(index);
+}
+
+time_t CLicqAutoReply::expireReplies(time_t now)
+{
+  time_t next = 0;
+  std::map<unsigned long, PendingReply>::iterator iter = myPendingReplies.begin();
+  while (iter != myPendingReplies.end())
+  {
+    if (iter->second.deadline <= now)
+    {
+      gLog.warning("%s did not reply in time", myProgram.c_str());
+      myPendingReplies.erase(iter++);
+      continue;
+    }
+
+    if (next == 0 || iter->second.deadline < next)
+      next = iter->second.deadline;
+    ++iter;
+  }
+  return next;
+}
+
+void CLicqAutoReply::stopResponders()
+{
+  BOOST_FOREACH(Responder* responder, myResponders)
+    delete responder;
+  myResponders.clear();
+  myResponderStates.clear();
+  myPendingReplies.clear();
+}
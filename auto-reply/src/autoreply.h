@@ -22,7 +22,12 @@
 
 #include <licq/plugin/generalpluginhelper.h>
 
+#include <ctime>
+#include <map>
 #include <string>
+#include <vector>
+
+#include <licq/userid.h>
 
 
 namespace Licq
@@ -30,7 +35,11 @@ namespace Licq
 class Event;
 class PluginSignal;
 class UserEvent;
-class UserId;
+}
+
+namespace LicqAutoReply
+{
+class Responder;
 }
 
 class CLicqAutoReply : public Licq::GeneralPluginHelper
@@ -57,6 +66,11 @@ protected:
   bool m_bPassMessage, m_bFailOnExitCode, m_bAbortDeleteOnExitCode,
        m_bSendThroughServer;
 
+  // Persistent responder processes
+  bool myPersistent;
+  unsigned myNumResponders;
+  unsigned myTimeout;
+
   void ProcessPipe();
   void ProcessSignal(const Licq::PluginSignal* s);
   void ProcessEvent(const Licq::Event* e);
@@ -78,9 +92,111 @@ protected:
    */
   bool autoReplyEvent(const Licq::UserId& userId, const Licq::UserEvent* event);
 
+  /**
+   * Queue an event to be replied to by a persistent responder
+   *
+   * @param userId Affected user
+   * @param event Event to reply to
+   * @param eventId Id of event
+   */
+  void queueReply(const Licq::UserId& userId, const Licq::UserEvent* event,
+      unsigned long eventId);
+
+  /**
+   * Handle output from a persistent responder
+   *
+   * @param index Index of responder in myResponders
+   */
+  void processResponder(size_t index);
+
+  /**
+   * Restart a persistent responder that has exited or stopped accepting
+   * requests, its outstanding requests are dropped
+   *
+   * @param index Index of responder in myResponders
+   * @param exited True if process exited, false if a request couldn't be written
+   */
+  void restartResponder(size_t index, bool exited);
+
+  /**
+   * Start a persistent responder process, schedules a restart on failure
+   *
+   * @param index Index of responder in myResponders
+   */
+  void startResponder(size_t index);
+
+  /**
+   * Start responders whose restart delay has passed
+   *
+   * @param now Current time
+   * @return Time of next restart or zero if no restarts are scheduled
+   */
+  time_t startResponders(time_t now);
+
+  /**
+   * Schedule a failed responder to be started again
+   * Delay doubles for each failure shortly after start and persistent mode
+   * is given up when there are too many of them.
+   *
+   * @param index Index of responder in myResponders
+   */
+  void scheduleRestart(size_t index);
+
+  /**
+   * Fail requests that have not been answered in time
+   *
+   * @param now Current time
+   * @return Time of next deadline or zero if no requests are pending
+   */
+  time_t expireReplies(time_t now);
+
+  /**
+   * Reply sent or failed, mark event as read if configured
+   *
+   * @param userId Affected user
+   * @param eventId Id of event
+   * @param success True if a reply was sent
+   */
+  void finishReply(const Licq::UserId& userId, unsigned long eventId,
+      bool success);
+
+  /**
+   * Send reply text to a user
+   *
+   * @param userId User to send reply to
+   * @param message Reply text
+   * @return True if message was sent
+   */
+  bool sendReply(const Licq::UserId& userId, const std::string& message);
+
+  void stopResponders();
+
   bool POpen(const char *cmd);
   int PClose();
 
+  struct PendingReply
+  {
+    Licq::UserId userId;
+    unsigned long eventId;
+    size_t responder;
+    time_t deadline;
+  };
+
+  struct ResponderState
+  {
+    ResponderState() : started(0), restartTime(0), failures(0) { }
+
+    time_t started;
+    time_t restartTime;
+    unsigned failures;
+  };
+
+  std::vector<LicqAutoReply::Responder*> myResponders;
+  std::vector<ResponderState> myResponderStates;
+  bool myRespondersFailed;
+  std::map<unsigned long, PendingReply> myPendingReplies;
+  unsigned long myNextRequestId;
+
 protected:
   int pid;
   FILE *fStdOut;
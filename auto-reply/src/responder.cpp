@@ -0,0 +1,238 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "responder.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __sun
+# define _PATH_BSHELL "/bin/sh"
+#else
+# include <paths.h>
+#endif
+
+using LicqAutoReply::Responder;
+using std::string;
+
+Responder::Responder(const string& command)
+  : myCommand(command),
+    myPid(-1),
+    myStdIn(-1),
+    myStdOut(-1)
+{
+  // Empty
+}
+
+Responder::~Responder()
+{
+  stop();
+}
+
+bool Responder::start()
+{
+  if (myPid != -1)
+    return true;
+
+  int in[2];
+  int out[2];
+  if (::pipe(in) < 0)
+    return false;
+  if (::pipe(out) < 0)
+  {
+    ::close(in[0]);
+    ::close(in[1]);
+    return false;
+  }
+
+  pid_t pid = ::fork();
+  if (pid < 0)
+  {
+    ::close(in[0]);
+    ::close(in[1]);
+    ::close(out[0]);
+    ::close(out[1]);
+    return false;
+  }
+
+  // Child
+  if (pid == 0)
+  {
+    ::close(in[1]);
+    ::close(out[0]);
+    ::dup2(in[0], STDIN_FILENO);
+    ::dup2(out[1], STDOUT_FILENO);
+    if (in[0] != STDIN_FILENO)
+      ::close(in[0]);
+    if (out[1] != STDOUT_FILENO)
+      ::close(out[1]);
+
+    ::execl(_PATH_BSHELL, "sh", "-c", myCommand.c_str(), NULL);
+    ::_exit(127);
+  }
+
+  // Parent
+  ::close(in[0]);
+  ::close(out[1]);
+  myPid = pid;
+  myStdIn = in[1];
+  myStdOut = out[0];
+  myBuffer.clear();
+  myOutput.clear();
+
+  // Never let a stuck responder block the plugin thread
+  ::fcntl(myStdIn, F_SETFL, ::fcntl(myStdIn, F_GETFL) | O_NONBLOCK);
+  ::fcntl(myStdOut, F_SETFL, ::fcntl(myStdOut, F_GETFL) | O_NONBLOCK);
+  ::fcntl(myStdIn, F_SETFD, FD_CLOEXEC);
+  ::fcntl(myStdOut, F_SETFD, FD_CLOEXEC);
+  return true;
+}
+
+void Responder::stop()
+{
+  myOutput.clear();
+  if (myStdIn != -1)
+  {
+    ::close(myStdIn);
+    myStdIn = -1;
+  }
+  if (myStdOut != -1)
+  {
+    ::close(myStdOut);
+    myStdOut = -1;
+  }
+  if (myPid == -1)
+    return;
+
+  // Give the process some time to exit by itself before killing it
+  int signal = 0;
+  for (int i = 0; i < 30; ++i)
+  {
+    int r = ::waitpid(myPid, NULL, WNOHANG);
+    if (r == myPid || r == -1)
+      break;
+
+    if (i == 10)
+      signal = SIGTERM;
+    else if (i == 20)
+      signal = SIGKILL;
+    if (signal != 0)
+    {
+      ::kill(myPid, signal);
+      signal = 0;
+    }
+    ::usleep(20*1000);
+  }
+  myPid = -1;
+}
+
+bool Responder::sendRequest(unsigned long id, const string& arguments,
+    const string& message)
+{
+  if (myStdIn == -1)
+    return false;
+
+  char header[64];
+  snprintf(header, sizeof(header), "%lu %lu %lu\n", id,
+      static_cast<unsigned long>(arguments.size()),
+      static_cast<unsigned long>(message.size()));
+  myOutput += header;
+  myOutput += arguments;
+  myOutput += message;
+
+  return sendQueuedRequests();
+}
+
+bool Responder::sendQueuedRequests()
+{
+  if (myStdIn == -1)
+    return false;
+
+  size_t sent = 0;
+  while (sent < myOutput.size())
+  {
+    ssize_t ret = ::write(myStdIn, myOutput.data() + sent, myOutput.size() - sent);
+    if (ret >= 0)
+    {
+      sent += ret;
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      return false;
+
+    // Process is busy, rest will be sent when it is ready for more
+    break;
+  }
+  myOutput.erase(0, sent);
+  return true;
+}
+
+bool Responder::readResponses(std::list<Response>& responses)
+{
+  bool open = true;
+  while (true)
+  {
+    char buf[4096];
+    ssize_t ret = ::read(myStdOut, buf, sizeof(buf));
+    if (ret > 0)
+    {
+      myBuffer.append(buf, ret);
+      continue;
+    }
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      open = false;
+    break;
+  }
+
+  // Parse all complete responses
+  while (true)
+  {
+    size_t eol = myBuffer.find('\n');
+    if (eol == string::npos)
+      break;
+
+    Response response;
+    unsigned long length;
+    string header(myBuffer, 0, eol);
+    if (sscanf(header.c_str(), "%lu %d %lu", &response.id, &response.status,
+        &length) != 3)
+    {
+      // Garbage from process, skip the line
+      myBuffer.erase(0, eol + 1);
+      continue;
+    }
+    if (myBuffer.size() < eol + 1 + length)
+      break;
+
+    response.text.assign(myBuffer, eol + 1, length);
+    myBuffer.erase(0, eol + 1 + length);
+    responses.push_back(response);
+  }
+
+  return open;
+}
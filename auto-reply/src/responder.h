@@ -0,0 +1,133 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef LICQAUTOREPLY_RESPONDER_H
+#define LICQAUTOREPLY_RESPONDER_H
+
+#include <list>
+#include <string>
+#include <sys/types.h>
+
+namespace LicqAutoReply
+{
+
+/**
+ * A long running responder process
+ *
+ * Requests and responses are exchanged over the process' stdin and stdout.
+ * Each request is a header line followed by the arguments and the message:
+ *
+ *   <id> <argument length> <message length>\n<arguments><message>
+ *
+ * and each response is a header line followed by the reply text:
+ *
+ *   <id> <status> <reply length>\n<reply>
+ *
+ * Lengths are in bytes. A non-zero status means the reply should not be
+ * sent. Requests may be pipelined and responses may come in any order.
+ */
+class Responder
+{
+public:
+  struct Response
+  {
+    unsigned long id;
+    int status;
+    std::string text;
+  };
+
+  /**
+   * Constructor
+   *
+   * @param command Command line to start responder with
+   */
+  explicit Responder(const std::string& command);
+
+  /**
+   * Destructor, stops the process if running
+   */
+  ~Responder();
+
+  /**
+   * Start the process
+   *
+   * @return True if process was started
+   */
+  bool start();
+
+  /**
+   * Stop the process
+   * Input is closed first to give the process a chance to exit by itself.
+   */
+  void stop();
+
+  /// Check if process is running
+  bool isRunning() const { return myPid != -1; }
+
+  /// Descriptor to wait on for responses
+  int readFd() const { return myStdOut; }
+
+  /// Descriptor to wait on for room to send queued requests
+  int writeFd() const { return myStdIn; }
+
+  /// Check if there are requests that haven't been passed to the process
+  bool hasQueuedRequests() const { return !myOutput.empty(); }
+
+  /**
+   * Send a request
+   * Never blocks, the part of the request the process isn't ready for is
+   *   queued and sent by sendQueuedRequests().
+   *
+   * @param id Request id to be returned in the response
+   * @param arguments Arguments for this request
+   * @param message Message to reply to
+   * @return False if process isn't running or can't be written to
+   */
+  bool sendRequest(unsigned long id, const std::string& arguments,
+      const std::string& message);
+
+  /**
+   * Send as much of the queued requests as the process will accept
+   * Should be called when writeFd() is writable
+   *
+   * @return False if process can't be written to
+   */
+  bool sendQueuedRequests();
+
+  /**
+   * Read available output from process
+   * Should be called when readFd() is readable
+   *
+   * @param responses List to add complete responses to
+   * @return False if process has closed its output
+   */
+  bool readResponses(std::list<Response>& responses);
+
+private:
+  std::string myCommand;
+  pid_t myPid;
+  int myStdIn;
+  int myStdOut;
+  std::string myBuffer;
+  std::string myOutput;
+};
+
+} // namespace LicqAutoReply
+
+#endif
@@ -33,6 +33,7 @@
 #include "gettext.h"
 #include "icq.h"
 #include "packet-tcp.h"
+#include "sessionloop.h"
 #include "socket.h"
 #include "user.h"
 
@@ -76,7 +77,6 @@ using Licq::FONT_STRIKEOUT;
 using Licq::FONT_UNDERLINE;
 
 #define MAX_CONNECTS  256
-#define DEBUG_THREADS(x)
 
 
 const unsigned short CHAT_STATE_DISCONNECTED = 0;
@@ -737,6 +737,7 @@ bool ChatManager::StartChatServer()
   // Add the server to the sock manager
   sockman.AddSocket(&chatServer);
   sockman.DropSocket(&chatServer);
+  gSessionLoop.addSocket(&chatServer, this);
 
   return true;
 }
@@ -751,15 +752,6 @@ bool ChatManager::StartAsServer()
     return false;
   }
 
-  // Create the socket manager thread
-  if (pthread_create(&thread_chat, NULL, &ChatManager_tep, this) == -1)
-  {
-    PushChatEvent(new IcqChatEvent(CHAT_ERRORxRESOURCES, NULL));
-    return false;
-  }
-
-  m_bThreadCreated = true;
-
   return true;
 }
 
@@ -777,12 +769,14 @@ void ChatManager::StartAsClient(unsigned short nPort)
     m_pChatClient->m_nPort = nPort;
   }
 
-  // Create the socket manager thread
-  if (pthread_create(&thread_chat, NULL, &ChatManager_tep, this) == -1)
+  // Connect in a separate thread, the chat itself is run by gSessionLoop
+  if (pthread_create(&thread_chat, NULL, &ChatConnect_tep, this) == -1)
   {
     PushChatEvent(new IcqChatEvent(CHAT_ERRORxRESOURCES, NULL));
     return;
   }
+
+  m_bThreadCreated = true;
 }
 
 
@@ -876,7 +870,7 @@ bool ChatManager::SendChatHandshake(ChatUser* u)
   CPChat_Color p_color(myName, LocalPort(),
      m_nColorFore[0], m_nColorFore[1], m_nColorFore[2],
      m_nColorBack[0], m_nColorBack[1], m_nColorBack[2]);
-  u->sock.send(*p_color.getBuffer());
+  sendToClient(u, *p_color.getBuffer());
 
   gLog.info(tr("Chat: Waiting for color/font response."));
 
@@ -884,6 +878,7 @@ bool ChatManager::SendChatHandshake(ChatUser* u)
 
   sockman.AddSocket(&u->sock);
   sockman.DropSocket(&u->sock);
+  watchClient(u);
 
   return true;
 }
@@ -911,10 +906,9 @@ void ChatManager::AcceptReverseConnection(DcSocket* s)
   u->state = CHAT_STATE_WAITxFORxCOLOR;
   chatUsers.push_back(u);
 
-  // Reload the socket information
   sockman.AddSocket(&u->sock);
   sockman.DropSocket(&u->sock);
-  myThreadPipe.putChar('R');
+  watchClient(u);
 
   gLog.info(tr("Chat: Received reverse connection."));
 }
@@ -1012,7 +1006,7 @@ bool ChatManager::ProcessPacket(ChatUser* u)
         CPChat_Color p_color(myName, LocalPort(),
         m_nColorFore[0], m_nColorFore[1], m_nColorFore[2],
         m_nColorBack[0], m_nColorBack[1], m_nColorBack[2]);
-        u->sock.send(*p_color.getBuffer());
+        sendToClient(u, *p_color.getBuffer());
 
         gLog.info(tr("Chat: Waiting for color/font response."));
 
@@ -1061,7 +1055,7 @@ bool ChatManager::ProcessPacket(ChatUser* u)
          m_nFontSize, m_nFontFace & FONT_BOLD, m_nFontFace & FONT_ITALIC,
          m_nFontFace & FONT_UNDERLINE, m_nFontFace & FONT_STRIKEOUT,
           myFontFamily, m_nFontEncoding, m_nFontStyle, l);
-      if (!u->sock.send(*p_colorfont.getBuffer()))
+      if (!sendToClient(u, *p_colorfont.getBuffer()))
       {
         gLog.error(tr("Chat: Send error (color/font packet): %s"), u->sock.errorStr().c_str());
         return false;
@@ -1147,7 +1141,7 @@ bool ChatManager::ProcessPacket(ChatUser* u)
          m_nFontSize, m_nFontFace & FONT_BOLD, m_nFontFace & FONT_ITALIC,
          m_nFontFace & FONT_UNDERLINE, m_nFontFace & FONT_STRIKEOUT,
           myFontFamily, m_nFontEncoding, m_nFontStyle);
-      if (!u->sock.send(*p_font.getBuffer()))
+      if (!sendToClient(u, *p_font.getBuffer()))
       {
         gLog.error(tr("Chat: Send error (font packet): %s"), u->sock.errorStr().c_str());
         return false;
@@ -1954,7 +1948,7 @@ bool ChatManager::SendBufferToClient(CBuffer *b, unsigned char cmd, ChatUser* u)
     b_out.Pack(b->getDataStart(), b->getDataSize());
   }
 
-  if (!u->sock.send(b_out))
+  if (!sendToClient(u, b_out))
   {
     gLog.warning(tr("Chat: Send error: %s"), u->sock.errorStr().c_str());
     CloseClient(u);
@@ -1983,7 +1977,7 @@ void ChatManager::SendBuffer_Raw(CBuffer *b)
       // If the socket was closed, ignore the key event
       if (u->state != CHAT_STATE_CONNECTED || u->sock.Descriptor() == -1) continue;
 
-      if (!u->sock.send(*b))
+      if (!sendToClient(u, *b))
       {
         gLog.warning(tr("Chat: Send error: %s"), u->sock.errorStr().c_str());
         CloseClient(u);
@@ -1995,6 +1989,24 @@ void ChatManager::SendBuffer_Raw(CBuffer *b)
 }
 
 
+bool ChatManager::sendToClient(ChatUser* u, const CBuffer& buf)
+{
+  if (!u->sock.sendBuffer(buf))
+    return false;
+
+  // Peer isn't keeping up, send the rest from the loop instead of waiting
+  if (u->sock.hasPendingOutput())
+    watchClient(u);
+  return true;
+}
+
+void ChatManager::watchClient(ChatUser* u)
+{
+  gSessionLoop.addSocket(&u->sock, this,
+      u->sock.hasPendingOutput() ? (POLLIN | POLLOUT) : POLLIN);
+}
+
+
 void ChatManager::SendNewline()
 {
   CBuffer buf(1);
@@ -2223,21 +2235,23 @@ void ChatManager::ChangeColorBg(int r, int g, int b)
 //----ChatManager::CloseChat------------------------------------------------
 void ChatManager::CloseChat()
 {
-  // Close the chat thread
-  // We must do it before trying to close the socket to avoid
-  // the chat thread trying to close the socket itself once
-  // it notices it cannot read from it
-  myThreadPipe.putChar('X');
+  // Wait for connect thread to finish
   if (m_bThreadCreated)
     pthread_join(thread_chat, NULL);
   m_bThreadCreated = false;
 
+  // Stop callbacks from the loop before trying to close the sockets to avoid
+  // the loop trying to close a socket itself once it notices it cannot read
+  // from it
+  gSessionLoop.removeCallback(this);
+
   ChatUser* u = NULL;
   CBuffer buf;
   SendBuffer(&buf, CHAT_DISCONNECTION);
   while (chatUsers.size() > 0)
   {
     u = chatUsers.front();
+    gSessionLoop.removeSocket(&u->sock);
     sockman.CloseSocket(u->sock.Descriptor(), false, false);
     u->state = CHAT_STATE_DISCONNECTED;
     chatUsersClosed.push_back(u);
@@ -2246,6 +2260,7 @@ void ChatManager::CloseChat()
     PushChatEvent(new IcqChatEvent(CHAT_DISCONNECTION, u));
   }
 
+  gSessionLoop.removeSocket(&chatServer);
   sockman.CloseSocket(chatServer.Descriptor(), false, false);
 }
 
@@ -2306,6 +2321,7 @@ void ChatManager::CloseClient(ChatUser* u)
   {
     if (u == *iter)
     {
+      gSessionLoop.removeSocket(&u->sock);
       sockman.CloseSocket(u->sock.Descriptor(), false, false);
       chatUsers.erase(iter);
       u->state = CHAT_STATE_DISCONNECTED;
@@ -2361,120 +2377,87 @@ string ChatManager::userEncoding(const ChatUser* u)
   return getEncoding(u->fontEncoding);
 }
 
-void* LicqIcq::ChatManager_tep(void* arg)
+void ChatManager::socketEvent(int /* id */, Licq::INetSocket* inetSocket,
+    int revents)
 {
-  ChatManager *chatman = (ChatManager *)arg;
+  // Connection on the server port ---------------------------------------
+  if (inetSocket == &chatServer)
+  {
+    if (sockman.Num() >= MAX_CONNECTS)
+    {
+      // Too many sockets, drop this one
+      gLog.warning(tr("Too many connected clients, rejecting new connection."));
+      return;
+    }
 
-  fd_set f;
-  int l, nSocketsAvailable, nCurrentSocket;
+    ChatUser* u = new ChatUser;
+    u->m_pClient = new ChatClient;
 
-  if (chatman->m_pChatClient)
-  {
-    if (!chatman->ConnectToChat(chatman->m_pChatClient))
+    if (chatServer.RecvConnection(u->sock))
     {
-      chatman->PushChatEvent(new IcqChatEvent(CHAT_ERRORxCONNECT, NULL));
-      return NULL;
+      sockman.AddSocket(&u->sock);
+      sockman.DropSocket(&u->sock);
+      gSessionLoop.addSocket(&u->sock, this);
+
+      u->state = CHAT_STATE_HANDSHAKE;
+      chatUsers.push_back(u);
+      gLog.info(tr("Chat: Received connection."));
     }
-    chatman->m_pChatClient = 0;
+    else
+    {
+      delete u;
+      gLog.error(tr("Chat: Unable to receive new connection."));
+    }
+    return;
   }
 
-  while (true)
+  // Socket was closed but removal from the loop is still pending
+  if (revents & POLLNVAL)
+    return;
+
+  // Message from connected socket----------------------------------------
+  ChatUser* u = FindChatUser(inetSocket->Descriptor());
+  if (u == NULL)
   {
-    f = chatman->sockman.socketSet();
-    l = chatman->sockman.LargestSocket() + 1;
+    gLog.warning(tr("Chat: No user owns socket %d."), inetSocket->Descriptor());
+    return;
+  }
 
-    // Add the new socket pipe descriptor
-    FD_SET(chatman->myThreadPipe.getReadFd(), &f);
-    if (chatman->myThreadPipe.getReadFd() >= l)
-      l = chatman->myThreadPipe.getReadFd() + 1;
+  pthread_mutex_lock(&u->mutex);
+  u->sock.Lock();
+  bool ok = true;
 
-    nSocketsAvailable = select(l, &f, NULL, NULL, NULL);
+  // Socket can take more of the data that is waiting to be sent
+  if (revents & POLLOUT)
+  {
+    ok = u->sock.flushOutput();
+    if (!ok)
+      gLog.warning(tr("Chat: Send error: %s"), u->sock.errorStr().c_str());
+    else if (!u->sock.hasPendingOutput())
+      watchClient(u);
+  }
 
-    nCurrentSocket = 0;
-    while (nSocketsAvailable > 0 && nCurrentSocket < l)
-    {
-      if (FD_ISSET(nCurrentSocket, &f))
-      {
-        // New socket event ----------------------------------------------------
-        if (nCurrentSocket == chatman->myThreadPipe.getReadFd())
-        {
-          char buf = chatman->myThreadPipe.getChar();
-          if (buf == 'R')
-          {
-            DEBUG_THREADS("[ChatManager_tep] Reloading socket info.\n");
-          }
-          else if (buf == 'X')
-          {
-            DEBUG_THREADS("[ChatManager_tep] Exiting.\n");
-            pthread_exit(NULL);
-          }
-        }
+  if (ok && (revents & (POLLIN | POLLHUP | POLLERR)))
+  {
+    if (u->state != CHAT_STATE_CONNECTED)
+      ok = ProcessPacket(u);
+    else  // Raw character being received
+      ok = ProcessRaw(u);
+  }
 
-        // Connection on the server port ---------------------------------------
-        else if (nCurrentSocket == chatman->chatServer.Descriptor())
-        {
-          if (chatman->sockman.Num() >= MAX_CONNECTS)
-          {
-            // Too many sockets, drop this one
-            gLog.warning(tr("Too many connected clients, rejecting new connection."));
-          }
-          else
-          {
-            ChatUser* u = new ChatUser;
-            u->m_pClient = new ChatClient;
-
-            if (chatman->chatServer.RecvConnection(u->sock))
-            {
-              chatman->sockman.AddSocket(&u->sock);
-              chatman->sockman.DropSocket(&u->sock);
-
-              u->state = CHAT_STATE_HANDSHAKE;
-              chatman->chatUsers.push_back(u);
-              gLog.info(tr("Chat: Received connection."));
-            }
-            else
-            {
-              delete u;
-              gLog.error(tr("Chat: Unable to receive new connection."));
-            }
-          }
-        }
+  u->sock.Unlock();
+  if (!ok) CloseClient(u);
+  pthread_mutex_unlock(&u->mutex);
+}
 
-        // Message from connected socket----------------------------------------
-        else
-        {
-          ChatUser* u = chatman->FindChatUser(nCurrentSocket);
-          if (u == NULL)
-          {
-            gLog.warning(tr("Chat: No user owns socket %d."), nCurrentSocket);
-          }
-          else
-          {
-            pthread_mutex_lock(&u->mutex);
-            u->sock.Lock();
-            bool ok = true;
-
-            if (u->state != CHAT_STATE_CONNECTED)
-            {
-              ok = chatman->ProcessPacket(u);
-            }
-
-            else  // Raw character being received
-            {
-              ok = chatman->ProcessRaw(u);
-            }
-
-            u->sock.Unlock();
-            if (!ok) chatman->CloseClient(u);
-            pthread_mutex_unlock(&u->mutex);
-          }
-        }
+void* LicqIcq::ChatConnect_tep(void* arg)
+{
+  ChatManager *chatman = (ChatManager *)arg;
+
+  if (!chatman->ConnectToChat(chatman->m_pChatClient))
+    chatman->PushChatEvent(new IcqChatEvent(CHAT_ERRORxCONNECT, NULL));
+  chatman->m_pChatClient = 0;
 
-        nSocketsAvailable--;
-      }
-      nCurrentSocket++;
-    }
-  }
   return NULL;
 }
 
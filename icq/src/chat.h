@@ -27,6 +27,7 @@
 #include <pthread.h>
 #include <string>
 
+#include <licq/mainloop.h>
 #include <licq/pipe.h>
 #include <licq/socketmanager.h>
 
@@ -38,7 +39,7 @@ class CPChat_ColorFond;
 class ChatManager;
 class User;
 
-void* ChatManager_tep(void*);
+void* ChatConnect_tep(void*);
 void* ChatWaitForSignal_tep(void*);
 void ChatWaitForSignal_cleanup(void*);
 
@@ -119,7 +120,8 @@ typedef std::list<Licq::IcqChatEvent*> ChatEventList;
 typedef std::list<ChatManager*> ChatManagerList;
 typedef std::list<pthread_t> ThreadList;
 
-class ChatManager : public Licq::IcqChatManager
+class ChatManager : public Licq::IcqChatManager,
+    private Licq::MainLoopCallback
 {
 public:
   ChatManager(const Licq::UserId& userId);
@@ -169,7 +171,6 @@ private:
   static pthread_mutex_t waiting_thread_cancel_mutex;
 
   Licq::Pipe myEventsPipe;
-  Licq::Pipe myThreadPipe;
   Licq::UserId myUserId;
   unsigned short m_nSession;
   ChatUserList chatUsers;
@@ -204,10 +205,24 @@ private:
   void SendBuffer_Raw(Licq::Buffer*);
   //void SendPacket(Licq::Packet*);
 
+  /**
+   * Send a packet to a client without blocking
+   * Any data that couldn't be sent yet is sent when the socket is writable.
+   */
+  bool sendToClient(ChatUser* u, const Licq::Buffer& buf);
+
+  /**
+   * Update events monitored for a client socket
+   */
+  void watchClient(ChatUser* u);
+
   std::string getEncoding(int chatEncoding);
   std::string userEncoding(const ChatUser* u);
 
-  friend void *ChatManager_tep(void *);
+  // From Licq::MainLoopCallback
+  void socketEvent(int id, Licq::INetSocket* inetSocket, int revents);
+
+  friend void *ChatConnect_tep(void *);
   friend void *ChatWaitForSignal_tep(void *);
   friend void ChatWaitForSignal_cleanup(void *);
 };
@@ -29,6 +29,7 @@
 #include <string>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include <licq/logging/log.h>
 #include <licq/contactlist/owner.h>
@@ -37,10 +38,9 @@
 #include "gettext.h"
 #include "icq.h"
 #include "packet-tcp.h"
+#include "sessionloop.h"
 #include "user.h"
 
-#define DEBUG_THREADS(x)
-
 const unsigned short FT_STATE_DISCONNECTED = 0;
 const unsigned short FT_STATE_HANDSHAKE = 1;
 const unsigned short FT_STATE_WAITxFORxCLIENTxINIT = 2;
@@ -51,6 +51,12 @@ const unsigned short FT_STATE_RECEIVINGxFILE = 6;
 const unsigned short FT_STATE_SENDINGxFILE = 7;
 const unsigned short FT_STATE_CONFIRMINGxFILE = 8;
 
+// File data is sent in packets of this size as other clients expect, but a
+// whole window of packets is read from disk and written to the socket at once
+const size_t FT_DATA_PACKET_SIZE = 2048;
+const size_t FT_SEND_WINDOW_PACKETS = 32;
+const size_t FT_DATA_BUFFER_SIZE = FT_DATA_PACKET_SIZE * FT_SEND_WINDOW_PACKETS;
+
 using namespace LicqIcq;
 using Licq::IcqFileTransferEvent;
 using Licq::Log;
@@ -225,6 +231,14 @@ FileTransferManager::FileTransferManager(const Licq::UserId& userId)
   m_nFileDesc = -1;
   m_nState = FT_STATE_DISCONNECTED;
   m_bThreadCreated = false;
+  myUpdateTimeoutId = 0;
+  myWatchEvents = 0;
+  myFileQueued = false;
+
+  myDataBuffer = new char[FT_DATA_BUFFER_SIZE];
+  myRecvHeaderSize = 0;
+  myRecvPacketLeft = 0;
+  myRecvPacketIsData = false;
 
   myRemoteName = myUserId.accountId();
 
@@ -244,6 +258,7 @@ bool CFileTransferManager::StartFileTransferServer()
   // Add the server to the sock manager
   sockman.AddSocket(&ftServer);
   sockman.DropSocket(&ftServer);
+  gSessionLoop.addSocket(&ftServer, this);
 
   return true;
 }
@@ -283,15 +298,6 @@ bool CFileTransferManager::receiveFiles(const string& directory)
     return false;
   }
 
-  // Create the socket manager thread
-  if (pthread_create(&thread_ft, NULL, &FileTransferManager_tep, this) == -1)
-  {
-    PushFileTransferEvent(Licq::FT_ERRORxRESOURCES);
-    return false;
-  }
-
-  m_bThreadCreated = true;
-
   return true;
 }
 
@@ -330,8 +336,8 @@ void CFileTransferManager::sendFiles(const list<string>& pathNames, unsigned sho
     return;
   }
 
-  // Create the socket manager thread
-  if (pthread_create(&thread_ft, NULL, &FileTransferManager_tep, this) == -1)
+  // Connect in a separate thread, the transfer itself is run by gSessionLoop
+  if (pthread_create(&thread_ft, NULL, &FileTransferConnect_tep, this) == -1)
   {
     PushFileTransferEvent(Licq::FT_ERRORxRESOURCES);
     return;
@@ -416,6 +422,7 @@ bool CFileTransferManager::SendFileHandshake()
 
   sockman.AddSocket(&mySock);
   sockman.DropSocket(&mySock);
+  updateWatch();
 
   return true;
 }
@@ -435,9 +442,7 @@ void CFileTransferManager::AcceptReverseConnection(Licq::TCPSocket* s)
   sockman.DropSocket(&mySock);
 
   m_nState = FT_STATE_WAITxFORxCLIENTxINIT;
-
-  // Reload socket info
-  myThreadPipe.putChar('R');
+  updateWatch();
 
   gLog.info(tr("File Transfer: Received reverse connection."));
 }
@@ -625,82 +630,8 @@ bool CFileTransferManager::ProcessPacket()
 
     case FT_STATE_RECEIVINGxFILE:
     {
-      // if this is the first call to this function...
-      if (m_nBytesTransfered == 0)
-      {
-        m_nStartTime = time(NULL);
-        m_nBatchPos += m_nFilePos;
-        gLog.info(tr("File Transfer: Receiving %s (%ld bytes)."),
-            myFileName.c_str(), m_nFileSize);
-        PushFileTransferEvent(new IcqFileTransferEvent(Licq::FT_STARTxFILE, myPathName));
-        gettimeofday(&tv_lastupdate, NULL);
-      }
-
-      // Write the new data to the file and empty the buffer
-      b.unpackUInt16LE(); // Packet length
-      char nCmd = b.UnpackChar();
-      if (nCmd == 0x05)
-      {
-        unsigned long nSpeed = b.UnpackUnsignedLong();
-        gLog.info(tr("File Transfer: Speed set to %ld%%."), nSpeed);
-        break;
-      }
-
-      if (nCmd != 0x06)
-      {
-        gLog.unknown(tr("File Transfer: Invalid data (%c) ignoring packet"),
-           nCmd);
-        break;
-      }
-
-      errno = 0;
-      size_t nBytesWritten = write(m_nFileDesc, b.getDataPosRead(), b.getDataSize() - 3);
-      if (nBytesWritten != b.getDataSize() - 3)
-      {
-        gLog.error(tr("File Transfer: Write error: %s."),
-            errno == 0 ? "Disk full (?)" : strerror(errno));
-        m_nResult = Licq::FT_ERRORxFILE;
-        return false;
-      }
-
-      m_nFilePos += nBytesWritten;
-      m_nBytesTransfered += nBytesWritten;
-      m_nBatchPos += nBytesWritten;
-      m_nBatchBytesTransfered += nBytesWritten;
-
-      // Check if we need to send an update notification
-      if (m_nUpdatesEnabled)
-      {
-        struct timeval tv_now;
-        gettimeofday(&tv_now, NULL);
-        if (tv_now.tv_sec >= tv_lastupdate.tv_sec + m_nUpdatesEnabled)
-        {
-          PushFileTransferEvent(Licq::FT_UPDATE);
-          tv_lastupdate = tv_now;
-        }
-      }
-
-      int nBytesLeft = m_nFileSize - m_nFilePos;
-      if (nBytesLeft > 0)
-        break;
-
-      close(m_nFileDesc);
-      m_nFileDesc = -1;
-      if (nBytesLeft == 0) // File transfer done perfectly
-      {
-        gLog.info(tr("File Transfer: %s received."), myFileName.c_str());
-      }
-      else // nBytesLeft < 0
-      {
-        // Received too many bytes for the given size of the current file
-        gLog.warning(tr("File Transfer: %s received %d too many bytes."),
-            myFileName.c_str(), -nBytesLeft);
-      }
-      // Notify Plugin
-      PushFileTransferEvent(new IcqFileTransferEvent(Licq::FT_DONExFILE, myPathName));
-
-      // Now wait for a disconnect or another file
-      m_nState = FT_STATE_WAITxFORxFILExINFO;
+      // File data is read by ReceiveFileData, shouldn't get here
+      b.log(Log::Unknown, tr("File Transfer: Unexpected packet while receiving file"));
       break;
     }
 
@@ -794,6 +725,7 @@ bool CFileTransferManager::ProcessPacket()
       }
 
       m_nState = FT_STATE_SENDINGxFILE;
+      updateWatch();
       break;
     }
 
@@ -882,15 +814,177 @@ bool CFileTransferManager::startReceivingFile(const string& fileName)
     return false;
   }
 
+  myRecvHeaderSize = 0;
+  myRecvPacketLeft = 0;
   m_nState = FT_STATE_RECEIVINGxFILE;
   return true;
 }
 
+//-----CFileTransferManager::ReceiveFileData---------------------------------
+/*
+ * Reads file data directly from the socket in large chunks instead of one
+ * packet at a time. The data packets are unwrapped in place and the data is
+ * written to the file with a single write for each read.
+ * Reads are limited so they never go past the last packet of the current
+ * file, anything that follows is left in the socket for ProcessPacket.
+ */
+bool CFileTransferManager::ReceiveFileData()
+{
+  // if this is the first call to this function...
+  if (m_nBytesTransfered == 0 && myRecvHeaderSize == 0)
+  {
+    m_nStartTime = time(NULL);
+    m_nBatchPos += m_nFilePos;
+    gLog.info(tr("File Transfer: Receiving %s (%ld bytes)."),
+        myFileName.c_str(), m_nFileSize);
+    PushFileTransferEvent(new IcqFileTransferEvent(Licq::FT_STARTxFILE, myPathName));
+    gettimeofday(&tv_lastupdate, NULL);
+    startUpdateTimer();
+  }
+
+  // Calculate how much we know is left of the stream for this file, with at
+  //   least a three byte header (length and command) for each packet
+  unsigned long nFileLeft = (m_nFilePos < m_nFileSize ? m_nFileSize - m_nFilePos : 0);
+  size_t nMaxRead;
+  if (myRecvHeaderSize < 3)
+    nMaxRead = 3 - myRecvHeaderSize + nFileLeft;
+  else if (myRecvPacketIsData)
+    nMaxRead = myRecvPacketLeft +
+        (nFileLeft > myRecvPacketLeft ? 3 + nFileLeft - myRecvPacketLeft : 0);
+  else
+    nMaxRead = myRecvPacketLeft + (nFileLeft > 0 ? 3 + nFileLeft : 0);
+  if (nMaxRead > FT_DATA_BUFFER_SIZE)
+    nMaxRead = FT_DATA_BUFFER_SIZE;
+
+  ssize_t nBytesRead = mySock.receive(myDataBuffer, nMaxRead);
+  if (nBytesRead < 0)
+  {
+    if (mySock.Error() == 0)
+      gLog.info(tr("File Transfer: Remote end disconnected."));
+    else
+      gLog.warning(tr("File Transfer: Lost remote end: %s"), mySock.errorStr().c_str());
+    m_nResult = Licq::FT_ERRORxCLOSED;
+    return false;
+  }
+
+  // Strip the packet headers, moving the file data down in the buffer
+  const char* pos = myDataBuffer;
+  const char* end = myDataBuffer + nBytesRead;
+  char* dataEnd = myDataBuffer;
+  while (pos < end)
+  {
+    if (myRecvHeaderSize < 2)
+    {
+      myRecvHeader[myRecvHeaderSize++] = *pos++;
+      if (myRecvHeaderSize == 2)
+      {
+        myRecvPacketLeft = myRecvHeader[0] | (myRecvHeader[1] << 8);
+        // Handle empty packets in case we ever get one
+        if (myRecvPacketLeft == 0)
+          myRecvHeaderSize = 0;
+      }
+      continue;
+    }
+
+    if (myRecvHeaderSize == 2)
+    {
+      char nCmd = *pos++;
+      --myRecvPacketLeft;
+      myRecvHeaderSize = 3;
+      myRecvPacketIsData = (nCmd == 0x06);
+      if (!myRecvPacketIsData)
+        myRecvControl.assign(1, nCmd);
+    }
+    else
+    {
+      size_t n = end - pos;
+      if (n > myRecvPacketLeft)
+        n = myRecvPacketLeft;
+      if (myRecvPacketIsData)
+      {
+        memmove(dataEnd, pos, n);
+        dataEnd += n;
+      }
+      else
+        myRecvControl.append(pos, n);
+      pos += n;
+      myRecvPacketLeft -= n;
+    }
+
+    if (myRecvPacketLeft == 0)
+    {
+      myRecvHeaderSize = 0;
+      if (!myRecvPacketIsData)
+        ProcessControlPacket();
+    }
+  }
+
+  size_t nDataSize = dataEnd - myDataBuffer;
+  if (nDataSize > 0)
+  {
+    errno = 0;
+    ssize_t nBytesWritten = write(m_nFileDesc, myDataBuffer, nDataSize);
+    if (nBytesWritten < 0 || (size_t)nBytesWritten != nDataSize)
+    {
+      gLog.error(tr("File Transfer: Write error: %s."),
+          errno == 0 ? "Disk full (?)" : strerror(errno));
+      m_nResult = Licq::FT_ERRORxFILE;
+      return false;
+    }
+
+    m_nFilePos += nBytesWritten;
+    fileDataTransfered(nBytesWritten);
+  }
+
+  // Wait for the rest of the file or of the last packet
+  if (m_nFilePos < m_nFileSize || myRecvHeaderSize != 0)
+    return true;
+
+  close(m_nFileDesc);
+  m_nFileDesc = -1;
+  stopUpdateTimer();
+  if (m_nFilePos == m_nFileSize) // File transfer done perfectly
+  {
+    gLog.info(tr("File Transfer: %s received."), myFileName.c_str());
+  }
+  else
+  {
+    // Received too many bytes for the given size of the current file
+    gLog.warning(tr("File Transfer: %s received %lu too many bytes."),
+        myFileName.c_str(), m_nFilePos - m_nFileSize);
+  }
+  // Notify Plugin
+  PushFileTransferEvent(new IcqFileTransferEvent(Licq::FT_DONExFILE, myPathName));
+
+  // Now wait for a disconnect or another file
+  m_nState = FT_STATE_WAITxFORxFILExINFO;
+  return true;
+}
+
+//-----CFileTransferManager::ProcessControlPacket----------------------------
+void CFileTransferManager::ProcessControlPacket()
+{
+  CBuffer b(myRecvControl.size());
+  b.packRaw(myRecvControl);
+  char nCmd = b.UnpackChar();
+  if (nCmd == 0x05 && b.remainingDataToRead() >= 4)
+  {
+    unsigned long nSpeed = b.UnpackUnsignedLong();
+    gLog.info(tr("File Transfer: Speed set to %ld%%."), nSpeed);
+    return;
+  }
+
+  gLog.unknown(tr("File Transfer: Invalid data (%c) ignoring packet"), nCmd);
+}
+
 //-----CFileTransferManager::SendFilePacket----------------------------------
+/*
+ * Sends a window of data packets with a single read from the file and a
+ * single vectored write to the socket. The packet headers are kept
+ * separately so the file data never has to be copied into packet buffers.
+ */
 bool CFileTransferManager::SendFilePacket()
 {
-  static char pSendBuf[2048];
-
   if (m_nBytesTransfered == 0)
   {
     m_nStartTime = time(NULL);
@@ -899,64 +993,81 @@ bool CFileTransferManager::SendFilePacket()
         myPathName.c_str(), m_nFileSize);
     PushFileTransferEvent(new IcqFileTransferEvent(Licq::FT_STARTxFILE, myPathName));
     gettimeofday(&tv_lastupdate, NULL);
+    startUpdateTimer();
   }
 
-  int nBytesToSend = m_nFileSize - m_nFilePos;
-  if (nBytesToSend > 2048) nBytesToSend = 2048;
-  if (read(m_nFileDesc, pSendBuf, nBytesToSend) != nBytesToSend)
+  size_t nBytesToSend = (m_nFilePos < m_nFileSize ? m_nFileSize - m_nFilePos : 0);
+  if (nBytesToSend > FT_DATA_BUFFER_SIZE)
+    nBytesToSend = FT_DATA_BUFFER_SIZE;
+  if (read(m_nFileDesc, myDataBuffer, nBytesToSend) != (ssize_t)nBytesToSend)
   {
     gLog.error(tr("File Transfer: Error reading from %s: %s."),
         myPathName.c_str(), strerror(errno));
     m_nResult = Licq::FT_ERRORxFILE;
     return false;
   }
-  CBuffer xSendBuf(nBytesToSend + 1);
-  xSendBuf.PackChar(0x06);
-  xSendBuf.Pack(pSendBuf, nBytesToSend);
-  if (!SendBuffer(&xSendBuf))
+
+  // Split the data into packets, an empty file still gets one empty packet
+  unsigned char headers[FT_SEND_WINDOW_PACKETS][3];
+  struct iovec iov[FT_SEND_WINDOW_PACKETS * 2];
+  int iovcnt = 0;
+  size_t nOffset = 0;
+  for (size_t i = 0; i == 0 || nOffset < nBytesToSend; ++i)
   {
+    size_t nPacketSize = nBytesToSend - nOffset;
+    if (nPacketSize > FT_DATA_PACKET_SIZE)
+      nPacketSize = FT_DATA_PACKET_SIZE;
+
+    // Length (including command) and data command
+    headers[i][0] = (nPacketSize + 1) & 0xFF;
+    headers[i][1] = ((nPacketSize + 1) >> 8) & 0xFF;
+    headers[i][2] = 0x06;
+    iov[iovcnt].iov_base = headers[i];
+    iov[iovcnt].iov_len = 3;
+    ++iovcnt;
+    if (nPacketSize > 0)
+    {
+      iov[iovcnt].iov_base = myDataBuffer + nOffset;
+      iov[iovcnt].iov_len = nPacketSize;
+      ++iovcnt;
+    }
+    nOffset += nPacketSize;
+  }
+
+  if (!mySock.sendv(iov, iovcnt))
+  {
+    gLog.warning(tr("File Transfer: Send error: %s"), mySock.errorStr().c_str());
     m_nResult = Licq::FT_ERRORxCLOSED;
     return false;
   }
 
   m_nFilePos += nBytesToSend;
-  m_nBytesTransfered += nBytesToSend;
+  fileDataTransfered(nBytesToSend);
 
-  m_nBatchPos += nBytesToSend;
-  m_nBatchBytesTransfered += nBytesToSend;
-
-  // Check if we need to send an update notification
-  if (m_nUpdatesEnabled)
+  if (m_nFilePos < m_nFileSize)
   {
-    struct timeval tv_now;
-    gettimeofday(&tv_now, NULL);
-    if (tv_now.tv_sec >= tv_lastupdate.tv_sec + m_nUpdatesEnabled)
-    {
-      PushFileTransferEvent(Licq::FT_UPDATE);
-      tv_lastupdate = tv_now;
-    }
+    // More bytes to send so go away until the socket is free again
+    return true;
   }
 
-  int nBytesLeft = m_nFileSize - m_nFilePos;
-  if (nBytesLeft > 0)
+  if (mySock.hasPendingOutput())
   {
-    // More bytes to send so go away until the socket is free again
+    // Finish the file when the last data has left the socket
+    myFileQueued = true;
     return true;
   }
 
-  // Only get here if we are done
+  return fileSent();
+}
+
+//-----CFileTransferManager::fileSent-----------------------------------------
+bool CFileTransferManager::fileSent()
+{
   close(m_nFileDesc);
   m_nFileDesc = -1;
+  stopUpdateTimer();
 
-  if (nBytesLeft == 0)
-  {
-    gLog.info(tr("File Transfer: Sent %s."), myFileName.c_str());
-  }
-  else // nBytesLeft < 0
-  {
-    gLog.info(tr("File Transfer: Sent %s, %d too many bytes."),
-        myFileName.c_str(), -nBytesLeft);
-  }
+  gLog.info(tr("File Transfer: Sent %s."), myFileName.c_str());
   PushFileTransferEvent(new IcqFileTransferEvent(Licq::FT_DONExFILE, myPathName));
 
   // Go to the next file, if no more then close connections
@@ -988,6 +1099,7 @@ bool CFileTransferManager::SendFilePacket()
     myPathName = *myPathNameIter;
 
     m_nState = FT_STATE_WAITxFORxSTART;
+    updateWatch();
   }
 
   return true;
@@ -995,6 +1107,26 @@ bool CFileTransferManager::SendFilePacket()
 
 
 
+//-----CFileTransferManager::fileDataTransfered------------------------------
+void CFileTransferManager::fileDataTransfered(unsigned long nBytes)
+{
+  m_nBytesTransfered += nBytes;
+  m_nBatchPos += nBytes;
+  m_nBatchBytesTransfered += nBytes;
+
+  // Check if we need to send an update notification
+  if (m_nUpdatesEnabled)
+  {
+    struct timeval tv_now;
+    gettimeofday(&tv_now, NULL);
+    if (tv_now.tv_sec >= tv_lastupdate.tv_sec + m_nUpdatesEnabled)
+    {
+      PushFileTransferEvent(Licq::FT_UPDATE);
+      tv_lastupdate = tv_now;
+    }
+  }
+}
+
 //-----CFileTransferManager::PopFileTransferEvent------------------------------
 IcqFileTransferEvent *CFileTransferManager::PopFileTransferEvent()
 {
@@ -1040,7 +1172,7 @@ bool CFileTransferManager::SendPacket(CPacket *p)
 //-----CFileTransferManager::SendBuffer----------------------------------------------
 bool CFileTransferManager::SendBuffer(CBuffer *b)
 {
-  if (!mySock.send(*b))
+  if (!mySock.sendBuffer(*b))
   {
     gLog.warning(tr("File Transfer: Send error: %s"), mySock.errorStr().c_str());
     return false;
@@ -1067,12 +1199,14 @@ void CFileTransferManager::ChangeSpeed(unsigned short nSpeed)
 //----CFileTransferManager::CloseFileTransfer--------------------------------
 void CFileTransferManager::CloseFileTransfer()
 {
-  // Close the thread
-  myThreadPipe.putChar('X');
+  // Wait for connect thread to finish
   if (m_bThreadCreated)
     pthread_join(thread_ft, NULL);
   m_bThreadCreated = false;
 
+  // Make sure there are no more callbacks before closing the sockets
+  gSessionLoop.removeCallback(this);
+
   CloseConnection();
 }
 
@@ -1080,9 +1214,14 @@ void CFileTransferManager::CloseFileTransfer()
 //----CFileTransferManager::CloseConnection----------------------------------
 void CFileTransferManager::CloseConnection()
 {
+  stopUpdateTimer();
+  gSessionLoop.removeSocket(&ftServer);
+  gSessionLoop.removeSocket(&mySock);
   sockman.CloseSocket(ftServer.Descriptor(), false, false);
   sockman.CloseSocket(mySock.Descriptor(), false, false);
   m_nState = FT_STATE_DISCONNECTED;
+  myWatchEvents = 0;
+  myFileQueued = false;
 
   if (m_nFileDesc != -1)
   {
@@ -1093,165 +1232,151 @@ void CFileTransferManager::CloseConnection()
 
 
 
-void* LicqIcq::FileTransferManager_tep(void* arg)
+//----CFileTransferManager::updateWatch--------------------------------------
+void CFileTransferManager::updateWatch()
 {
-  CFileTransferManager *ftman = (CFileTransferManager *)arg;
+  if (mySock.Descriptor() == -1)
+    return;
 
-  fd_set f_recv, f_send;
-  struct timeval *tv;
-  struct timeval tv_updates = { 2, 0 };
-  int l, nSocketsAvailable, nCurrentSocket;
+  // Socket must be watched for writing while sending the file or while
+  //   there is queued data that couldn't be sent without blocking
+  int events = POLLIN;
+  if (m_nState == FT_STATE_SENDINGxFILE || mySock.hasPendingOutput())
+    events |= POLLOUT;
+  if (events == myWatchEvents)
+    return;
 
-  if (!ftman->isReceiver())
-  {
-    if (!ftman->ConnectToFileServer(ftman->m_nPort))
-    {
-      ftman->PushFileTransferEvent(Licq::FT_ERRORxCONNECT);
-      return NULL;
-    }
-  }
-  else if (!ftman->isReceiver())
-    return NULL;
+  gSessionLoop.addSocket(&mySock, this, events);
+  myWatchEvents = events;
+}
 
-  while (true)
-  {
-    f_recv = ftman->sockman.socketSet();
-    l = ftman->sockman.LargestSocket() + 1;
+void CFileTransferManager::startUpdateTimer()
+{
+  if (m_nUpdatesEnabled == 0 || myUpdateTimeoutId != 0)
+    return;
 
-    // Add the new socket pipe descriptor
-    FD_SET(ftman->myThreadPipe.getReadFd(), &f_recv);
-    if (ftman->myThreadPipe.getReadFd() >= l)
-      l = ftman->myThreadPipe.getReadFd() + 1;
+  myUpdateTimeoutId = gSessionLoop.addTimeout(m_nUpdatesEnabled * 1000, this, false);
+}
 
-    // Set up the send descriptor
-    FD_ZERO(&f_send);
-    if (ftman->m_nState == FT_STATE_SENDINGxFILE)
-    {
-      FD_SET(ftman->mySock.Descriptor(), &f_send);
-      // No need to check "l" as mySock is already in the read list
-    }
+void CFileTransferManager::stopUpdateTimer()
+{
+  if (myUpdateTimeoutId == 0)
+    return;
 
-    // Prepare max timeout if necessary
-    if (ftman->m_nUpdatesEnabled &&
-        (ftman->m_nState == FT_STATE_SENDINGxFILE ||
-         ftman->m_nState == FT_STATE_RECEIVINGxFILE) )
+  gSessionLoop.removeTimeout(myUpdateTimeoutId);
+  myUpdateTimeoutId = 0;
+}
+
+void CFileTransferManager::socketEvent(int /* id */, Licq::INetSocket* inetSocket,
+    int revents)
+{
+  // Connection on the server port ---------------------------------------
+  if (inetSocket == &ftServer)
+  {
+    if (mySock.Descriptor() != -1)
     {
-      tv_updates.tv_sec = ftman->m_nUpdatesEnabled;
-      tv_updates.tv_usec = 0;
-      tv = &tv_updates;
+      gLog.warning(tr("File Transfer: Receiving repeat incoming connection."));
+
+      // Dump the extra connection to clear the listen socket queue
+      Licq::TCPSocket ts;
+      if (ftServer.RecvConnection(ts))
+        ts.CloseConnection();
     }
     else
     {
-      tv = NULL;
-    }
+      if (ftServer.RecvConnection(mySock))
+      {
+        sockman.AddSocket(&mySock);
+        sockman.DropSocket(&mySock);
 
-    nSocketsAvailable = select(l, &f_recv, &f_send, NULL, tv);
+        m_nState = FT_STATE_HANDSHAKE;
+        updateWatch();
+        gLog.info(tr("File Transfer: Received connection."));
+      }
+      else
+      {
+        gLog.error(tr("File Transfer: Unable to receive new connection."));
+      }
+    }
+    return;
+  }
 
-    if (nSocketsAvailable == -1)
-    {
-      // Something is very wrong, most likely we've lost control of a file
-      //   descriptor and select will continue to fail causing this thread to
-      //   spin so better to just give up and exit.
+  if (inetSocket != &mySock)
+  {
+    gLog.warning(tr("File Transfer: No such socket."));
+    return;
+  }
 
-      gLog.warning(tr("File Transfer: select failed, aborting thread: %s"), strerror(errno));
-      pthread_exit(NULL);
-    }
+  // Socket was closed but removal from the loop is still pending
+  if (revents & POLLNVAL)
+    return;
 
-    // Check if we timed out
-    if (tv != NULL && nSocketsAvailable == 0)
+  bool ok = true;
+  mySock.Lock();
+  // Message from connected socket----------------------------------------
+  if (revents & (POLLIN | POLLHUP | POLLERR))
+  {
+    if (m_nState == FT_STATE_RECEIVINGxFILE)
+      ok = ReceiveFileData();
+    else
+      ok = ProcessPacket();
+  }
+  // Socket ready for more data------------------------------------------
+  else if (revents & POLLOUT)
+  {
+    ok = mySock.flushOutput();
+    if (!ok)
     {
-      ftman->PushFileTransferEvent(Licq::FT_UPDATE);
-      gettimeofday(&ftman->tv_lastupdate, NULL);
+      gLog.warning(tr("File Transfer: Send error: %s"), mySock.errorStr().c_str());
+      m_nResult = Licq::FT_ERRORxCLOSED;
     }
-
-    nCurrentSocket = 0;
-    while (nSocketsAvailable > 0 && nCurrentSocket < l)
+    else if (!mySock.hasPendingOutput() && m_nState == FT_STATE_SENDINGxFILE)
     {
-      if (FD_ISSET(nCurrentSocket, &f_recv))
+      if (myFileQueued)
       {
-        // New socket event ----------------------------------------------------
-        if (nCurrentSocket == ftman->myThreadPipe.getReadFd())
-        {
-          char buf = ftman->myThreadPipe.getChar();
-          if (buf == 'R')
-          {
-            DEBUG_THREADS("[FileTransferManager_tep] Reloading socket info.\n");
-          }
-          else if (buf == 'X')
-          {
-            DEBUG_THREADS("[FileTransferManager_tep] Exiting.\n");
-            pthread_exit(NULL);
-          }
-        }
+        myFileQueued = false;
+        ok = fileSent();
+      }
+      else
+        ok = SendFilePacket();
+    }
+  }
+  if (ok)
+    updateWatch();
+  mySock.Unlock();
 
-        // Connection on the server port ---------------------------------------
-        else if (nCurrentSocket == ftman->ftServer.Descriptor())
-        {
-          if (ftman->mySock.Descriptor() != -1)
-          {
-            gLog.warning(tr("File Transfer: Receiving repeat incoming connection."));
+  if (!ok)
+  {
+    CloseConnection();
+    PushFileTransferEvent(m_nResult);
+  }
+}
 
-            // Dump the extra connection to clear the listen socket queue
-            Licq::TCPSocket ts;
-            if (ftman->ftServer.RecvConnection(ts))
-              ts.CloseConnection();
-          }
-          else
-          {
-            if (ftman->ftServer.RecvConnection(ftman->mySock))
-            {
-              ftman->sockman.AddSocket(&ftman->mySock);
-              ftman->sockman.DropSocket(&ftman->mySock);
-
-              ftman->m_nState = FT_STATE_HANDSHAKE;
-              gLog.info(tr("File Transfer: Received connection."));
-            }
-            else
-            {
-              gLog.error(tr("File Transfer: Unable to receive new connection."));
-            }
-          }
-        }
+void CFileTransferManager::timeoutEvent(int id)
+{
+  if (id != myUpdateTimeoutId)
+    return;
 
-        // Message from connected socket----------------------------------------
-        else if (nCurrentSocket == ftman->mySock.Descriptor())
-        {
-          ftman->mySock.Lock();
-          bool ok = ftman->ProcessPacket();
-          ftman->mySock.Unlock();
-          if (!ok)
-          {
-            ftman->CloseConnection();
-            ftman->PushFileTransferEvent(ftman->m_nResult);
-          }
-        }
+  if (m_nState != FT_STATE_SENDINGxFILE && m_nState != FT_STATE_RECEIVINGxFILE)
+    return;
 
-        else
-        {
-          gLog.warning(tr("File Transfer: No such socket."));
-        }
+  // Only send an update if the transfer hasn't done so itself recently
+  struct timeval tv_now;
+  gettimeofday(&tv_now, NULL);
+  if (tv_now.tv_sec >= tv_lastupdate.tv_sec + m_nUpdatesEnabled)
+  {
+    PushFileTransferEvent(Licq::FT_UPDATE);
+    tv_lastupdate = tv_now;
+  }
+}
 
-        nSocketsAvailable--;
-      }
-      else if (FD_ISSET(nCurrentSocket, &f_send))
-      {
-        if (nCurrentSocket == ftman->mySock.Descriptor())
-        {
-          ftman->mySock.Lock();
-          bool ok = ftman->SendFilePacket();
-          ftman->mySock.Unlock();
-          if (!ok)
-          {
-            ftman->CloseConnection();
-            ftman->PushFileTransferEvent(ftman->m_nResult);
-          }
-        }
-        nSocketsAvailable--;
-      }
+void* LicqIcq::FileTransferConnect_tep(void* arg)
+{
+  CFileTransferManager *ftman = (CFileTransferManager *)arg;
+
+  if (!ftman->ConnectToFileServer(ftman->m_nPort))
+    ftman->PushFileTransferEvent(Licq::FT_ERRORxCONNECT);
 
-      nCurrentSocket++;
-    }
-  }
   return NULL;
 }
 
@@ -1316,7 +1441,6 @@ void* LicqIcq::FileWaitForSignal_tep(void* arg)
     {
       rc->m->mySock.TransferConnectionFrom(s);
       bConnected = rc->m->SendFileHandshake();
-      rc->m->myThreadPipe.putChar('R');
     }
   }
 
@@ -1359,6 +1483,8 @@ FileTransferManager::~FileTransferManager()
 
   CloseFileTransfer();
 
+  delete [] myDataBuffer;
+
   // Delete any pending events
   IcqFileTransferEvent *e = NULL;
   while (ftEvents.size() > 0)
@@ -22,6 +22,7 @@
 
 #include <licq/icq/filetransfer.h>
 
+#include <licq/mainloop.h>
 #include <licq/pipe.h>
 #include <licq/socketmanager.h>
 
@@ -36,7 +37,7 @@ namespace LicqIcq
 {
 class FileTransferManager;
 
-void *FileTransferManager_tep(void *);
+void *FileTransferConnect_tep(void *);
 void *FileWaitForSignal_tep(void *);
 void FileWaitForSignal_cleanup(void *);
 
@@ -50,7 +51,8 @@ struct SFileReverseConnectInfo
   FileTransferManager* m;
 };
 
-class FileTransferManager : public Licq::IcqFileTransferManager
+class FileTransferManager : public Licq::IcqFileTransferManager,
+    private Licq::MainLoopCallback
 {
 public:
   FileTransferManager(const Licq::UserId& userId);
@@ -77,7 +79,6 @@ private:
   bool m_bThreadRunning;
   pthread_t m_tThread;
   Licq::Pipe myEventsPipe;
-  Licq::Pipe myThreadPipe;
   pthread_t thread_ft;
   bool m_bThreadCreated;
 
@@ -89,6 +90,17 @@ private:
 
   unsigned short m_nPort;
   int m_nFileDesc;
+
+  // Buffer for file data, used for sending or receiving depending on direction
+  char* myDataBuffer;
+
+  // Framing state for the streaming receive of file data
+  unsigned char myRecvHeader[2];
+  unsigned short myRecvHeaderSize;
+  unsigned short myRecvPacketLeft;
+  bool myRecvPacketIsData;
+  std::string myRecvControl;
+
   std::list<std::string>::iterator myPathNameIter;
 
   FileTransferEventList ftEvents;
@@ -96,12 +108,19 @@ private:
   Licq::TCPSocket ftServer;
   DcSocket mySock;
   Licq::SocketManager sockman;
+  int myUpdateTimeoutId;
+  int myWatchEvents;
+  bool myFileQueued;
 
   bool StartFileTransferServer();
   bool ConnectToFileServer(unsigned short nPort);
   bool SendFileHandshake();
   bool ProcessPacket();
+  bool ReceiveFileData();
+  void ProcessControlPacket();
   bool SendFilePacket();
+  bool fileSent();
+  void fileDataTransfered(unsigned long nBytes);
   void PushFileTransferEvent(unsigned char t);
   void PushFileTransferEvent(Licq::IcqFileTransferEvent* e);
   void CloseConnection();
@@ -109,7 +128,15 @@ private:
   bool SendBuffer(Licq::Buffer*);
   bool SendPacket(Licq::Packet*);
 
-friend void *FileTransferManager_tep(void *);
+  void updateWatch();
+  void startUpdateTimer();
+  void stopUpdateTimer();
+
+  // From Licq::MainLoopCallback
+  void socketEvent(int id, Licq::INetSocket* inetSocket, int revents);
+  void timeoutEvent(int id);
+
+friend void *FileTransferConnect_tep(void *);
 friend void *FileWaitForSignal_tep(void *);
 friend void FileWaitForSignal_cleanup(void *);
 
@@ -1553,6 +1553,7 @@ void IcqProtocol::postLogoff(int nSD, Licq::Event* cancelledEvent)
       m_xBARTService->ResetSocket();
       m_xBARTService->ChangeStatus(STATUS_UNINITIALIZED);
       m_xBARTService->ClearQueue();
+      m_xBARTService->failPendingIcons();
     }
   }
   pthread_mutex_lock(&mutex_runningevents);
@@ -46,6 +46,7 @@
 #include <licq/translator.h>
 #include <licq/userevents.h>
 #include <licq/logging/log.h>
+#include <licq/thread/mutexlocker.h>
 #include <licq/version.h>
 
 #include "filetransfer.h"
@@ -519,19 +520,15 @@ void IcqProtocol::icqRequestPicture(const Licq::ProtocolSignal* ps)
     useBart = o->useBart();
   }
 
-  size_t iconHashSize;
   {
-    UserReadGuard user(ps->userId());
+    UserWriteGuard user(ps->userId());
     if (!user.isLocked())
       return;
 
-    iconHashSize = user->buddyIconHash().size();
+    if (useBart && user->buddyIconHash().size() > 0)
+      return m_xBARTService->requestBuddyIcon(ps->callerThread(), ps->eventId(), *user);
   }
 
-  if (useBart && iconHashSize > 0)
-    return m_xBARTService->SendEvent(ps->callerThread(), ps->eventId(), ps->userId(),
-        ICQ_SNACxBART_DOWNLOADxREQUEST, true);
-
   icqRequestPluginInfo(ps->userId(), Licq::IcqProtocol::PluginPicture, false, ps);
 }
 
@@ -1039,6 +1036,38 @@ int IcqProtocol::connectToUser(const Licq::UserId& userId, int channel)
 
 
 
+void IcqProtocol::logDirectConnectionStats()
+{
+  Licq::MutexLocker statsLocker(myDirectStatsMutex);
+  unsigned long total = myDirectReused + myDirectConnects;
+  if (total == myDirectStatsLogged)
+    return;
+  myDirectStatsLogged = total;
+
+  unsigned long connects = myDirectConnects - myDirectConnectFailures;
+  gLog.debug("Direct connections: %lu reused, %lu connected (%lu ms average), "
+      "%lu failed", myDirectReused, connects,
+      (connects > 0 ? myDirectConnectMsec / connects : 0),
+      myDirectConnectFailures);
+}
+
+void IcqProtocol::countDirectReuse()
+{
+  Licq::MutexLocker statsLocker(myDirectStatsMutex);
+  ++myDirectReused;
+}
+
+void IcqProtocol::countDirectConnect(bool success, unsigned long msec)
+{
+  Licq::MutexLocker statsLocker(myDirectStatsMutex);
+  ++myDirectConnects;
+  if (success)
+    myDirectConnectMsec += msec;
+  else
+    ++myDirectConnectFailures;
+}
+
+
 /*------------------------------------------------------------------------------
  * OpenConnectionToUser
  *
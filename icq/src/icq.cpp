@@ -50,6 +50,7 @@
 #include "packet-srv.h"
 #include "packet-tcp.h"
 #include "protocolsignal.h"
+#include "sessionloop.h"
 #include "socket.h"
 #include "user.h"
 
@@ -123,6 +124,12 @@ void IcqProtocol::initialize()
 
   myMaxUsersPerPacket = 100;
 
+  myDirectReused = 0;
+  myDirectConnects = 0;
+  myDirectConnectFailures = 0;
+  myDirectConnectMsec = 0;
+  myDirectStatsLogged = 0;
+
   // Proxy
   m_xProxy = NULL;
 
@@ -144,6 +151,9 @@ bool IcqProtocol::start()
 {
   MonitorSockets_func();
 
+  // Stop the thread running chat and file transfer sessions
+  gSessionLoop.shutdown();
+
   // Cancel the ping thread
   pthread_cancel(thread_ping);
 
@@ -578,6 +588,8 @@ Licq::Event* IcqProtocol::SendExpectEvent_Client(const Licq::ProtocolSignal* ps,
         packet, Licq::Event::ConnectUser, pUser->id(), ue);
   e->myCommand = eventCommandFromPacket(packet);
   e->myFlags |= Licq::Event::FlagDirect;
+  if (e->m_nSocketDesc != -1)
+    countDirectReuse();
 
   return SendExpectEvent(e, &ProcessRunningEvent_Client_tep);
 }
@@ -32,6 +32,7 @@
 #include <licq/oneventmanager.h>
 #include <licq/pipe.h>
 #include <licq/socketmanager.h>
+#include <licq/thread/mutex.h>
 #include <licq/userid.h>
 
 #include "buffer.h"
@@ -269,6 +270,11 @@ public:
      unsigned long nIntIp, Licq::TCPSocket* sock, unsigned short nPort,
      bool bSendIntIp);
 
+  /**
+   * Log direct connection statistics if they changed since last call
+   */
+  void logDirectConnectionStats();
+
   void updateAllUsersInGroup(int groupId = 0);
   void CancelEvent(unsigned long );
   void CancelEvent(Licq::Event*);
@@ -371,6 +377,17 @@ private:
   static const int LogonAttemptDelay = 300;
   static const int MaxPingTimeouts = 3;
 
+  /// Update direct connection statistics when an open connection is reused
+  void countDirectReuse();
+
+  /**
+   * Update direct connection statistics after connecting for an event
+   *
+   * @param success True if a connection was established
+   * @param msec Time spent connecting and shaking hands
+   */
+  void countDirectConnect(bool success, unsigned long msec);
+
   bool SendEvent(int nSD, Licq::Packet &, bool);
   bool SendEvent(Licq::INetSocket *, Licq::Packet &, bool);
   void SendEvent_Server(Licq::Packet *packet, const Licq::ProtocolSignal* ps = NULL);
@@ -516,6 +533,14 @@ private:
   pthread_mutex_t mutex_serverack;
   unsigned short m_nServerAck;
 
+  // Direct connection statistics
+  Licq::Mutex myDirectStatsMutex;
+  unsigned long myDirectReused;
+  unsigned long myDirectConnects;
+  unsigned long myDirectConnectFailures;
+  unsigned long myDirectConnectMsec;
+  unsigned long myDirectStatsLogged;
+
   friend void *Ping_tep(void *p);
   friend void *UpdateUsers_tep(void *p);
   friend void *MonitorSockets_func();
@@ -19,6 +19,7 @@
 
 #include "oscarservice.h"
 
+#include <boost/foreach.hpp>
 #include <boost/scoped_array.hpp>
 #include <cerrno>
 #include <cstdio>
@@ -47,18 +48,85 @@
 using namespace LicqIcq;
 using Licq::gLog;
 using Licq::gDaemon;
+using std::list;
+using std::map;
 using std::string;
 
+// Seconds before an unanswered icon request may be sent again
+static const time_t IconRequestTimeout = 120;
+
+static string iconCacheDir()
+{
+  return gDaemon.baseDir() + "icons/";
+}
+
+static string iconCacheFile(const string& hash)
+{
+  string name;
+  for (string::const_iterator i = hash.begin(); i != hash.end(); ++i)
+  {
+    char hex[3];
+    snprintf(hex, sizeof(hex), "%02x", static_cast<unsigned char>(*i));
+    name += hex;
+  }
+  return iconCacheDir() + name;
+}
+
+static bool readCachedIcon(const string& hash, string& icon)
+{
+  int fd = open(iconCacheFile(hash).c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  icon.resize(st.st_size);
+  ssize_t count = read(fd, &icon[0], st.st_size);
+  close(fd);
+  return count == st.st_size;
+}
+
+static void writeCachedIcon(const string& hash, const string& icon)
+{
+  if (mkdir(iconCacheDir().c_str(), 0700) == -1 && errno != EEXIST)
+    return;
+
+  // Write to a temporary file first so other processes never see half an icon
+  string filename = iconCacheFile(hash);
+  string tmpname = filename + ".tmp";
+  int fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 00600);
+  if (fd == -1)
+  {
+    gLog.warning(tr("Unable to open icon cache file (%s): %s."),
+        tmpname.c_str(), strerror(errno));
+    return;
+  }
+  ssize_t count = write(fd, icon.data(), icon.size());
+  close(fd);
+  if (count != static_cast<ssize_t>(icon.size()) ||
+      rename(tmpname.c_str(), filename.c_str()) != 0)
+    unlink(tmpname.c_str());
+}
+
 COscarService::COscarService(unsigned short Fam)
 {
   myFam = Fam;
   mySocketDesc = -1;
   myProxy = NULL;
   myStatus = STATUS_UNINITIALIZED;
+  myIconCacheHits = 0;
+  myIconDownloads = 0;
+  myIconSharedDownloads = 0;
   pthread_mutex_init(&mutex_sendqueue, NULL);
   pthread_cond_init(&cond_sendqueue, NULL);
   pthread_mutex_init(&mutex_status, NULL);
   pthread_cond_init(&cond_status, NULL);
+  pthread_mutex_init(&mutex_pendingicons, NULL);
 }
 
 COscarService::~COscarService()
@@ -158,6 +226,162 @@ void COscarService::SendEvent(pthread_t caller, unsigned long eventId,
   pthread_mutex_unlock(&mutex_sendqueue);
 }
 
+void COscarService::requestBuddyIcon(pthread_t caller, unsigned long eventId,
+    User* u)
+{
+  const string hash = u->buddyIconHash();
+
+  string icon;
+  if (readCachedIcon(hash, icon))
+  {
+    gLog.info(tr("Using cached buddy icon for %s."), u->getAlias().c_str());
+    setBuddyIcon(u, hash, icon);
+    finishIconEvent(caller, eventId, u->id(), Licq::Event::ResultSuccess);
+
+    pthread_mutex_lock(&mutex_pendingicons);
+    ++myIconCacheHits;
+    pthread_mutex_unlock(&mutex_pendingicons);
+    return;
+  }
+
+  list<IconWaiter> expired;
+  pthread_mutex_lock(&mutex_pendingicons);
+  map<string, PendingIcon>::iterator iter = myPendingIcons.find(hash);
+  if (iter != myPendingIcons.end() &&
+      iter->second.requestTime + IconRequestTimeout <= time(NULL))
+  {
+    // No reply to last request, give up on it and send a new one
+    expired.swap(iter->second.waiters);
+    myPendingIcons.erase(iter);
+    iter = myPendingIcons.end();
+  }
+  if (iter != myPendingIcons.end())
+  {
+    // Icon already requested, just wait for it
+    PendingIcon& pending = iter->second;
+    bool waiting = (pending.userId == u->id());
+    BOOST_FOREACH(const IconWaiter& waiter, pending.waiters)
+      if (waiter.userId == u->id())
+        waiting = true;
+    if (!waiting)
+    {
+      IconWaiter waiter;
+      waiter.userId = u->id();
+      waiter.caller = caller;
+      waiter.eventId = eventId;
+      pending.waiters.push_back(waiter);
+      ++myIconSharedDownloads;
+    }
+    pthread_mutex_unlock(&mutex_pendingicons);
+    return;
+  }
+
+  PendingIcon& pending = myPendingIcons[hash];
+  pending.userId = u->id();
+  pending.requestTime = time(NULL);
+  ++myIconDownloads;
+  pthread_mutex_unlock(&mutex_pendingicons);
+
+  BOOST_FOREACH(const IconWaiter& waiter, expired)
+    finishIconEvent(waiter.caller, waiter.eventId, waiter.userId,
+        Licq::Event::ResultFailed);
+
+  SendEvent(caller, eventId, u->id(), ICQ_SNACxBART_DOWNLOADxREQUEST, true);
+}
+
+void COscarService::setBuddyIcon(User* u, const string& hash, const string& icon)
+{
+  u->setOurBuddyIconHash(hash);
+  if (!icon.empty()) // do not create empty .pic files
+  {
+    if (u->writePictureData(icon))
+    {
+      u->SetEnableSave(false);
+      u->SetPicturePresent(true);
+      u->SetEnableSave(true);
+    }
+  }
+  u->save(Licq::User::SavePictureInfo);
+  Licq::gPluginManager.pushPluginSignal(new Licq::PluginSignal(
+      Licq::PluginSignal::SignalUser,
+      Licq::PluginSignal::UserPicture, u->id()));
+}
+
+void COscarService::finishIconEvent(pthread_t caller, unsigned long eventId,
+    const Licq::UserId& userId, Licq::Event::ResultType result)
+{
+  Licq::Event* e = new Licq::Event(caller, eventId, mySocketDesc, NULL,
+      Licq::Event::ConnectServer, userId);
+  e->m_nSNAC = MAKESNAC(ICQ_SNACxFAM_BART, ICQ_SNACxBART_DOWNLOADxREQUEST);
+  e->m_eResult = result;
+  Licq::gPluginManager.pushPluginEvent(e);
+}
+
+void COscarService::finishIconWaiters(const string& hash, const string& icon,
+    Licq::Event::ResultType result)
+{
+  list<IconWaiter> waiters;
+  pthread_mutex_lock(&mutex_pendingicons);
+  map<string, PendingIcon>::iterator iter = myPendingIcons.find(hash);
+  if (iter != myPendingIcons.end())
+  {
+    waiters.swap(iter->second.waiters);
+    myPendingIcons.erase(iter);
+  }
+  gLog.debug("Buddy icons: %lu cache hits, %lu downloads, %lu shared downloads",
+      myIconCacheHits, myIconDownloads, myIconSharedDownloads);
+  pthread_mutex_unlock(&mutex_pendingicons);
+
+  BOOST_FOREACH(const IconWaiter& waiter, waiters)
+  {
+    if (result == Licq::Event::ResultSuccess)
+    {
+      UserWriteGuard u(waiter.userId);
+      if (!u.isLocked())
+        continue;
+      if (u->buddyIconHash() == hash)
+        setBuddyIcon(*u, hash, icon);
+    }
+    finishIconEvent(waiter.caller, waiter.eventId, waiter.userId, result);
+  }
+}
+
+void COscarService::failIconRequest(const Licq::UserId& userId,
+    Licq::Event::ResultType result)
+{
+  string hash;
+  bool found = false;
+  pthread_mutex_lock(&mutex_pendingicons);
+  for (map<string, PendingIcon>::iterator iter = myPendingIcons.begin();
+      iter != myPendingIcons.end(); ++iter)
+  {
+    if (iter->second.userId == userId)
+    {
+      hash = iter->first;
+      found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&mutex_pendingicons);
+
+  if (found)
+    finishIconWaiters(hash, string(), result);
+}
+
+void COscarService::failPendingIcons()
+{
+  map<string, PendingIcon> pending;
+  pthread_mutex_lock(&mutex_pendingicons);
+  pending.swap(myPendingIcons);
+  pthread_mutex_unlock(&mutex_pendingicons);
+
+  map<string, PendingIcon>::const_iterator iter;
+  for (iter = pending.begin(); iter != pending.end(); ++iter)
+    BOOST_FOREACH(const IconWaiter& waiter, iter->second.waiters)
+      finishIconEvent(waiter.caller, waiter.eventId, waiter.userId,
+          Licq::Event::ResultFailed);
+}
+
 bool COscarService::SendBARTFam(Licq::Event* e)
 {
   switch (e->SubType())
@@ -341,88 +565,92 @@ void COscarService::ProcessBARTFam(Buffer& packet, unsigned short SubType,
 
       Licq::Event* e = gIcqProtocol.DoneServerEvent(RequestId, Licq::Event::ResultError);
       if (e)
+      {
+        // Fail anyone waiting for the same icon
+        failIconRequest(e->userId(), Licq::Event::ResultError);
         gIcqProtocol.ProcessDoneEvent(e);
+      }
       break;
     }
 
     case ICQ_SNACxBART_DOWNLOADxREPLY:
     {
-      string id = packet.unpackByteString();
-      UserWriteGuard u(Licq::UserId(gIcqProtocol.ownerId(), id));
-      if (!u.isLocked())
+      string hash;
+      string icon;
+      bool received = false;
+      Licq::UserId userId(gIcqProtocol.ownerId(), packet.unpackByteString());
       {
-        gLog.warning(tr("Buddy icon for unknown user (%s)."), id.c_str());
-        break;
-      }
+        UserWriteGuard u(userId);
+        if (!u.isLocked())
+        {
+          gLog.warning(tr("Buddy icon for unknown user (%s)."),
+              userId.accountId().c_str());
+          Licq::Event* e = gIcqProtocol.DoneServerEvent(RequestId, Licq::Event::ResultFailed);
+          if (e)
+            gIcqProtocol.ProcessDoneEvent(e);
+          failIconRequest(userId, Licq::Event::ResultFailed);
+          break;
+        }
 
-      unsigned short IconType = packet.UnpackUnsignedShortBE();
-      char HashType = packet.UnpackChar();                     
-      char HashLength = packet.UnpackChar();
-      switch (IconType)
-      {
-        case BART_TYPExBUDDY_ICON_SMALL:
-        case BART_TYPExBUDDY_ICON:
+        unsigned short IconType = packet.UnpackUnsignedShortBE();
+        char HashType = packet.UnpackChar();
+        char HashLength = packet.UnpackChar();
+        switch (IconType)
         {
-          if ((HashType == 0 || HashType == 1) && HashLength > 0 && HashLength <= 16)
+          case BART_TYPExBUDDY_ICON_SMALL:
+          case BART_TYPExBUDDY_ICON:
           {
-            string hash = packet.unpackRawString(HashLength);
-            packet.UnpackChar(); // unknown (command ?)
-            packet.UnpackUnsignedShortBE(); // IconType once more
-            packet.UnpackChar(); // HashType once more
-            char HashLength2 = packet.UnpackChar(); // Hash once more
-            packet.incDataPosRead(HashLength2); // Hash once more
-            u->setOurBuddyIconHash(hash);
-
-            gLog.info(tr("Buddy icon reply for %s."), u->getAlias().c_str());
-            unsigned short IconLen = packet.UnpackUnsignedShortBE();
-            if (IconLen > 0) // do not create empty .pic files
+            if ((HashType == 0 || HashType == 1) && HashLength > 0 && HashLength <= 16)
             {
-              int FD = open(u->pictureFileName().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 00664);
-              if (FD == -1)
+              hash = packet.unpackRawString(HashLength);
+              packet.UnpackChar(); // unknown (command ?)
+              packet.UnpackUnsignedShortBE(); // IconType once more
+              packet.UnpackChar(); // HashType once more
+              char HashLength2 = packet.UnpackChar(); // Hash once more
+              packet.incDataPosRead(HashLength2); // Hash once more
+
+              gLog.info(tr("Buddy icon reply for %s."), u->getAlias().c_str());
+              unsigned short IconLen = packet.UnpackUnsignedShortBE();
+              if (IconLen > 0)
               {
-                gLog.error(tr("Unable to open picture file (%s): %s."),
-                    u->pictureFileName().c_str(), strerror(errno));
-                break;
+                icon = packet.unpackRawString(IconLen);
+                writeCachedIcon(hash, icon);
               }
+              setBuddyIcon(*u, hash, icon);
+              received = true;
 
-              string icon = packet.unpackRawString(IconLen);
-              write(FD, icon.c_str(), IconLen);
-              close(FD);
-
-              u->SetEnableSave(false);
-              u->SetPicturePresent(true);
-              u->SetEnableSave(true);
+              Licq::Event* e = gIcqProtocol.DoneServerEvent(RequestId, Licq::Event::ResultSuccess);
+              if (e)
+                gIcqProtocol.ProcessDoneEvent(e);
             }
-            u->save(Licq::User::SavePictureInfo);
-            Licq::gPluginManager.pushPluginSignal(new Licq::PluginSignal(
-                Licq::PluginSignal::SignalUser,
-                Licq::PluginSignal::UserPicture, u->id()));
-
-            Licq::Event* e = gIcqProtocol.DoneServerEvent(RequestId, Licq::Event::ResultSuccess);
-            if (e)
-              gIcqProtocol.ProcessDoneEvent(e);
+            else
+            {
+              gLog.warning(tr("Buddy icon reply for %s with wrong or unsupported hashtype (%d) or hashlength (%d)."),
+                  u->getAlias().c_str(), HashType, HashLength);
+              Licq::Event* e = gIcqProtocol.DoneServerEvent(RequestId, Licq::Event::ResultFailed);
+              if (e)
+                gIcqProtocol.ProcessDoneEvent(e);
+            }
+            break;
           }
-          else
+
+          default:
           {
-            gLog.warning(tr("Buddy icon reply for %s with wrong or unsupported hashtype (%d) or hashlength (%d)."),
-                u->getAlias().c_str(), HashType, HashLength);
+            gLog.warning(tr("Buddy icon reply for %s with wrong or unsupported icontype (0x%02x)."),
+                u->getAlias().c_str(), IconType);
             Licq::Event* e = gIcqProtocol.DoneServerEvent(RequestId, Licq::Event::ResultFailed);
             if (e)
               gIcqProtocol.ProcessDoneEvent(e);
+            break;
           }
-          break;
-        }
-
-        default:
-        {
-          gLog.warning(tr("Buddy icon reply for %s with wrong or unsupported icontype (0x%02x)."),
-              u->getAlias().c_str(), IconType);
-          Licq::Event* e = gIcqProtocol.DoneServerEvent(RequestId, Licq::Event::ResultFailed);
-          if (e)
-            gIcqProtocol.ProcessDoneEvent(e);
-          break;
         }
       }
+
+      // Update other users waiting for the same icon
+      if (received)
+        finishIconWaiters(hash, icon, Licq::Event::ResultSuccess);
+      else
+        failIconRequest(userId, Licq::Event::ResultFailed);
       break;
     }
 
@@ -580,6 +808,7 @@ void* LicqIcq::OscarServiceSendQueue_tep(void *p)
       {
         gLog.warning(tr("Can't send event for service 0x%02X because we are not online."),
             os->myFam);
+        os->failIconRequest(e->userId(), Licq::Event::ResultError);
         if (gIcqProtocol.DoneEvent(e, Licq::Event::ResultError) != NULL)
           gIcqProtocol.ProcessDoneEvent(e);
         else
@@ -596,6 +825,7 @@ void* LicqIcq::OscarServiceSendQueue_tep(void *p)
         {
           gLog.warning(tr("Initialization of socket for service 0x%02X failed, failing event."),
               os->myFam);
+          os->failIconRequest(e->userId(), Licq::Event::ResultError);
           if (gIcqProtocol.DoneEvent(e, Licq::Event::ResultError) != NULL)
             gIcqProtocol.ProcessDoneEvent(e);
           else
@@ -622,6 +852,7 @@ void* LicqIcq::OscarServiceSendQueue_tep(void *p)
  
       if (!Sent)
       {
+        os->failIconRequest(e->userId(), Licq::Event::ResultError);
         if (gIcqProtocol.DoneEvent(e, Licq::Event::ResultError) != NULL)
           gIcqProtocol.ProcessDoneEvent(e);
         else
@@ -20,23 +20,27 @@
 #ifndef LICQICQ_OSCARSERVICE_H
 #define LICQICQ_OSCARSERVICE_H
 
+#include <ctime>
 #include <list>
+#include <map>
 #include <string>
 #include <pthread.h>
 
 #include <boost/shared_array.hpp>
 
+#include <licq/event.h>
+#include <licq/userid.h>
+
 namespace Licq
 {
-class Event;
 class Packet;
 class Proxy;
-class UserId;
 }
 
 namespace LicqIcq
 {
 class Buffer;
+class User;
 
 enum EOscarServiceStatus {STATUS_UNINITIALIZED, STATUS_SERVICE_REQ_SENT,
                           STATUS_SERVICE_REQ_ACKED, STATUS_CONNECTED,
@@ -56,6 +60,25 @@ public:
       unsigned short SubType, bool Request);
   void ClearQueue();
 
+  /**
+   * Get the current buddy icon for a user
+   *
+   * Icons are kept in a cache shared by all users and owners, keyed by the
+   * icon hash. Only icons not in the cache are requested from the server and
+   * users waiting for the same icon share a single request.
+   *
+   * @param caller Thread to send event to when icon has been updated
+   * @param eventId Id of event to send
+   * @param user User to get icon for, must be write locked
+   */
+  void requestBuddyIcon(pthread_t caller, unsigned long eventId, User* user);
+
+  /**
+   * Fail all icon requests still waiting for a reply
+   * Called when the service connection is closed.
+   */
+  void failPendingIcons();
+
   void setConnectCredential(const std::string& server, unsigned short port,
       const std::string& cookie);
   void ChangeStatus(EOscarServiceStatus s);
@@ -77,6 +100,36 @@ protected:
   pthread_mutex_t mutex_status;
   pthread_cond_t cond_status;
 
+  struct IconWaiter
+  {
+    Licq::UserId userId;
+    pthread_t caller;
+    unsigned long eventId;
+  };
+
+  struct PendingIcon
+  {
+    Licq::UserId userId;
+    time_t requestTime;
+    std::list<IconWaiter> waiters;
+  };
+
+  // Icon requests sent to the server by icon hash
+  std::map<std::string, PendingIcon> myPendingIcons;
+  pthread_mutex_t mutex_pendingicons;
+  unsigned long myIconCacheHits;
+  unsigned long myIconDownloads;
+  unsigned long myIconSharedDownloads;
+
+  /**
+   * Fail the icon request sent for a user and anyone waiting for that icon
+   *
+   * @param userId User the request was sent for
+   * @param result Result to report to the waiters
+   */
+  void failIconRequest(const Licq::UserId& userId,
+      Licq::Event::ResultType result);
+
   bool SendPacket(Licq::Packet* packet);
   bool WaitForStatus(EOscarServiceStatus s);
   bool SendBARTFam(Licq::Event* event);
@@ -85,6 +138,31 @@ protected:
   void ProcessServiceFam(Buffer& packet, unsigned short SubType, unsigned long RequestId);
   void ProcessBARTFam(Buffer& packet, unsigned short SubType, unsigned long RequestId);
 
+  /**
+   * Set buddy icon for a user and notify plugins
+   *
+   * @param user User to update, must be write locked
+   * @param hash Hash of the icon
+   * @param icon Icon data, empty if user has no icon
+   */
+  void setBuddyIcon(User* user, const std::string& hash, const std::string& icon);
+
+  /**
+   * Report a finished icon request to a plugin
+   */
+  void finishIconEvent(pthread_t caller, unsigned long eventId,
+      const Licq::UserId& userId, Licq::Event::ResultType result);
+
+  /**
+   * Update and notify users waiting for an icon that has been received
+   *
+   * @param hash Hash of icon
+   * @param icon Icon data or empty if none was received
+   * @param result Result to report to waiting plugins
+   */
+  void finishIconWaiters(const std::string& hash, const std::string& icon,
+      Licq::Event::ResultType result);
+
   friend void *OscarServiceSendQueue_tep(void *p);
 };
 
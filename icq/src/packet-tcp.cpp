@@ -28,12 +28,15 @@
 #include <fcntl.h>
 
 #include <cerrno>
+#include <ctime>
 
 #include <licq/byteorder.h>
 #include <licq/color.h>
 #include <licq/contactlist/usermanager.h>
 #include <licq/translator.h>
 #include <licq/logging/log.h>
+#include <licq/thread/mutex.h>
+#include <licq/thread/mutexlocker.h>
 #include <licq/version.h>
 
 #include "buffer.h"
@@ -66,7 +69,47 @@ static unsigned char client_check_data[] = {
 #define DEBUG_ENCRYPTION(x)
 //#define DEBUG_ENCRYPTION(x) fprintf(stderr, x)
 
-void LicqIcq::Encrypt_Client(CBuffer* pkt, unsigned long version)
+// Seed used when a packet is encrypted without a socket to draw from
+static unsigned int sharedCryptSeed = time(NULL);
+static Licq::Mutex sharedCryptSeedMutex;
+
+static unsigned int cryptRandom(unsigned int* seed)
+{
+  if (seed != NULL)
+    return rand_r(seed);
+
+  Licq::MutexLocker locker(sharedCryptSeedMutex);
+  return rand_r(&sharedCryptSeed);
+}
+
+/**
+ * XOR the encrypted part of a direct connection packet in place
+ *
+ * Only every fourth byte offset below (size+3)/4 starts a key word, so
+ * roughly the first quarter of the packet is scrambled. This is how the
+ * official clients do it and must not be "fixed". Each key word is applied
+ * as a single 32 bit little endian word instead of four separate bytes.
+ *
+ * @param buf Start of packet data (after length and any version byte)
+ * @param start Offset of first word to process
+ * @param size Size of packet data
+ * @param key Main XOR key for this packet
+ */
+static void xorClientData(unsigned char* buf, unsigned long start,
+    unsigned long size, unsigned long key)
+{
+  const unsigned long end = (size + 3) / 4;
+  for (unsigned long i = start; i < end; i += 4)
+  {
+    uint32_t word;
+    memcpy(&word, buf + i, sizeof(word));
+    word ^= LE_32(static_cast<uint32_t>(key + client_check_data[i & 0xFF]));
+    memcpy(buf + i, &word, sizeof(word));
+  }
+}
+
+void LicqIcq::Encrypt_Client(CBuffer* pkt, unsigned long version,
+    unsigned int* seed)
 {
   unsigned long B1, M1, check;
   unsigned int i;
@@ -102,9 +145,9 @@ void LicqIcq::Encrypt_Client(CBuffer* pkt, unsigned long version)
   }
 
   // calculate verification data
-  M1 = (rand() % ((size < 255 ? size : 255)-10))+10;
+  M1 = (cryptRandom(seed) % ((size < 255 ? size : 255)-10))+10;
   X1 = buf[M1] ^ 0xFF;
-  X2 = rand() % 220;
+  X2 = cryptRandom(seed) % 220;
   X3 = client_check_data[X2] ^ 0xFF;
   if(offset) {
     for(i=0;i<6;i++)  bak[i] = buf[i];
@@ -122,11 +165,7 @@ void LicqIcq::Encrypt_Client(CBuffer* pkt, unsigned long version)
   unsigned long key = 0x67657268 * size + check;
 
   // XORing the actual data
-  for(i=0;i<(size+3)/4;i+=4){
-    unsigned long hex = key + client_check_data[i&0xFF];
-    buf[i+0] ^= hex&0xFF;buf[i+1] ^= (hex>>8)&0xFF;
-    buf[i+2] ^= (hex>>16)&0xFF;buf[i+3] ^= (hex>>24)&0xFF;
-  }
+  xorClientData(buf, 0, size, key);
 
   // in TCPv4 are the first 6 bytes unencrypted
   // so restore them
@@ -142,7 +181,7 @@ void LicqIcq::Encrypt_Client(CBuffer* pkt, unsigned long version)
 
 bool LicqIcq::Decrypt_Client(CBuffer* pkt, unsigned long version)
 {
-  unsigned long hex, key, B1, M1, check;
+  unsigned long key, B1, M1, check;
   unsigned int i;
   unsigned char X1, X2, X3;
   unsigned char* buf = (unsigned char*)pkt->getDataStart() + 2;
@@ -184,11 +223,7 @@ bool LicqIcq::Decrypt_Client(CBuffer* pkt, unsigned long version)
   // main XOR key
   key = 0x67657268 * size + check;
 
-  for(i=4; i<(size+3)/4; i+=4) {
-    hex = key + client_check_data[i&0xFF];
-    buf[i+0] ^= hex&0xFF;buf[i+1] ^= (hex>>8)&0xFF;
-    buf[i+2] ^= (hex>>16)&0xFF;buf[i+3] ^= (hex>>24)&0xFF;
-  }
+  xorClientData(buf, 4, size, key);
 
   // retrive validate data
   if(offset) {
@@ -493,7 +528,9 @@ Licq::Buffer* CPacketTcp::Finalize(Licq::INetSocket *s)
     LocalPortOffset()[1] = (s->getLocalPort() >> 8) & 0xFF;
   }
 
-  Encrypt_Client(buffer, m_nVersion);
+  DcSocket* dcSocket = dynamic_cast<DcSocket*>(s);
+  Encrypt_Client(buffer, m_nVersion,
+      dcSocket != NULL ? dcSocket->cryptSeed() : NULL);
   return buffer;
 }
 
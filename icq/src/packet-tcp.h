@@ -50,7 +50,16 @@ const unsigned short DirectStatusPluginRequest   = 2;
 
 //=====TCP======================================================================
 bool Decrypt_Client(Licq::Buffer* pkt, unsigned long version);
-void Encrypt_Client(Licq::Buffer* pkt, unsigned long version);
+
+/**
+ * Encrypt a direct connection packet in place
+ *
+ * @param pkt Packet to encrypt
+ * @param version Protocol version of the connection
+ * @param seed PRNG state of the connection or NULL to use a shared state
+ */
+void Encrypt_Client(Licq::Buffer* pkt, unsigned long version,
+    unsigned int* seed = NULL);
 
 //-----PacketTcp_Handshake------------------------------------------------------
 class CPacketTcp_Handshake : public CPacket
@@ -0,0 +1,242 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2014 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "sessionloop.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <licq/logging/log.h>
+#include <licq/socket.h>
+#include <licq/thread/mutexlocker.h>
+
+#include "gettext.h"
+
+using namespace LicqIcq;
+using Licq::MutexLocker;
+using Licq::gLog;
+
+SessionLoop LicqIcq::gSessionLoop;
+
+SessionLoop::SessionLoop()
+  : myQueuedCount(0),
+    myDoneCount(0),
+    myNextTimeoutId(1),
+    myThreadRunning(false)
+{
+  // Empty
+}
+
+SessionLoop::~SessionLoop()
+{
+  shutdown();
+}
+
+void SessionLoop::addSocket(Licq::INetSocket* inetSocket,
+    Licq::MainLoopCallback* callback, int events)
+{
+  Command c;
+  c.type = AddSocket;
+  c.inetSocket = inetSocket;
+  c.callback = callback;
+  c.fd = inetSocket->Descriptor();
+  c.events = events;
+  queueCommand(c, false);
+}
+
+void SessionLoop::removeSocket(Licq::INetSocket* inetSocket)
+{
+  // Use the descriptor from now as the socket may be closed before the loop
+  // gets to the command
+  Command c;
+  c.type = RemoveFile;
+  c.fd = inetSocket->Descriptor();
+  if (c.fd == -1)
+    return;
+  queueCommand(c, false);
+}
+
+int SessionLoop::addTimeout(int timeout, Licq::MainLoopCallback* callback, bool once)
+{
+  Command c;
+  c.type = AddTimeout;
+  c.callback = callback;
+  c.timeout = timeout;
+  c.once = once;
+  {
+    MutexLocker lock(myMutex);
+    c.id = myNextTimeoutId++;
+  }
+  queueCommand(c, false);
+  return c.id;
+}
+
+void SessionLoop::removeTimeout(int id)
+{
+  Command c;
+  c.type = RemoveTimeout;
+  c.id = id;
+  queueCommand(c, false);
+}
+
+void SessionLoop::removeCallback(const Licq::MainLoopCallback* callback)
+{
+  Command c;
+  c.type = RemoveCallback;
+  c.callback = callback;
+  queueCommand(c, true);
+}
+
+void SessionLoop::shutdown()
+{
+  if (isLoopThread())
+  {
+    gLog.error(tr("Session loop can't be stopped from its own thread"));
+    return;
+  }
+
+  {
+    MutexLocker lock(myMutex);
+    if (!myThreadRunning)
+      return;
+  }
+
+  Command c;
+  c.type = Quit;
+  queueCommand(c, false);
+  pthread_join(myThread, NULL);
+
+  MutexLocker lock(myMutex);
+  myThreadRunning = false;
+  myMainLoop.removeRawFile(myPipe.getReadFd());
+  myCommands.clear();
+  myDoneCount = myQueuedCount;
+  myCommandsDone.broadcast();
+}
+
+bool SessionLoop::isLoopThread() const
+{
+  MutexLocker lock(myMutex);
+  return myThreadRunning && pthread_equal(pthread_self(), myThread);
+}
+
+void SessionLoop::queueCommand(const Command& command, bool wait)
+{
+  // Called from a callback, mainloop can be used directly
+  if (isLoopThread())
+  {
+    runCommand(command);
+    return;
+  }
+
+  MutexLocker lock(myMutex);
+  if (!myThreadRunning)
+  {
+    // Nothing to remove if the loop isn't running
+    if (command.type != AddSocket && command.type != AddTimeout)
+      return;
+    startThread();
+  }
+
+  myCommands.push_back(command);
+  unsigned long ticket = ++myQueuedCount;
+  myPipe.putChar('C');
+
+  if (wait)
+    while (myDoneCount < ticket)
+      myCommandsDone.wait(myMutex);
+}
+
+void SessionLoop::runCommand(const Command& c)
+{
+  switch (c.type)
+  {
+    case AddSocket:
+      // Socket may have been closed while the command was queued
+      if (c.inetSocket->Descriptor() != c.fd || c.fd == -1)
+        break;
+      // Remove any previous monitor so this can be used to change events
+      myMainLoop.removeRawFile(c.fd);
+      myMainLoop.addSocket(c.inetSocket,
+          const_cast<Licq::MainLoopCallback*>(c.callback), c.events);
+      break;
+
+    case RemoveFile:
+      myMainLoop.removeRawFile(c.fd);
+      break;
+
+    case AddTimeout:
+      myMainLoop.addTimeout(c.timeout,
+          const_cast<Licq::MainLoopCallback*>(c.callback), c.id, c.once);
+      break;
+
+    case RemoveTimeout:
+      myMainLoop.removeTimeout(c.id);
+      break;
+
+    case RemoveCallback:
+      myMainLoop.removeCallback(c.callback);
+      break;
+
+    case Quit:
+      myMainLoop.quit();
+      break;
+  }
+}
+
+void SessionLoop::startThread()
+{
+  // Must be called with myMutex locked
+  myMainLoop.addRawFile(myPipe.getReadFd(), this);
+  if (pthread_create(&myThread, NULL, &loop_tep, this) != 0)
+  {
+    gLog.error(tr("Unable to start thread for direct connections: %s"),
+        strerror(errno));
+    myMainLoop.removeRawFile(myPipe.getReadFd());
+    return;
+  }
+  myThreadRunning = true;
+}
+
+void SessionLoop::rawFileEvent(int /* id */, int fd, int /* revents */)
+{
+  if (fd != myPipe.getReadFd())
+    return;
+  myPipe.getChar();
+
+  std::list<Command> commands;
+  {
+    MutexLocker lock(myMutex);
+    commands.swap(myCommands);
+  }
+
+  for (std::list<Command>::const_iterator i = commands.begin(); i != commands.end(); ++i)
+    runCommand(*i);
+
+  MutexLocker lock(myMutex);
+  myDoneCount += commands.size();
+  myCommandsDone.broadcast();
+}
+
+void* SessionLoop::loop_tep(void* arg)
+{
+  SessionLoop* loop = static_cast<SessionLoop*>(arg);
+  loop->myMainLoop.run();
+  return NULL;
+}
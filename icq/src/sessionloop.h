@@ -0,0 +1,166 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2014 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef LICQICQ_SESSIONLOOP_H
+#define LICQICQ_SESSIONLOOP_H
+
+#include <list>
+#include <pthread.h>
+
+#include <licq/mainloop.h>
+#include <licq/pipe.h>
+#include <licq/thread/condition.h>
+#include <licq/thread/mutex.h>
+
+namespace Licq
+{
+class INetSocket;
+}
+
+namespace LicqIcq
+{
+
+/**
+ * Event loop shared by all direct connection sessions (file transfers and
+ * chats)
+ *
+ * A single thread runs a Licq::MainLoop monitoring the sockets of all
+ * sessions so the number of threads doesn't grow with the number of open
+ * sessions. The sessions themselves are state machines driven by the
+ * callbacks from the loop.
+ *
+ * All functions may be called from any thread. Calls made from other threads
+ * are queued and performed by the loop thread, calls made from a callback are
+ * performed directly.
+ */
+class SessionLoop : private Licq::MainLoopCallback
+{
+public:
+  SessionLoop();
+  ~SessionLoop();
+
+  /**
+   * Start monitoring a socket
+   *
+   * @param inetSocket Socket to monitor
+   * @param callback Object to call socketEvent on when events occur
+   * @param events Events to monitor for (POLLIN and/or POLLOUT)
+   */
+  void addSocket(Licq::INetSocket* inetSocket, Licq::MainLoopCallback* callback,
+      int events = POLLIN);
+
+  /**
+   * Stop monitoring a socket
+   * Must be called before the socket is closed.
+   *
+   * @param inetSocket Socket to stop monitoring
+   */
+  void removeSocket(Licq::INetSocket* inetSocket);
+
+  /**
+   * Add a timeout
+   *
+   * @param timeout Timeout in milliseconds
+   * @param callback Object to call timeoutEvent on at timeout
+   * @param once True to remove timeout after first occurance
+   * @return Id of the new timeout
+   */
+  int addTimeout(int timeout, Licq::MainLoopCallback* callback, bool once = true);
+
+  /**
+   * Cancel a timeout
+   *
+   * @param id Id of the timeout as returned by addTimeout
+   */
+  void removeTimeout(int id);
+
+  /**
+   * Stop all callbacks to an object
+   * When this function returns the object will not get any more callbacks and
+   * may be deleted.
+   *
+   * @param callback Object to stop callbacks for
+   */
+  void removeCallback(const Licq::MainLoopCallback* callback);
+
+  /**
+   * Stop the loop thread
+   * Should be called when the plugin is shutting down, any sessions left will
+   * not get any more callbacks.
+   * Must not be called from a session callback as the thread can't join
+   * itself, such calls are ignored.
+   */
+  void shutdown();
+
+  /**
+   * Check if the current thread is the loop thread
+   *
+   * @return True if called from a callback
+   */
+  bool isLoopThread() const;
+
+private:
+  enum CommandType
+  {
+    AddSocket,
+    RemoveFile,
+    AddTimeout,
+    RemoveTimeout,
+    RemoveCallback,
+    Quit
+  };
+
+  struct Command
+  {
+    CommandType type;
+    Licq::INetSocket* inetSocket;
+    const Licq::MainLoopCallback* callback;
+    int fd;
+    int events;
+    int timeout;
+    int id;
+    bool once;
+  };
+
+  // From Licq::MainLoopCallback
+  void rawFileEvent(int id, int fd, int revents);
+
+  void queueCommand(const Command& command, bool wait);
+  void runCommand(const Command& command);
+  void startThread();
+
+  static void* loop_tep(void* arg);
+
+  Licq::MainLoop myMainLoop;
+  Licq::Pipe myPipe;
+  mutable Licq::Mutex myMutex;
+  Licq::Condition myCommandsDone;
+  std::list<Command> myCommands;
+  unsigned long myQueuedCount;
+  unsigned long myDoneCount;
+  int myNextTimeoutId;
+  bool myThreadRunning;
+  pthread_t myThread;
+};
+
+extern SessionLoop gSessionLoop;
+
+} // namespace LicqIcq
+
+#endif
@@ -20,17 +20,21 @@
 #include "socket.h"
 
 #include <cerrno>
+#include <cstring>
+#include <ctime>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <licq/buffer.h>
 #include <licq/logging/log.h>
+#include <licq/thread/mutexlocker.h>
 
 #include "gettext.h"
 
 using namespace LicqIcq;
 using Licq::Buffer;
+using Licq::MutexLocker;
 using Licq::gLog;
 
 SrvSocket::SrvSocket(const Licq::UserId& userId)
@@ -120,12 +124,16 @@ bool SrvSocket::receiveFlap(Licq::Buffer& buf)
 
 DcSocket::DcSocket(const Licq::UserId& userId)
   : TCPSocket(userId),
-    myVersion(0)
+    myVersion(0),
+    myCryptSeed(time(NULL) ^ reinterpret_cast<unsigned long>(this)),
+    myPendingFd(-1)
 {
   // Empty
 }
 
 DcSocket::DcSocket()
+  : myCryptSeed(time(NULL) ^ reinterpret_cast<unsigned long>(this)),
+    myPendingFd(-1)
 {
   // Empty
 }
@@ -141,6 +149,124 @@ void DcSocket::TransferConnectionFrom(Licq::TCPSocket& from)
   Licq::TCPSocket::TransferConnectionFrom(from);
 }
 
+bool DcSocket::sendv(struct iovec* iov, int iovcnt)
+{
+  MutexLocker lock(myOutputMutex);
+
+  // Drop anything left from a previous connection
+  if (myPendingFd != myDescriptor)
+    myPendingOutput.clear();
+  myPendingFd = myDescriptor;
+
+  // Keep data in order, if something is already waiting this must wait too
+  if (myPendingOutput.empty())
+  {
+    while (iovcnt > 0)
+    {
+      ssize_t bytesSent = writeNonBlocking(iov, iovcnt);
+      if (bytesSent < 0)
+        return false;
+      if (bytesSent == 0)
+        break;
+
+      // Skip past everything that was written
+      while (iovcnt > 0 && (size_t)bytesSent >= iov->iov_len)
+      {
+        bytesSent -= iov->iov_len;
+        ++iov;
+        --iovcnt;
+      }
+      if (iovcnt > 0)
+      {
+        iov->iov_base = (char*)iov->iov_base + bytesSent;
+        iov->iov_len -= bytesSent;
+      }
+    }
+  }
+
+  for (int i = 0; i < iovcnt; ++i)
+    myPendingOutput.append(static_cast<const char*>(iov[i].iov_base),
+        iov[i].iov_len);
+  return true;
+}
+
+bool DcSocket::sendBuffer(const Buffer& buf)
+{
+  struct iovec iov;
+  iov.iov_base = const_cast<char*>(buf.getDataStart());
+  iov.iov_len = buf.getDataSize();
+  if (!sendv(&iov, 1))
+    return false;
+
+  DumpPacket(&buf, false);
+  return true;
+}
+
+bool DcSocket::flushOutput()
+{
+  MutexLocker lock(myOutputMutex);
+  if (myPendingFd != myDescriptor)
+    myPendingOutput.clear();
+
+  while (!myPendingOutput.empty())
+  {
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(myPendingOutput.data());
+    iov.iov_len = myPendingOutput.size();
+    ssize_t bytesSent = writeNonBlocking(&iov, 1);
+    if (bytesSent < 0)
+      return false;
+    if (bytesSent == 0)
+      break;
+    myPendingOutput.erase(0, bytesSent);
+  }
+  return true;
+}
+
+bool DcSocket::hasPendingOutput() const
+{
+  MutexLocker lock(myOutputMutex);
+  return (!myPendingOutput.empty() && myPendingFd == myDescriptor);
+}
+
+ssize_t DcSocket::writeNonBlocking(const struct iovec* iov, int iovcnt)
+{
+  if (Secure())
+  {
+    // SSL has no vectored write, stop at first buffer not written in full
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+      ssize_t bytesSent = sendNonBlocking(iov[i].iov_base, iov[i].iov_len);
+      if (bytesSent < 0)
+        return (total > 0 ? total : -1);
+      total += bytesSent;
+      if (static_cast<size_t>(bytesSent) < iov[i].iov_len)
+        break;
+    }
+    return total;
+  }
+
+  // Use a per call flag as receive() resets O_NONBLOCK on the descriptor
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = const_cast<struct iovec*>(iov);
+  msg.msg_iovlen = iovcnt;
+
+  while (true)
+  {
+    ssize_t bytesSent = ::sendmsg(myDescriptor, &msg, MSG_DONTWAIT);
+    if (bytesSent >= 0)
+      return bytesSent;
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return 0;
+    myErrorType = ErrorErrno;
+    return -1;
+  }
+}
+
 bool DcSocket::RecvPacket()
 {
   if (myRecvBuffer.Full())
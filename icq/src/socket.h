@@ -22,7 +22,11 @@
 
 #include <licq/socket.h>
 
+#include <string>
+#include <sys/uio.h>
+
 #include <licq/buffer.h>
+#include <licq/thread/mutex.h>
 
 namespace LicqIcq
 {
@@ -57,6 +61,40 @@ public:
 
   void TransferConnectionFrom(Licq::TCPSocket& from);
 
+  /**
+   * Send data from several buffers with a single system call without blocking
+   * Used to send multiple packets at once without copying them together.
+   * Data that can't be sent right away is kept and sent by flushOutput() so
+   *   the caller must watch the socket for POLLOUT while hasPendingOutput()
+   *   is true. Secure connections fall back to a blocking send per buffer.
+   *
+   * @param iov Buffers to send, will be modified if writes are partial
+   * @param iovcnt Number of buffers in iov
+   * @return False on any failure
+   */
+  bool sendv(struct iovec* iov, int iovcnt);
+
+  /**
+   * Send a packet without blocking, see sendv()
+   *
+   * @param buf Packet to send
+   * @return False on any failure
+   */
+  bool sendBuffer(const Licq::Buffer& buf);
+
+  /**
+   * Send data left over by previous calls to sendv()
+   * Should be called when the socket is writable.
+   *
+   * @return False on any failure
+   */
+  bool flushOutput();
+
+  /**
+   * Check if there is data waiting to be sent by flushOutput()
+   */
+  bool hasPendingOutput() const;
+
   /**
    * Receive a packet without blocking
    * Check RecvBufferFull() on return to determine if packet is complete
@@ -80,10 +118,25 @@ public:
   unsigned long Version() const { return (myVersion); }
   void SetVersion(unsigned long version) { myVersion = version; }
 
+  /// PRNG state used for check codes of packets sent on this connection
+  unsigned int* cryptSeed() { return &myCryptSeed; }
+
 private:
+  /**
+   * Write data without blocking
+   * Caller must hold myOutputMutex
+   *
+   * @return Number of bytes written or -1 on error
+   */
+  ssize_t writeNonBlocking(const struct iovec* iov, int iovcnt);
+
   Licq::Buffer myRecvBuffer;
   int myChannel;
   unsigned short myVersion;
+  unsigned int myCryptSeed;
+  mutable Licq::Mutex myOutputMutex;
+  std::string myPendingOutput;
+  int myPendingFd;
 };
 
 } // namespace LicqIcq
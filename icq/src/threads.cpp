@@ -22,6 +22,7 @@
 #include <boost/foreach.hpp>
 #include <cerrno>
 #include <ctime>
+#include <sys/time.h>
 #include <unistd.h>
 
 #include <licq/contactlist/owner.h>
@@ -411,6 +412,9 @@ void* LicqIcq::ProcessRunningEvent_Client_tep(void *p)
     int channel = (packetTcp != NULL ? packetTcp->channel() : DcSocket::ChannelNormal);
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
+    struct timeval connectStart;
+    gettimeofday(&connectStart, NULL);
+
     unsigned long nVersion;
     bool directMode;
     unsigned short nRemotePort;
@@ -511,6 +515,12 @@ void* LicqIcq::ProcessRunningEvent_Client_tep(void *p)
       }
     }
 
+    struct timeval connectEnd;
+    gettimeofday(&connectEnd, NULL);
+    gIcqProtocol.countDirectConnect(socket != -1,
+        (connectEnd.tv_sec - connectStart.tv_sec) * 1000 +
+        (connectEnd.tv_usec - connectStart.tv_usec) / 1000);
+
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     pthread_testcancel();
     e->m_nSocketDesc = socket;
@@ -669,6 +679,7 @@ void* LicqIcq::Ping_tep(void * /*p*/)
         gIcqProtocol.icqRelogon();
       break;
     }
+    gIcqProtocol.logDirectConnectionStats();
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     pthread_testcancel();
 
@@ -816,6 +827,7 @@ void* LicqIcq::MonitorSockets_func()
             gLog.warning(tr("Can't process packet for service 0x%02X."), svc->GetFam());
             svc->ResetSocket();
             svc->ChangeStatus(STATUS_UNINITIALIZED);
+            svc->failPendingIcons();
             gSocketManager.CloseSocket(nCurrentSocket);
           }
         }
@@ -824,6 +836,7 @@ void* LicqIcq::MonitorSockets_func()
           gLog.warning(tr("Can't receive packet for service 0x%02X."), svc->GetFam());
           svc->ResetSocket();
           svc->ChangeStatus(STATUS_UNINITIALIZED);
+          svc->failPendingIcons();
           gSocketManager.DropSocket(sock_svc);
           gSocketManager.CloseSocket(nCurrentSocket);
         }
@@ -978,8 +991,7 @@ void* LicqIcq::UpdateUsers_tep(void* /* p */)
             pUser->buddyIconHash() != pUser->ourBuddyIconHash())
         {
           unsigned long eventId = Licq::gProtocolManager.getNextEventId();
-          gIcqProtocol.m_xBARTService->SendEvent(pthread_self(), eventId, pUser->id(),
-              ICQ_SNACxBART_DOWNLOADxREQUEST, true);
+          gIcqProtocol.m_xBARTService->requestBuddyIcon(pthread_self(), eventId, *pUser);
           bSent = true;
           bBART = true;
         }
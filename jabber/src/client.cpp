@@ -26,6 +26,7 @@
 #include "user.h"
 #include "vcard.h"
 
+#include <algorithm>
 #include <gloox/connectionhttpproxy.h>
 #include <gloox/connectiontcpclient.h>
 #include <gloox/disco.h>
@@ -50,6 +51,12 @@ using Licq::gLog;
 using std::string;
 
 static const time_t PING_TIMEOUT = 60;
+
+// Maximum number of vCard requests waiting for a reply
+static const size_t MAX_VCARD_REQUESTS = 4;
+
+// Seconds before an unanswered vCard request is given up
+static const time_t VCARD_TIMEOUT = 120;
 Licq::Mutex Client::myGlooxMutex;
 
 GlooxClient::GlooxClient(const gloox::JID& jid, const string& password) :
@@ -77,15 +84,15 @@ Client::Client(Licq::MainLoop& mainLoop, const Licq::UserId& ownerId,
   myClient(myJid, password),
   myTcpClient(NULL),
   myRosterManager(myClient.rosterManager()),
-  myVCardManager(&myClient)
+  myVCardManager(&myClient),
+  myRosterReceived(false)
 {
   myClient.registerStanzaExtension(new gloox::VCardUpdate);
   myClient.addPresenceExtension(new gloox::VCardUpdate);
 
   myClient.registerConnectionListener(this);
   myRosterManager->registerRosterListener(this, false);
-  myClient.logInstance().registerLogHandler(
-      gloox::LogLevelDebug, gloox::LogAreaAll, this);
+  updateLogLevel();
 
   mySessionManager = new SessionManager(myClient, myHandler);
   myClient.registerMessageSessionHandler(mySessionManager);
@@ -155,6 +162,21 @@ void Client::rawFileEvent(int /*id*/, int /*fd*/, int /*revents*/)
 void Client::timeoutEvent(int /*id*/)
 {
   myClient.whitespacePing();
+
+  // Don't let lost replies block the vCard queue
+  const time_t now = time(NULL);
+  std::map<string, time_t>::iterator it = myVCardsInFlight.begin();
+  while (it != myVCardsInFlight.end())
+  {
+    if (it->second + VCARD_TIMEOUT < now)
+    {
+      gLog.warning("vCard request for %s timed out", it->first.c_str());
+      myVCardsInFlight.erase(it++);
+    }
+    else
+      ++it;
+  }
+  sendVCardRequests();
 }
 
 void Client::setPassword(const string& password)
@@ -171,6 +193,7 @@ bool Client::connect(unsigned status)
   // does gnutls_bye(*m_session, ...). But m_session == NULL...
   Licq::MutexLocker locker(myGlooxMutex);
 
+  updateLogLevel();
   changeStatus(status, false);
   myMainLoop.removeCallback(this);
   if (!myClient.connect(false))
@@ -183,6 +206,21 @@ bool Client::connect(unsigned status)
   return true;
 }
 
+void Client::updateLogLevel()
+{
+  // gloox builds its debug messages (including all XML in and out) before
+  // checking if there is anyone to receive them, so only ask for the levels
+  // that will actually be logged
+  gloox::LogLevel level = gloox::LogLevelError;
+  if (gLog.isLogging(Licq::Log::Debug))
+    level = gloox::LogLevelDebug;
+  else if (gLog.isLogging(Licq::Log::Warning))
+    level = gloox::LogLevelWarning;
+
+  myClient.logInstance().removeLogHandler(this);
+  myClient.logInstance().registerLogHandler(level, gloox::LogAreaAll, this);
+}
+
 bool Client::isConnected()
 {
   return myClient.authed();
@@ -199,9 +237,62 @@ void Client::changeStatus(unsigned status, bool notifyHandler)
     myHandler.onChangeStatus(status);
 }
 
-void Client::getVCard(const string& user)
+void Client::getVCard(const string& user, bool urgent)
+{
+  if (myVCardsInFlight.count(user) > 0)
+    return;
+
+  // Don't hold up the login with requests for contacts from the roster
+  std::deque<string>::iterator it =
+      std::find(myDeferredVCards.begin(), myDeferredVCards.end(), user);
+  if (it != myDeferredVCards.end())
+  {
+    if (!urgent)
+      return;
+    myDeferredVCards.erase(it);
+  }
+  else if (!urgent && !myRosterReceived)
+  {
+    myDeferredVCards.push_back(user);
+    return;
+  }
+
+  it = std::find(myVCardQueue.begin(), myVCardQueue.end(), user);
+  if (it != myVCardQueue.end())
+  {
+    if (!urgent)
+      return;
+    myVCardQueue.erase(it);
+  }
+
+  if (urgent)
+    myVCardQueue.push_front(user);
+  else
+    myVCardQueue.push_back(user);
+
+  sendVCardRequests();
+}
+
+void Client::sendVCardRequests()
+{
+  if (!myClient.authed())
+    return;
+
+  while (!myVCardQueue.empty() && myVCardsInFlight.size() < MAX_VCARD_REQUESTS)
+  {
+    const string user = myVCardQueue.front();
+    myVCardQueue.pop_front();
+
+    myVCardsInFlight[user] = time(NULL);
+    myVCardManager.fetchVCard(gloox::JID(user), this);
+  }
+}
+
+void Client::vCardDone(const gloox::JID& jid)
 {
-  myVCardManager.fetchVCard(gloox::JID(user), this);
+  // Replies for our own vCard may come without a from address
+  myVCardsInFlight.erase(jid ? jid.bare() : myClient.jid().bare());
+  sendVCardRequests();
 }
 
 void Client::setOwnerVCard(const UserToVCard& wrapper)
@@ -270,8 +361,9 @@ void Client::onConnect()
   myHandler.onConnect(conn->localInterface(), conn->localPort(),
                       presenceToStatus(myClient.presence().subtype()));
 
-  // Fetch the current vCard from the server
-  myVCardManager.fetchVCard(myClient.jid().bareJID(), this);
+  // Fetch the current vCard from the server, this also sends any requests
+  // queued while not connected
+  getVCard(myClient.jid().bare());
 }
 
 bool Client::onTLSConnect(const gloox::CertInfo& /*info*/)
@@ -284,6 +376,12 @@ void Client::onDisconnect(gloox::ConnectionError error)
   // Socket no longer open, stop monitoring it
   myMainLoop.removeCallback(this);
 
+  // Replies to outstanding requests will never arrive
+  myVCardQueue.clear();
+  myVCardsInFlight.clear();
+  myDeferredVCards.clear();
+  myRosterReceived = false;
+
   bool authError = false;
 
   switch (error)
@@ -350,7 +448,8 @@ void Client::handleItemAdded(const gloox::JID& jid)
   TRACE("%s", jid.full().c_str());
 
   gloox::RosterItem* item = myRosterManager->getRosterItem(jid);
-  addRosterItem(*item);
+  if (addRosterItem(*item))
+    getVCard(jid.bare(), false);
 }
 
 void Client::handleItemSubscribed(const gloox::JID& jid)
@@ -372,7 +471,8 @@ void Client::handleItemUpdated(const gloox::JID& jid)
   TRACE("%s", jid.full().c_str());
 
   gloox::RosterItem* item = myRosterManager->getRosterItem(jid);
-  addRosterItem(*item);
+  if (addRosterItem(*item))
+    getVCard(jid.bare(), false);
 }
 
 void Client::handleItemUnsubscribed(const gloox::JID& jid)
@@ -391,11 +491,21 @@ void Client::handleRoster(const gloox::Roster& roster)
 
   for (it = roster.begin(); it != roster.end(); ++it)
   {
+    if (!isRosterItem(*it->second))
+      continue;
     if (addRosterItem(*it->second))
-      jidlist.insert(it->first);
+      getVCard(it->first, false);
+    jidlist.insert(it->first);
   }
 
   myHandler.onRosterReceived(jidlist);
+
+  // Contact list is complete, fetch vCards for the new contacts
+  myRosterReceived = true;
+  myVCardQueue.insert(myVCardQueue.end(), myDeferredVCards.begin(),
+      myDeferredVCards.end());
+  myDeferredVCards.clear();
+  sendVCardRequests();
 }
 
 void Client::handleRosterPresence(const gloox::RosterItem& item,
@@ -432,13 +542,14 @@ void Client::handleRosterPresence(const gloox::RosterItem& item,
     }
   }
 
-  myHandler.onUserStatusChange(
 #if GLOOXVERSION < 0x010001
-      JID(item.jid()).bare(),
+  const string user = JID(item.jid()).bare();
 #else
-      item.jidJID().bare(),
+  const string user = item.jidJID().bare();
 #endif
-      presenceToStatus(presence), msg, photoHash);
+  if (myHandler.onUserStatusChange(
+      user, presenceToStatus(presence), msg, photoHash))
+    getVCard(user, false);
 }
 
 void Client::handleSelfPresence(const gloox::RosterItem& /*item*/,
@@ -563,6 +674,8 @@ void Client::handleVCard(const gloox::JID& jid, const gloox::VCard* vcard)
 {
   TRACE();
 
+  vCardDone(jid);
+
   if (vcard != NULL)
   {
     VCardToUser user(vcard);
@@ -583,6 +696,9 @@ void Client::handleVCardResult(gloox::VCardHandler::VCardContext context,
     gLog.warning("%s vCard for user %s failed with error %u",
         context == gloox::VCardHandler::StoreVCard ? "Storing" : "Fetching",
         jid ? jid.bare().c_str() : myClient.jid().bare().c_str(), error);
+
+    if (context == gloox::VCardHandler::FetchVCard)
+      vCardDone(jid);
   }
 
   if (!jid && context == gloox::VCardHandler::StoreVCard)
@@ -626,11 +742,17 @@ void Client::broadcastPhotoHash(const boost::optional<std::string>& hash)
   myClient.setPresence();
 }
 
-bool Client::addRosterItem(const gloox::RosterItem& item)
+bool Client::isRosterItem(const gloox::RosterItem& item)
 {
   // Filter out the states where the contact should not be on our list
-  if (item.subscription() == gloox::S10nNoneIn
-      || item.subscription() == gloox::S10nFrom)
+  return item.subscription() != gloox::S10nNoneIn
+      && item.subscription() != gloox::S10nFrom;
+}
+
+bool Client::addRosterItem(const gloox::RosterItem& item)
+{
+  // Returns true for new contacts only, those have no vCard yet
+  if (!isRosterItem(item))
     return false;
 
   // States where we have sent a subscription request that hasn't be answered
@@ -638,14 +760,13 @@ bool Client::addRosterItem(const gloox::RosterItem& item)
       || item.subscription() == gloox::S10nNoneOutIn
       || item.subscription() == gloox::S10nFromOut;
 
-  myHandler.onUserAdded(
+  return myHandler.onUserAdded(
 #if GLOOXVERSION < 0x010001
       item.jid(),
 #else
       item.jidJID().bare(),
 #endif
       item.name(), item.groups(), awaitAuth);
-  return true;
 }
 
 unsigned Client::presenceToStatus(gloox::Presence::PresenceType presence)
@@ -25,6 +25,8 @@
 
 #include <boost/noncopyable.hpp>
 #include <boost/optional.hpp>
+#include <deque>
+#include <map>
 #include <gloox/client.h>
 #include <gloox/connectionlistener.h>
 #include <gloox/loghandler.h>
@@ -86,7 +88,18 @@ public:
   bool connect(unsigned status);
   bool isConnected();
   void changeStatus(unsigned status, bool notifyHandler = true);
-  void getVCard(const std::string& user);
+
+  /**
+   * Fetch the vCard for a contact. Requests are queued so only a few are
+   * outstanding at once and a request for a contact that is already queued
+   * or being fetched is dropped.
+   *
+   * @param user Bare JID of the contact
+   * @param urgent True for requests made by the user, these are sent before
+   *               any queued background requests. Background requests are
+   *               held back until the roster has been received.
+   */
+  void getVCard(const std::string& user, bool urgent = true);
   void setOwnerVCard(const UserToVCard& wrapper);
   void addUser(const std::string& user, const gloox::StringList& groupNames,
                bool notify);
@@ -152,10 +165,35 @@ private:
   gloox::VCardManager myVCardManager;
   boost::optional<std::string> myPendingPhotoHash;
 
+  /// vCard requests waiting to be sent
+  std::deque<std::string> myVCardQueue;
+
+  /// vCard requests sent and the time they were sent
+  std::map<std::string, time_t> myVCardsInFlight;
+
+  /// Background vCard requests made before the roster was received
+  std::deque<std::string> myDeferredVCards;
+
+  /// True when the roster for the current session has been received
+  bool myRosterReceived;
+
+  /// Send queued vCard requests while there is room for them
+  void sendVCardRequests();
+
+  /// A vCard request has been answered or has failed
+  void vCardDone(const gloox::JID& jid);
+
   void broadcastPhotoHash(const boost::optional<std::string>& hash);
 
+  bool isRosterItem(const gloox::RosterItem& item);
   bool addRosterItem(const gloox::RosterItem& item);
 
+  /**
+   * Register with gloox for the lowest log level currently being logged.
+   * Called when connecting so level changes take effect on the next login.
+   */
+  void updateLogLevel();
+
   unsigned presenceToStatus(gloox::Presence::PresenceType presence);
   gloox::Presence::PresenceType statusToPresence(unsigned status);
 };
@@ -26,6 +26,11 @@
 #include "vcard.h"
 
 #include <boost/foreach.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <licq/contactlist/usermanager.h>
 #include <licq/daemon.h>
@@ -49,6 +54,66 @@ using Licq::gOnEventManager;
 using Licq::gUserManager;
 using std::string;
 
+namespace
+{
+
+string pictureCacheFile(const string& sha1)
+{
+  // The hash comes from the network so make sure it's safe as a file name
+  if (sha1.size() != 40 ||
+      sha1.find_first_not_of("0123456789abcdef") != string::npos)
+    return string();
+
+  return Licq::gDaemon.baseDir() + "jabber-pictures/" + sha1;
+}
+
+bool readCachedPicture(const string& sha1, string& data)
+{
+  const string filename = pictureCacheFile(sha1);
+  if (filename.empty())
+    return false;
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size <= 0)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  data.resize(st.st_size);
+  ssize_t count = ::read(fd, &data[0], st.st_size);
+  ::close(fd);
+  return count == st.st_size;
+}
+
+void writeCachedPicture(const string& sha1, const string& data)
+{
+  const string filename = pictureCacheFile(sha1);
+  if (filename.empty())
+    return;
+
+  const string dir = Licq::gDaemon.baseDir() + "jabber-pictures";
+  if (::mkdir(dir.c_str(), 0700) == -1 && errno != EEXIST)
+    return;
+
+  // Write to a temporary file first so a cut off picture is never used
+  const string tmpname = filename + ".tmp";
+  int fd = ::open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1)
+    return;
+  ssize_t count = ::write(fd, data.data(), data.size());
+  ::close(fd);
+  if (count != static_cast<ssize_t>(data.size()) ||
+      ::rename(tmpname.c_str(), filename.c_str()) != 0)
+    ::unlink(tmpname.c_str());
+}
+
+} // namespace
+
 Handler::Handler(const Licq::UserId& ownerId)
   : myOwnerId(ownerId)
 {
@@ -111,7 +176,7 @@ void Handler::onDisconnect(bool authError)
                              myOwnerId));
 }
 
-void Handler::onUserAdded(
+bool Handler::onUserAdded(
     const string& id, const string& name, const std::list<string>& groups,
     bool awaitingAuthorization)
 {
@@ -127,11 +192,6 @@ void Handler::onUserAdded(
   UserWriteGuard user(userId);
   assert(user.isLocked());
 
-  user->SetEnableSave(false);
-
-  if (wasAdded || !user->KeepAliasOnUpdate())
-    user->setAlias(name);
-
   Licq::UserGroupList glist;
   for (std::list<string>::const_iterator it = groups.begin();
       it != groups.end(); ++it)
@@ -143,6 +203,21 @@ void Handler::onUserAdded(
       continue;
     glist.insert(groupId);
   }
+
+  const bool updateAlias = wasAdded || !user->KeepAliasOnUpdate();
+
+  // Roster pushes and rosters from a new session are mostly unchanged, don't
+  // write the user file or notify plugins for those
+  if (!wasAdded && (!updateAlias || user->getAlias() == name) &&
+      user->GetGroups() == glist && user->userEncoding() == "UTF-8" &&
+      user->GetAwaitingAuth() == awaitingAuthorization && user->SendServer())
+    return false;
+
+  user->SetEnableSave(false);
+
+  if (updateAlias)
+    user->setAlias(name);
+
   user->SetGroups(glist);
 
   user->setUserEncoding("UTF-8");
@@ -159,9 +234,8 @@ void Handler::onUserAdded(
       new Licq::PluginSignal(Licq::PluginSignal::SignalUser,
                              Licq::PluginSignal::UserGroups, userId));
 
-  // Request user info if this is a new user
-  if (wasAdded)
-    Licq::gProtocolManager.requestUserInfo(userId);
+  // Caller should request user info if this is a new user
+  return wasAdded;
 }
 
 void Handler::onUserRemoved(const string& id)
@@ -171,13 +245,14 @@ void Handler::onUserRemoved(const string& id)
   Licq::gUserManager.removeLocalUser(UserId(myOwnerId, id));
 }
 
-void Handler::onUserStatusChange(
+bool Handler::onUserStatusChange(
     const string& id, unsigned status, const string& msg,
     const string& photoHash)
 {
   TRACE();
 
   bool refreshInfo = false;
+  bool pictureUpdated = false;
 
   Licq::UserId userId(myOwnerId, id);
   UserWriteGuard user(userId);
@@ -189,14 +264,31 @@ void Handler::onUserStatusChange(
 
     if (!photoHash.empty() && photoHash != user->pictureSha1())
     {
-      Licq::gLog.debug("New picture SHA1 for %s; requesting new VCard",
-                       userId.accountId().c_str());
-      refreshInfo = true;
+      string pictureData;
+      if (readCachedPicture(photoHash, pictureData))
+      {
+        Licq::gLog.debug("New picture SHA1 for %s found in cache",
+                         userId.accountId().c_str());
+        user->setPictureSha1(photoHash);
+        user->SetPicturePresent(user->writePictureData(pictureData));
+        user->save(User::SavePictureInfo);
+        pictureUpdated = true;
+      }
+      else
+      {
+        Licq::gLog.debug("New picture SHA1 for %s; requesting new VCard",
+                         userId.accountId().c_str());
+        refreshInfo = true;
+      }
     }
   }
 
-  if (refreshInfo)
-    Licq::gProtocolManager.requestUserInfo(userId);
+  if (pictureUpdated)
+    Licq::gPluginManager.pushPluginSignal(
+        new Licq::PluginSignal(Licq::PluginSignal::SignalUser,
+                               Licq::PluginSignal::UserPicture, userId));
+
+  return refreshInfo;
 }
 
 void Handler::onUserInfo(const string& id, const VCardToUser& wrapper)
@@ -229,6 +321,13 @@ void Handler::onUserInfo(const string& id, const VCardToUser& wrapper)
 
   if (saveGroup != 0)
   {
+    // Keep pictures by hash so other contacts using the same picture, or this
+    // one switching back to it, won't need another vCard fetch
+    const boost::optional<string> sha1 = wrapper.pictureSha1();
+    if ((saveGroup & User::SavePictureInfo) && sha1 && !sha1->empty() &&
+        wrapper.pictureData().size() <= VCardToUser::MaxPictureSize)
+      writeCachedPicture(*sha1, wrapper.pictureData());
+
     if (saveGroup & User::SaveUserInfo)
       Licq::gPluginManager.pushPluginSignal(
           new Licq::PluginSignal(Licq::PluginSignal::SignalUser,
@@ -45,11 +45,22 @@ public:
   void onChangeStatus(unsigned status);
   void onDisconnect(bool authError);
 
-  void onUserAdded(const std::string& id, const std::string& name,
+  /**
+   * Add or update a contact from the roster
+   *
+   * @return True if the contact is new and its vCard should be fetched
+   */
+  bool onUserAdded(const std::string& id, const std::string& name,
                    const std::list<std::string>& groups,
                    bool awaitingAuthorization);
   void onUserRemoved(const std::string& id);
-  void onUserStatusChange(const std::string& id, unsigned status,
+  /**
+   * Update status for a contact. If the contact has a new picture that is
+   * already in the picture cache it is used directly.
+   *
+   * @return True if the picture has changed and the vCard must be fetched
+   */
+  bool onUserStatusChange(const std::string& id, unsigned status,
                           const std::string& msg,
                           const std::string& photoHash);
   void onUserInfo(const std::string& id, const VCardToUser& wrapper);
@@ -130,6 +130,11 @@ boost::optional<std::string> VCardToUser::pictureSha1() const
     return boost::none;
 }
 
+const std::string& VCardToUser::pictureData() const
+{
+  return myVCard->photo().binval;
+}
+
 int VCardToUser::updateUser(User* user) const
 {
   int saveGroup = User::SaveUserInfo;
@@ -162,7 +167,7 @@ int VCardToUser::updateUser(User* user) const
     if (Licq::Sha1::supported())
       user->setPictureSha1(myPictureSha1);
 
-    if (photo.binval.size() <= 100 * 1024)
+    if (photo.binval.size() <= MaxPictureSize)
       user->SetPicturePresent(user->writePictureData(photo.binval));
     else
     {
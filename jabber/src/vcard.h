@@ -56,6 +56,12 @@ public:
   boost::optional<std::string> pictureSha1() const;
   int updateUser(User* user) const;
 
+  /// Raw picture data from the vCard, empty if there is no picture
+  const std::string& pictureData() const;
+
+  /// Larger pictures are not stored
+  static const size_t MaxPictureSize = 100 * 1024;
+
 private:
   std::string myPictureSha1;
 
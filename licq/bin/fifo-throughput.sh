@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+# Measure throughput and fairness of the Licq command socket (licq_socket)
+#
+# Starts several clients that each pipeline a batch of commands without
+# waiting for results, checks that every command got exactly one result
+# in order and times a single command sent while the batches are running.
+# "nop" isn't a known command so all commands are answered with "unknown"
+# and nothing is changed in the running Licq.
+#
+# Usage: fifo-throughput.sh [clients] [commands] [socket]
+#   clients   Number of clients to run in parallel (default 4)
+#   commands  Number of commands per client (default 10000)
+#   socket    Path of command socket (default ~/.licq/licq_socket)
+#
+# Requires socat and GNU date. Expected output, <t> is the time taken in
+# milliseconds and includes starting socat:
+#
+#   4 clients x 10000 commands: 40000 results in <t> ms
+#   client 1: 10000 results, last "10000 unknown"
+#   client 2: 10000 results, last "10000 unknown"
+#   client 3: 10000 results, last "10000 unknown"
+#   client 4: 10000 results, last "10000 unknown"
+#   single command while busy: "1 unknown" in <t> ms
+#
+# The exit status is non-zero if any client is missing results.
+#
+
+set -eu
+
+CLIENTS=${1:-4}
+COMMANDS=${2:-10000}
+SOCKET=${3:-$HOME/.licq/licq_socket}
+
+if [ ! -S "$SOCKET" ]; then
+  echo "$SOCKET: not a socket, is Licq running?" >&2
+  exit 1
+fi
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+now_ms() {
+  echo $(($(date +%s%N) / 1000000))
+}
+
+# Connection stays open until Licq has sent all results
+client() {
+  socat -t 60 - UNIX-CONNECT:"$SOCKET" < "$1" > "$2"
+}
+
+yes nop | head -n "$COMMANDS" > "$TMP/commands"
+echo nop > "$TMP/single"
+
+start=$(now_ms)
+i=1
+while [ $i -le "$CLIENTS" ]; do
+  client "$TMP/commands" "$TMP/result$i" &
+  i=$((i + 1))
+done
+
+# Other connections must not have to wait for the batches to finish
+single_start=$(now_ms)
+client "$TMP/single" "$TMP/result0"
+single_end=$(now_ms)
+
+wait
+end=$(now_ms)
+
+total=$(cat "$TMP"/result[1-9]* | wc -l)
+echo "$CLIENTS clients x $COMMANDS commands: $total results in $((end - start)) ms"
+
+status=0
+i=1
+while [ $i -le "$CLIENTS" ]; do
+  results=$(wc -l < "$TMP/result$i")
+  last=$(tail -n 1 "$TMP/result$i")
+  echo "client $i: $results results, last \"$last\""
+
+  # Each result must be numbered after the command it belongs to
+  if [ "$results" -ne "$COMMANDS" ] ||
+      ! awk '$1 != NR || $2 != "unknown" { exit 1 }' "$TMP/result$i"; then
+    status=1
+  fi
+  i=$((i + 1))
+done
+
+echo "single command while busy: \"$(cat "$TMP/result0")\" in" \
+    "$((single_end - single_start)) ms"
+exit $status
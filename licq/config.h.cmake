@@ -34,6 +34,9 @@
 /* Define if prctl function is available */
 #cmakedefine HAVE_PRCTL 1
 
+/* Define if posix_spawn function is available */
+#cmakedefine HAVE_POSIX_SPAWN 1
+
 /* Directory where plugins go */
 #define INSTALL_LIBDIR "@Licq_PLUGIN_DIR@/"
 
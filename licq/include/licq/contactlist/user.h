@@ -482,7 +482,7 @@ public:
   int Birthday(unsigned short nDayRange = 0) const;
 
   // Message/History functions
-  unsigned short NewMessages() const            { return(m_vcMessages.size()); }
+  unsigned short NewMessages() const;
   void CancelEvent(unsigned short index);
   const UserEvent* EventPeek(unsigned short index) const;
   const UserEvent* EventPeekId(int id) const;
@@ -492,7 +492,60 @@ public:
   void EventClear(unsigned short);
   void EventClearId(int);
   void EventPush(UserEvent *);
+
+  /**
+   * Remove all unread events at once
+   * Cheaper than calling EventPop() for each event as only one signal is sent.
+   *
+   * @param events List to append events to, caller takes ownership of them
+   */
+  void EventPopAll(UserEventList& events);
+
+  /**
+   * Remove and delete several unread events at once
+   * Cheaper than calling EventClearId() for each event as only one signal is
+   * sent. Ids not in the queue are ignored.
+   *
+   * @param ids Ids of events to remove
+   */
+  void EventClearIds(const std::vector<int>& ids);
   int GetHistory(HistoryList& history) const;
+
+  /**
+   * Read part of the history
+   * Allows history to be loaded in chunks without keeping the user locked
+   * while the entire file is read.
+   *
+   * @param history List to append history entries to
+   * @param position File offset to start reading from, zero for beginning of
+   *                 history. Updated to offset where next chunk starts.
+   * @param maxEntries Maximum number of entries to read
+   * @return True if history was read
+   */
+  bool getHistoryChunk(HistoryList& history, long& position, size_t maxEntries) const;
+
+  /**
+   * Read the most recent part of the history
+   * Only the end of the history file is read so this is cheap also for
+   * contacts with a large history.
+   *
+   * @param history List to append history entries to
+   * @param count Number of entries to read from end of history
+   * @param since Also include earlier entries that are newer than this
+   * @param end History size to read up to as returned by getHistorySize(),
+   *            -1 to read to the end
+   * @return True if history was read
+   */
+  bool getHistoryTail(HistoryList& history, size_t count, time_t since,
+      long end = -1) const;
+
+  /**
+   * Get current size of the history
+   * Can be passed to getHistoryTail() to leave out entries added later.
+   *
+   * @return Size of history file or -1 on error
+   */
+  long getHistorySize() const;
   static void ClearHistory(HistoryList& h);
 
   /**
@@ -740,8 +793,6 @@ protected:
   // Server Side ID, Group SID
   bool m_bAwaitingAuth;
 
-  UserEventList m_vcMessages;
-
   static unsigned short s_nNumUserEvents;
 
   static pthread_mutex_t mutex_nNumUserEvents;
@@ -28,7 +28,7 @@ namespace LicqIcq
 {
 class ChatManager;
 
-void* ChatManager_tep(void*);
+void* ChatConnect_tep(void*);
 void* ChatWaitForSignal_tep(void*);
 }
 
@@ -236,7 +236,7 @@ protected:
   bool m_bLocked;
 
 friend class LicqIcq::ChatManager;
-friend void* LicqIcq::ChatManager_tep(void*);
+friend void* LicqIcq::ChatConnect_tep(void*);
 friend void* LicqIcq::ChatWaitForSignal_tep(void*);
 };
 
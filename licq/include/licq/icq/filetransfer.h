@@ -74,6 +74,7 @@
  *-------------------------------------------------------------------------*/
 
 #include <cstring>
+#include <ctime>
 #include <list>
 #include <string>
 
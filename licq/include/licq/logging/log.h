@@ -50,6 +50,17 @@ public:
   class Stream;
   Stream operator()(Level level) { return log(level); }
 
+  /**
+   * Check if anyone is interested in messages at @a level.
+   *
+   * This is a cheap check that can be used to avoid building expensive log
+   * messages that would just be thrown away. The printf style variants
+   * below already make this check before formatting the message.
+   *
+   * @return True if a message at @a level would be logged; otherwise false.
+   */
+  virtual bool isLogging(Level level) = 0;
+
   virtual void log(Level level, const std::string& msg) = 0;
   void log(Level level, const char* format, va_list args) LICQ_FORMAT(3, 0);
   Stream log(Level level) { return Stream(this, level, 0, 0); }
@@ -169,6 +180,7 @@ private:
 
 public:
   // From Log
+  inline bool isLogging(Level level);
   inline void log(Level level, const std::string& msg);
   inline void packet(Level level, const uint8_t* data, size_t size,
                      const std::string& msg);
@@ -178,6 +190,11 @@ public:
   using Log::packet;
 };
 
+inline bool ThreadLog::isLogging(Level level)
+{
+  return getLog()->isLogging(level);
+}
+
 inline void ThreadLog::log(Level level, const std::string& msg)
 {
   getLog()->log(level, msg);
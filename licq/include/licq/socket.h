@@ -282,6 +282,17 @@ public:
   bool send(const void* buf, size_t length);
   using INetSocket::send;
 
+  /**
+   * Send as much data as possible without blocking
+   * For secure sockets, a call that returned zero must be repeated with
+   * the same data (possibly followed by more) before sending anything else.
+   *
+   * @param buf Buffer with data to send
+   * @param length Number of bytes to send
+   * @return Number of bytes sent, zero if socket is full or -1 on error
+   */
+  ssize_t sendNonBlocking(const void* buf, size_t length);
+
   /// Overloaded to add SSL support
   ssize_t receive(void* buf, size_t maxlength);
   using INetSocket::receive;
@@ -0,0 +1,345 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "historywriter.h"
+
+#include <boost/foreach.hpp>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <licq/logging/log.h>
+#include <licq/thread/mutexlocker.h>
+
+#include "../gettext.h"
+
+#ifndef IOV_MAX
+# define IOV_MAX 16
+#endif
+
+#ifdef __APPLE__
+// fdatasync() isn't declared on all versions of OS X
+# define fdatasync fsync
+#endif
+
+using Licq::MutexLocker;
+using Licq::gLog;
+using LicqDaemon::HistoryWriter;
+using std::map;
+using std::string;
+using std::vector;
+
+// Declare global HistoryWriter (internal for daemon)
+HistoryWriter LicqDaemon::gHistoryWriter;
+
+static unsigned long msecSince(const timeval& start, const timeval& now)
+{
+  long msec = (now.tv_sec - start.tv_sec) * 1000 +
+      (now.tv_usec - start.tv_usec) / 1000;
+  return (msec > 0 ? msec : 0);
+}
+
+/**
+ * Write a full iovec array, handling partial writes and IOV_MAX
+ */
+static bool writeAll(int fd, struct iovec* iov, int count)
+{
+  while (count > 0)
+  {
+    ssize_t written = ::writev(fd, iov, (count < IOV_MAX ? count : IOV_MAX));
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    // Skip past everything that was written
+    while (count > 0 && static_cast<size_t>(written) >= iov->iov_len)
+    {
+      written -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (written > 0)
+    {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+HistoryWriter::HistoryWriter()
+  : myRunning(false),
+    myStopping(false),
+    myBusy(false),
+    mySyncWrites(false)
+{
+  memset(&myStats, 0, sizeof(myStats));
+}
+
+HistoryWriter::~HistoryWriter()
+{
+  stop();
+}
+
+void HistoryWriter::start(bool syncWrites)
+{
+  MutexLocker lock(myMutex);
+  mySyncWrites = syncWrites;
+  if (myRunning)
+    return;
+
+  myStopping = false;
+  if (::pthread_create(&myThread, NULL, &HistoryWriter::threadEntry, this) != 0)
+  {
+    gLog.error(tr("Unable to start history writer thread, "
+        "history will be written synchronously"));
+    return;
+  }
+  myRunning = true;
+}
+
+void HistoryWriter::stop()
+{
+  {
+    MutexLocker lock(myMutex);
+    if (myRunning)
+    {
+      myStopping = true;
+      myQueueCond.signal();
+      lock.unlock();
+
+      ::pthread_join(myThread, NULL);
+
+      lock.relock();
+      myRunning = false;
+
+      gLog.debug(tr("History writer: %lu records in %lu commits, "
+          "max backlog %lu, max latency %lu ms"),
+          myStats.records, myStats.commits, myStats.maxBacklog,
+          myStats.maxLatency);
+    }
+  }
+
+  MutexLocker fileLock(myFileMutex);
+  closeAll();
+}
+
+void* HistoryWriter::threadEntry(void* writer)
+{
+  static_cast<HistoryWriter*>(writer)->run();
+  return NULL;
+}
+
+void HistoryWriter::run()
+{
+  MutexLocker lock(myMutex);
+  while (true)
+  {
+    while (myQueue.empty() && !myStopping)
+      myQueueCond.wait(myMutex);
+
+    // Queue is always drained before exiting
+    if (myQueue.empty())
+      break;
+
+    RecordList records;
+    records.swap(myQueue);
+    myStats.backlog = 0;
+    myBusy = true;
+    lock.unlock();
+
+    {
+      MutexLocker fileLock(myFileMutex);
+      commit(records);
+    }
+
+    lock.relock();
+    myBusy = false;
+    if (myQueue.empty())
+      myIdleCond.broadcast();
+  }
+  myIdleCond.broadcast();
+}
+
+void HistoryWriter::append(const string& filename, const string& record)
+{
+  if (filename.empty() || record.empty())
+    return;
+
+  RecordList records(1);
+  Record& r(records.front());
+  r.filename = filename;
+  r.data = record;
+  ::gettimeofday(&r.queued, NULL);
+
+  {
+    MutexLocker lock(myMutex);
+    if (myRunning && !myStopping)
+    {
+      myQueue.splice(myQueue.end(), records);
+      ++myStats.backlog;
+      if (myStats.backlog > myStats.maxBacklog)
+        myStats.maxBacklog = myStats.backlog;
+      myQueueCond.signal();
+      return;
+    }
+  }
+
+  // No writer thread, write it ourselves
+  MutexLocker fileLock(myFileMutex);
+  commit(records);
+}
+
+void HistoryWriter::flush()
+{
+  MutexLocker lock(myMutex);
+  while (myRunning && (!myQueue.empty() || myBusy))
+    myIdleCond.wait(myMutex);
+}
+
+void HistoryWriter::closeFile(const string& filename)
+{
+  flush();
+
+  MutexLocker fileLock(myFileMutex);
+  for (OpenFileList::iterator i = myFiles.begin(); i != myFiles.end(); ++i)
+  {
+    if (i->filename == filename)
+    {
+      ::close(i->fd);
+      myFiles.erase(i);
+      break;
+    }
+  }
+}
+
+HistoryWriter::Stats HistoryWriter::stats() const
+{
+  MutexLocker lock(myMutex);
+  return myStats;
+}
+
+void HistoryWriter::commit(const RecordList& records)
+{
+  // Group records per file, keeping the order within each file
+  map<string, vector<const Record*> > files;
+  BOOST_FOREACH(const Record& record, records)
+    files[record.filename].push_back(&record);
+
+  map<string, vector<const Record*> >::const_iterator i;
+  for (i = files.begin(); i != files.end(); ++i)
+    writeRecords(i->first, i->second);
+
+  // Records are queued in order so the first one has waited the longest
+  timeval now;
+  ::gettimeofday(&now, NULL);
+  unsigned long latency = msecSince(records.front().queued, now);
+
+  MutexLocker lock(myMutex);
+  myStats.records += records.size();
+  ++myStats.commits;
+  myStats.lastLatency = latency;
+  if (latency > myStats.maxLatency)
+    myStats.maxLatency = latency;
+}
+
+void HistoryWriter::writeRecords(const string& filename,
+    const vector<const Record*>& records)
+{
+  int fd = getFile(filename);
+  if (fd == -1)
+    return;
+
+  static char newline[] = "\n";
+  vector<struct iovec> iov(records.size() * 2);
+  for (size_t i = 0; i < records.size(); ++i)
+  {
+    iov[i*2].iov_base = const_cast<char*>(records[i]->data.data());
+    iov[i*2].iov_len = records[i]->data.size();
+    iov[i*2+1].iov_base = newline;
+    iov[i*2+1].iov_len = 1;
+  }
+
+  bool ok = writeAll(fd, &iov[0], iov.size());
+  if (ok && mySyncWrites)
+    ok = (::fdatasync(fd) == 0);
+
+  if (!ok)
+  {
+    gLog.error(tr("Unable to write history file (%s): %s."),
+        filename.c_str(), strerror(errno));
+
+    // Reopen file on next write in case the problem was with the descriptor
+    ::close(fd);
+    myFiles.pop_front();
+  }
+}
+
+int HistoryWriter::getFile(const string& filename)
+{
+  for (OpenFileList::iterator i = myFiles.begin(); i != myFiles.end(); ++i)
+  {
+    if (i->filename == filename)
+    {
+      // Move to front of LRU
+      myFiles.splice(myFiles.begin(), myFiles, i);
+      return i->fd;
+    }
+  }
+
+  int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 00600);
+  if (fd == -1)
+  {
+    gLog.error(tr("Unable to open history file (%s): %s."),
+        filename.c_str(), strerror(errno));
+    return -1;
+  }
+  // Don't leak descriptors to child processes
+  ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  if (myFiles.size() >= MaxOpenFiles)
+  {
+    ::close(myFiles.back().fd);
+    myFiles.pop_back();
+  }
+
+  OpenFile file;
+  file.filename = filename;
+  file.fd = fd;
+  myFiles.push_front(file);
+  return fd;
+}
+
+void HistoryWriter::closeAll()
+{
+  BOOST_FOREACH(const OpenFile& file, myFiles)
+    ::close(file.fd);
+  myFiles.clear();
+}
@@ -0,0 +1,169 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef LICQDAEMON_CONTACTLIST_HISTORYWRITER_H
+#define LICQDAEMON_CONTACTLIST_HISTORYWRITER_H
+
+#include <list>
+#include <pthread.h>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+#include <licq/thread/condition.h>
+#include <licq/thread/mutex.h>
+
+namespace LicqDaemon
+{
+
+/**
+ * Background writer for user history files
+ *
+ * Records are queued by the calling thread and written by a separate thread
+ * so protocol threads never wait for disk I/O. All records queued since the
+ * last commit are written with one writev() per file and files are kept open
+ * in a small LRU cache.
+ *
+ * If the writer thread isn't running, records are written immediately by the
+ * calling thread.
+ */
+class HistoryWriter
+{
+public:
+  /// Maximum number of history files to keep open
+  static const size_t MaxOpenFiles = 16;
+
+  struct Stats
+  {
+    unsigned long records;      ///< Records written
+    unsigned long commits;      ///< Number of group commits
+    unsigned long backlog;      ///< Records currently waiting to be written
+    unsigned long maxBacklog;   ///< Largest backlog seen
+    unsigned long lastLatency;  ///< Queue to disk time for last commit (ms)
+    unsigned long maxLatency;   ///< Largest queue to disk time seen (ms)
+  };
+
+  HistoryWriter();
+  ~HistoryWriter();
+
+  /**
+   * Start writer thread
+   *
+   * @param syncWrites True to fdatasync() each file after a commit
+   */
+  void start(bool syncWrites);
+
+  /**
+   * Write all pending records, stop writer thread and close all files
+   */
+  void stop();
+
+  /**
+   * Queue a record to be appended to a history file
+   * A line break is added after the record when written.
+   *
+   * @param filename Absolute path of history file
+   * @param record Formatted history entry
+   */
+  void append(const std::string& filename, const std::string& record);
+
+  /**
+   * Wait until all queued records have been written
+   */
+  void flush();
+
+  /**
+   * Flush and close a file
+   * Must be called before a history file is rewritten, moved or removed.
+   *
+   * @param filename Absolute path of history file
+   */
+  void closeFile(const std::string& filename);
+
+  /**
+   * Get writer statistics
+   */
+  Stats stats() const;
+
+private:
+  struct Record
+  {
+    std::string filename;
+    std::string data;
+    struct timeval queued;
+  };
+  typedef std::list<Record> RecordList;
+
+  struct OpenFile
+  {
+    std::string filename;
+    int fd;
+  };
+  typedef std::list<OpenFile> OpenFileList;
+
+  static void* threadEntry(void* writer);
+  void run();
+
+  /**
+   * Write a batch of records
+   * Caller must hold myFileMutex
+   */
+  void commit(const RecordList& records);
+
+  /**
+   * Write records for a single file
+   * Caller must hold myFileMutex
+   */
+  void writeRecords(const std::string& filename,
+      const std::vector<const Record*>& records);
+
+  /**
+   * Get descriptor for a file, opening it if needed
+   * Caller must hold myFileMutex
+   *
+   * @return File descriptor or -1 on error
+   */
+  int getFile(const std::string& filename);
+
+  /**
+   * Close all open files
+   * Caller must hold myFileMutex
+   */
+  void closeAll();
+
+  mutable Licq::Mutex myMutex;
+  Licq::Condition myQueueCond;
+  Licq::Condition myIdleCond;
+  RecordList myQueue;
+  bool myRunning;
+  bool myStopping;
+  bool myBusy;
+  bool mySyncWrites;
+  pthread_t myThread;
+  Stats myStats;
+
+  Licq::Mutex myFileMutex;
+  OpenFileList myFiles;
+};
+
+extern HistoryWriter gHistoryWriter;
+
+} // namespace LicqDaemon
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "../historywriter.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+using LicqDaemon::HistoryWriter;
+using std::string;
+
+namespace LicqTest {
+
+class HistoryWriterFixture : public ::testing::Test
+{
+public:
+  HistoryWriter myWriter;
+  string myFile1;
+  string myFile2;
+
+  HistoryWriterFixture() :
+    myFile1("/tmp/testhistory1.history"),
+    myFile2("/tmp/testhistory2.history")
+  {
+    ::unlink(myFile1.c_str());
+    ::unlink(myFile2.c_str());
+  }
+
+  ~HistoryWriterFixture()
+  {
+    myWriter.stop();
+    ::unlink(myFile1.c_str());
+    ::unlink(myFile2.c_str());
+  }
+
+  static string readFile(const string& filename)
+  {
+    std::ifstream file(filename.c_str());
+    std::stringstream buf;
+    buf << file.rdbuf();
+    return buf.str();
+  }
+};
+
+TEST_F(HistoryWriterFixture, appendWithoutThread)
+{
+  myWriter.append(myFile1, "first");
+  myWriter.append(myFile1, "second");
+  EXPECT_EQ("first\nsecond\n", readFile(myFile1));
+
+  HistoryWriter::Stats stats = myWriter.stats();
+  EXPECT_EQ(2u, stats.records);
+  EXPECT_EQ(0u, stats.backlog);
+}
+
+TEST_F(HistoryWriterFixture, appendWithThread)
+{
+  myWriter.start(false);
+  for (int i = 0; i < 100; ++i)
+  {
+    myWriter.append(myFile1, "a");
+    myWriter.append(myFile2, "b");
+  }
+  myWriter.flush();
+
+  string expected1, expected2;
+  for (int i = 0; i < 100; ++i)
+  {
+    expected1 += "a\n";
+    expected2 += "b\n";
+  }
+  EXPECT_EQ(expected1, readFile(myFile1));
+  EXPECT_EQ(expected2, readFile(myFile2));
+
+  HistoryWriter::Stats stats = myWriter.stats();
+  EXPECT_EQ(200u, stats.records);
+  EXPECT_EQ(0u, stats.backlog);
+  EXPECT_GE(stats.maxBacklog, 1u);
+  EXPECT_LE(stats.commits, 200u);
+}
+
+TEST_F(HistoryWriterFixture, stopWritesQueuedRecords)
+{
+  myWriter.start(true);
+  myWriter.append(myFile1, "one");
+  myWriter.append(myFile1, "two");
+  myWriter.stop();
+
+  EXPECT_EQ("one\ntwo\n", readFile(myFile1));
+
+  // Writes after stop are done directly
+  myWriter.append(myFile1, "three");
+  EXPECT_EQ("one\ntwo\nthree\n", readFile(myFile1));
+}
+
+TEST_F(HistoryWriterFixture, closeFileReopensOnNextWrite)
+{
+  myWriter.start(false);
+  myWriter.append(myFile1, "old");
+  myWriter.closeFile(myFile1);
+  EXPECT_EQ("old\n", readFile(myFile1));
+
+  // Replace file, next write must go to the new file
+  ::unlink(myFile1.c_str());
+  myWriter.append(myFile1, "new");
+  myWriter.flush();
+  EXPECT_EQ("new\n", readFile(myFile1));
+}
+
+TEST_F(HistoryWriterFixture, emptyRecordIsIgnored)
+{
+  myWriter.append(myFile1, "");
+  myWriter.append("", "data");
+  EXPECT_EQ(0u, myWriter.stats().records);
+}
+
+static string lruFile(size_t i)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/tmp/testhistory_lru%lu.history",
+      static_cast<unsigned long>(i));
+  return name;
+}
+
+TEST_F(HistoryWriterFixture, manyFilesAreWritten)
+{
+  const size_t count = HistoryWriter::MaxOpenFiles + 4;
+
+  // Files may be left from an earlier run that was aborted
+  for (size_t i = 0; i < count; ++i)
+    ::unlink(lruFile(i).c_str());
+
+  myWriter.start(false);
+  for (size_t i = 0; i < count; ++i)
+    myWriter.append(lruFile(i), "x");
+  myWriter.append(myFile1, "y");
+  myWriter.stop();
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    EXPECT_EQ("x\n", readFile(lruFile(i)));
+    ::unlink(lruFile(i).c_str());
+  }
+  EXPECT_EQ("y\n", readFile(myFile1));
+}
+
+} // namespace LicqTest
@@ -0,0 +1,152 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "../usereventqueue.h"
+
+#include <gtest/gtest.h>
+
+using Licq::UserEvent;
+using LicqDaemon::UserEventQueue;
+
+namespace LicqTest {
+
+// Queue never dereferences events so any unique pointer will do
+static UserEvent* event(int id)
+{
+  static char events[1000];
+  return reinterpret_cast<UserEvent*>(&events[id]);
+}
+
+TEST(UserEventQueue, empty)
+{
+  UserEventQueue queue;
+  EXPECT_TRUE(queue.empty());
+  EXPECT_EQ(0u, queue.size());
+  EXPECT_EQ(NULL, queue.front());
+  EXPECT_EQ(NULL, queue.back());
+  EXPECT_EQ(NULL, queue.at(0));
+  EXPECT_EQ(NULL, queue.find(1));
+  EXPECT_EQ(NULL, queue.pop());
+  EXPECT_EQ(NULL, queue.remove(1));
+}
+
+TEST(UserEventQueue, pushAndPop)
+{
+  UserEventQueue queue;
+  for (int i = 1; i <= 5; ++i)
+    queue.push(i, event(i));
+
+  EXPECT_EQ(5u, queue.size());
+  EXPECT_EQ(event(1), queue.front());
+  EXPECT_EQ(event(5), queue.back());
+  EXPECT_EQ(event(3), queue.at(2));
+  EXPECT_EQ(NULL, queue.at(5));
+
+  for (int i = 1; i <= 5; ++i)
+  {
+    EXPECT_EQ(event(i), queue.find(i));
+    EXPECT_EQ(event(i), queue.pop());
+    EXPECT_EQ(NULL, queue.find(i));
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(UserEventQueue, removeFromMiddle)
+{
+  UserEventQueue queue;
+  for (int i = 1; i <= 5; ++i)
+    queue.push(i, event(i));
+
+  EXPECT_EQ(event(3), queue.remove(3));
+  EXPECT_EQ(NULL, queue.remove(3));
+  EXPECT_EQ(4u, queue.size());
+  EXPECT_EQ(NULL, queue.find(3));
+  EXPECT_EQ(event(4), queue.find(4));
+  EXPECT_EQ(event(2), queue.at(1));
+  EXPECT_EQ(event(4), queue.at(2));
+  EXPECT_EQ(event(5), queue.at(3));
+
+  // Ends are never left empty
+  EXPECT_EQ(event(5), queue.remove(5));
+  EXPECT_EQ(event(4), queue.back());
+  EXPECT_EQ(event(1), queue.remove(1));
+  EXPECT_EQ(event(2), queue.front());
+
+  EXPECT_EQ(event(2), queue.pop());
+  EXPECT_EQ(event(4), queue.pop());
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(UserEventQueue, interleavedPushAndRemove)
+{
+  UserEventQueue queue;
+
+  // Remove events from the middle while adding more so empty slots soon
+  // outnumber the events, forcing compaction
+  for (int round = 0; round < 100; ++round)
+  {
+    int first = round * 3 + 1;
+    EXPECT_TRUE(queue.push(first, event(first)));
+    EXPECT_TRUE(queue.push(first + 1, event(first + 1)));
+    EXPECT_TRUE(queue.push(first + 2, event(first + 2)));
+    EXPECT_EQ(event(first + 1), queue.remove(first + 1));
+    if (round > 0)
+    {
+      EXPECT_EQ(event(first - 1), queue.remove(first - 1));
+    }
+    EXPECT_EQ(event(first), queue.find(first));
+    EXPECT_EQ(event(first + 2), queue.back());
+  }
+
+  EXPECT_EQ(101u, queue.size());
+  for (int i = 0; i < 100; ++i)
+  {
+    EXPECT_EQ(event(i * 3 + 1), queue.at(i));
+    EXPECT_EQ(event(i * 3 + 1), queue.find(i * 3 + 1));
+  }
+  EXPECT_EQ(event(300), queue.at(100));
+
+  // Indexed access after more holes in the middle
+  for (int i = 1; i < 100; i += 2)
+    EXPECT_EQ(event(i * 3 + 1), queue.remove(i * 3 + 1));
+  EXPECT_EQ(51u, queue.size());
+  for (int i = 0; i < 50; ++i)
+    EXPECT_EQ(event(i * 6 + 1), queue.at(i));
+
+  for (int i = 0; i < 50; ++i)
+    EXPECT_EQ(event(i * 6 + 1), queue.pop());
+  EXPECT_EQ(event(300), queue.pop());
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(UserEventQueue, duplicateIdIsRejected)
+{
+  UserEventQueue queue;
+  EXPECT_TRUE(queue.push(1, event(1)));
+  EXPECT_TRUE(queue.push(2, event(2)));
+  EXPECT_FALSE(queue.push(1, event(3)));
+
+  EXPECT_EQ(2u, queue.size());
+  EXPECT_EQ(event(1), queue.find(1));
+  EXPECT_EQ(event(1), queue.pop());
+  EXPECT_EQ(event(2), queue.pop());
+  EXPECT_TRUE(queue.empty());
+}
+
+} // namespace LicqTest
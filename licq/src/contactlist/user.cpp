@@ -34,6 +34,7 @@
 #include <unistd.h>
 
 #include "gettext.h"
+#include "usermanager.h"
 #include <licq/logging/log.h>
 #include <licq/inifile.h>
 #include <licq/contactlist/owner.h>
@@ -63,7 +64,8 @@ pthread_mutex_t Licq::User::mutex_nNumUserEvents = PTHREAD_MUTEX_INITIALIZER;
 User::Private::Private(User* user, const UserId& id)
   : myUser(user),
     myId(id),
-    myHistory(myId)
+    myHistory(myId),
+    myNewMessagesChanged(false)
 {
   // Empty
 }
@@ -296,8 +298,11 @@ void User::Private::loadLicqInfo()
       }
       while (it != hist.end())
       {
-        myUser->m_vcMessages.push_back( (*it)->Copy() );
-        myUser->incNumUserEvents();
+        Licq::UserEvent* e = (*it)->Copy();
+        if (myEvents.push(e->Id(), e))
+          myUser->incNumUserEvents();
+        else
+          delete e;
         it++;
       }
     }
@@ -308,12 +313,14 @@ void User::Private::loadLicqInfo()
 
 User::~User()
 {
+  LICQ_D();
+
   unsigned long nId;
-  while (m_vcMessages.size() > 0)
+  while (!d->myEvents.empty())
   {
-    nId = m_vcMessages[m_vcMessages.size() - 1]->Id();
-    delete m_vcMessages[m_vcMessages.size() - 1];
-    m_vcMessages.pop_back();
+    Licq::UserEvent* e = d->myEvents.back();
+    nId = e->Id();
+    delete d->myEvents.remove(nId);
     decNumUserEvents();
 
     gPluginManager.pushPluginSignal(new PluginSignal(PluginSignal::SignalUser,
@@ -722,6 +729,29 @@ int User::GetHistory(Licq::HistoryList& history) const
   return d->myHistory.load(history, userEncoding());
 }
 
+bool User::getHistoryChunk(Licq::HistoryList& history, long& position,
+    size_t maxEntries) const
+{
+  LICQ_D();
+
+  return d->myHistory.load(history, userEncoding(), position, maxEntries);
+}
+
+bool User::getHistoryTail(Licq::HistoryList& history, size_t count,
+    time_t since, long end) const
+{
+  LICQ_D();
+
+  return d->myHistory.loadTail(history, userEncoding(), count, since, end);
+}
+
+long User::getHistorySize() const
+{
+  LICQ_D();
+
+  return d->myHistory.size();
+}
+
 void Licq::User::ClearHistory(HistoryList& h)
 {
   UserHistory::clear(h);
@@ -1319,6 +1349,7 @@ void User::saveLicqInfo()
   d->myConf.set("IntIp", Licq::ip_ntoa(m_nIntIp, buf));
   d->myConf.set("Port", Port());
   d->myConf.set("NewMessages", NewMessages());
+  d->myNewMessagesChanged = false;
   d->myConf.set("LastOnline", (unsigned long)LastOnline());
   d->myConf.set("LastSent", (unsigned long)LastSentEvent());
   d->myConf.set("LastRecv", (unsigned long)LastReceivedEvent());
@@ -1384,11 +1415,15 @@ void User::saveOwnerInfo()
 
 void User::save(unsigned group)
 {
+  LICQ_D();
+
+  // Clear before anything can fail so the next change queues the user again
+  if (group & SaveNewMessagesInfo)
+    d->myNewMessagesChanged = false;
+
   if (!EnableSave())
     return;
 
-  LICQ_D();
-
   if (!d->myConf.loadFile())
   {
     gLog.error(tr("Error opening '%s' for reading. See log for details."),
@@ -1470,9 +1505,17 @@ bool Licq::User::deletePictureData() const
 
 void Licq::User::EventPush(Licq::UserEvent *e)
 {
-  m_vcMessages.push_back(e);
+  LICQ_D();
+
+  if (!d->myEvents.push(e->Id(), e))
+  {
+    gLog.warning(tr("Event %d is already queued for %s, ignoring duplicate"),
+        e->Id(), myId.toString().c_str());
+    delete e;
+    return;
+  }
   incNumUserEvents();
-  save(SaveNewMessagesInfo);
+  d->newMessagesChanged();
   Touch();
   SetLastReceivedEvent();
 
@@ -1485,56 +1528,63 @@ void User::Private::writeToHistory(const string& text)
   myHistory.append(text);
 }
 
-void Licq::User::CancelEvent(unsigned short index)
+void User::Private::newMessagesChanged()
 {
-  if (index < NewMessages())
+  if (myNewMessagesChanged)
     return;
-  m_vcMessages[index]->Cancel();
+
+  myNewMessagesChanged = true;
+  LicqDaemon::gUserManager.newMessagesChanged(myId);
+}
+
+unsigned short Licq::User::NewMessages() const
+{
+  LICQ_D_CONST();
+  return d->myEvents.size();
+}
+
+void Licq::User::CancelEvent(unsigned short index)
+{
+  LICQ_D();
+
+  Licq::UserEvent* e = d->myEvents.at(index);
+  if (e != NULL)
+    e->Cancel();
 }
 
 const Licq::UserEvent* Licq::User::EventPeek(unsigned short index) const
 {
-  if (index >= NewMessages()) return (NULL);
-  return (m_vcMessages[index]);
+  LICQ_D_CONST();
+  return d->myEvents.at(index);
 }
 
 const Licq::UserEvent* Licq::User::EventPeekId(int id) const
 {
-  if (m_vcMessages.empty()) return NULL;
-  Licq::UserEvent* e = NULL;
-  UserEventList::const_iterator iter;
-  for (iter = m_vcMessages.begin(); iter != m_vcMessages.end(); ++iter)
-  {
-    if ((*iter)->Id() == id)
-    {
-      e = *iter;
-      break;
-    }
-  }
-  return e;
+  LICQ_D_CONST();
+  return d->myEvents.find(id);
 }
 
 const Licq::UserEvent* Licq::User::EventPeekLast() const
 {
-  if (m_vcMessages.empty()) return (NULL);
-  return (m_vcMessages[m_vcMessages.size() - 1]);
+  LICQ_D_CONST();
+  return d->myEvents.back();
 }
 
 const Licq::UserEvent* Licq::User::EventPeekFirst() const
 {
-  if (m_vcMessages.empty()) return (NULL);
-  return (m_vcMessages[0]);
+  LICQ_D_CONST();
+  return d->myEvents.front();
 }
 
 Licq::UserEvent *Licq::User::EventPop()
 {
-  if (m_vcMessages.empty()) return NULL;
-  Licq::UserEvent* e = m_vcMessages[0];
-  for (unsigned short i = 0; i < m_vcMessages.size() - 1; i++)
-    m_vcMessages[i] = m_vcMessages[i + 1];
-  m_vcMessages.pop_back();
+  LICQ_D();
+
+  Licq::UserEvent* e = d->myEvents.pop();
+  if (e == NULL)
+    return NULL;
   decNumUserEvents();
-  save(SaveNewMessagesInfo);
+  d->newMessagesChanged();
 
   gPluginManager.pushPluginSignal(new PluginSignal(PluginSignal::SignalUser,
       PluginSignal::UserEvents, myId, e->Id()));
@@ -1542,40 +1592,74 @@ Licq::UserEvent *Licq::User::EventPop()
   return e;
 }
 
+void Licq::User::EventPopAll(UserEventList& events)
+{
+  LICQ_D();
+
+  if (d->myEvents.empty())
+    return;
+
+  int lastId = 0;
+  while (Licq::UserEvent* e = d->myEvents.pop())
+  {
+    lastId = e->Id();
+    events.push_back(e);
+    decNumUserEvents();
+  }
+  d->newMessagesChanged();
+
+  gPluginManager.pushPluginSignal(new PluginSignal(PluginSignal::SignalUser,
+      PluginSignal::UserEvents, myId, -lastId));
+}
+
 void Licq::User::EventClear(unsigned short index)
 {
-  if (index >= m_vcMessages.size()) return;
+  LICQ_D();
+
+  const Licq::UserEvent* e = d->myEvents.at(index);
+  if (e == NULL)
+    return;
+
+  EventClearId(e->Id());
+}
+
+void Licq::User::EventClearId(int id)
+{
+  LICQ_D();
 
-  unsigned long id = m_vcMessages[index]->Id();
+  Licq::UserEvent* e = d->myEvents.remove(id);
+  if (e == NULL)
+    return;
 
-  delete m_vcMessages[index];
-  for (unsigned short i = index; i < m_vcMessages.size() - 1; i++)
-    m_vcMessages[i] = m_vcMessages[i + 1];
-  m_vcMessages.pop_back();
+  delete e;
   decNumUserEvents();
-  save(SaveNewMessagesInfo);
+  d->newMessagesChanged();
 
   gPluginManager.pushPluginSignal(new PluginSignal(PluginSignal::SignalUser,
       PluginSignal::UserEvents, myId, -id));
 }
 
-void Licq::User::EventClearId(int id)
+void Licq::User::EventClearIds(const vector<int>& ids)
 {
-  UserEventList::iterator iter;
-  for (iter = m_vcMessages.begin(); iter != m_vcMessages.end(); ++iter)
+  LICQ_D();
+
+  int lastId = 0;
+  BOOST_FOREACH(int id, ids)
   {
-    if ((*iter)->Id() == id)
-    {
-      delete *iter;
-      m_vcMessages.erase(iter);
-      decNumUserEvents();
-      save(SaveNewMessagesInfo);
+    Licq::UserEvent* e = d->myEvents.remove(id);
+    if (e == NULL)
+      continue;
 
-      gPluginManager.pushPluginSignal(new PluginSignal(PluginSignal::SignalUser,
-          PluginSignal::UserEvents, myId, -id));
-      break;
-    }
+    delete e;
+    decNumUserEvents();
+    lastId = id;
   }
+  if (lastId == 0)
+    return;
+  d->newMessagesChanged();
+
+  gPluginManager.pushPluginSignal(new PluginSignal(PluginSignal::SignalUser,
+      PluginSignal::UserEvents, myId, -lastId));
 }
 
 bool Licq::User::isInGroup(int groupId) const
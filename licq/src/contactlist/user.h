@@ -27,6 +27,7 @@
 #include <map>
 #include <string>
 
+#include "usereventqueue.h"
 #include "userhistory.h"
 
 namespace Licq
@@ -53,6 +54,12 @@ public:
   void loadPictureInfo();
   void loadUserInfo();
 
+  /**
+   * Unread events have been added or removed
+   * Saving the count is deferred so bursts of events only cause one write.
+   */
+  void newMessagesChanged();
+
 private:
   /**
    * Initialize all user object. Contains common code for all constructors
@@ -63,6 +70,8 @@ private:
   const UserId myId;
   IniFile myConf;
   LicqDaemon::UserHistory myHistory;
+  LicqDaemon::UserEventQueue myEvents;
+  bool myNewMessagesChanged;
 
   // myUserInfo holds user information like email, address, homepage etc...
   PropertyMap myUserInfo;
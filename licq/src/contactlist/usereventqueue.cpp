@@ -0,0 +1,137 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "usereventqueue.h"
+
+using Licq::UserEvent;
+using LicqDaemon::UserEventQueue;
+
+UserEventQueue::UserEventQueue()
+  : myFirstSeq(0),
+    myHoles(0)
+{
+  // Empty
+}
+
+bool UserEventQueue::push(int id, UserEvent* event)
+{
+  // Index can only point to one slot per id
+  if (myIndex.count(id) > 0)
+    return false;
+
+  Slot slot;
+  slot.id = id;
+  slot.event = event;
+  myIndex[id] = myFirstSeq + mySlots.size();
+  mySlots.push_back(slot);
+  return true;
+}
+
+UserEvent* UserEventQueue::front() const
+{
+  return (mySlots.empty() ? NULL : mySlots.front().event);
+}
+
+UserEvent* UserEventQueue::back() const
+{
+  return (mySlots.empty() ? NULL : mySlots.back().event);
+}
+
+UserEvent* UserEventQueue::at(size_t index) const
+{
+  if (index >= size())
+    return NULL;
+
+  // Positions only map directly to slots when there are no empty slots
+  if (myHoles > 0)
+    compact();
+  return mySlots[index].event;
+}
+
+UserEvent* UserEventQueue::find(int id) const
+{
+  std::map<int, unsigned long>::const_iterator iter = myIndex.find(id);
+  if (iter == myIndex.end())
+    return NULL;
+  return mySlots[iter->second - myFirstSeq].event;
+}
+
+UserEvent* UserEventQueue::pop()
+{
+  if (mySlots.empty())
+    return NULL;
+
+  UserEvent* event = mySlots.front().event;
+  myIndex.erase(mySlots.front().id);
+  mySlots.pop_front();
+  ++myFirstSeq;
+  trim();
+  return event;
+}
+
+UserEvent* UserEventQueue::remove(int id)
+{
+  std::map<int, unsigned long>::iterator iter = myIndex.find(id);
+  if (iter == myIndex.end())
+    return NULL;
+
+  Slot& slot(mySlots[iter->second - myFirstSeq]);
+  UserEvent* event = slot.event;
+  slot.event = NULL;
+  ++myHoles;
+  myIndex.erase(iter);
+
+  trim();
+
+  // Don't let empty slots take more space than the events
+  if (myHoles > 16 && myHoles > size())
+    compact();
+
+  return event;
+}
+
+void UserEventQueue::trim()
+{
+  while (!mySlots.empty() && mySlots.front().event == NULL)
+  {
+    mySlots.pop_front();
+    ++myFirstSeq;
+    --myHoles;
+  }
+  while (!mySlots.empty() && mySlots.back().event == NULL)
+  {
+    mySlots.pop_back();
+    --myHoles;
+  }
+}
+
+void UserEventQueue::compact() const
+{
+  std::deque<Slot> slots;
+  std::deque<Slot>::const_iterator iter;
+  for (iter = mySlots.begin(); iter != mySlots.end(); ++iter)
+  {
+    if (iter->event == NULL)
+      continue;
+    myIndex[iter->id] = myFirstSeq + slots.size();
+    slots.push_back(*iter);
+  }
+  mySlots.swap(slots);
+  myHoles = 0;
+}
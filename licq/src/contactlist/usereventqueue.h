@@ -0,0 +1,137 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef LICQDAEMON_CONTACTLIST_USEREVENTQUEUE_H
+#define LICQDAEMON_CONTACTLIST_USEREVENTQUEUE_H
+
+#include <cstddef>
+#include <deque>
+#include <map>
+
+namespace Licq
+{
+class UserEvent;
+}
+
+namespace LicqDaemon
+{
+
+/**
+ * Queue of unread events for a user
+ *
+ * Events are kept in arrival order with an index from event id to position
+ * so adding, taking the first event and looking up or removing an event by id
+ * doesn't need to scan or shift the queue.
+ *
+ * Events removed from the middle of the queue leave an empty slot behind
+ * which is reclaimed when the queue is compacted. This is done when the queue
+ * is accessed by position or when the empty slots outnumber the events.
+ *
+ * The queue does not own the events.
+ */
+class UserEventQueue
+{
+public:
+  UserEventQueue();
+
+  /// Number of events in queue
+  size_t size() const { return myIndex.size(); }
+
+  /// Check if queue is empty
+  bool empty() const { return myIndex.empty(); }
+
+  /**
+   * Add an event to the end of the queue
+   *
+   * @param id Event id, must be unique within the queue
+   * @param event Event to add
+   * @return False if an event with the same id is already in the queue
+   */
+  bool push(int id, Licq::UserEvent* event);
+
+  /**
+   * Get first event
+   *
+   * @return First event or NULL if queue is empty
+   */
+  Licq::UserEvent* front() const;
+
+  /**
+   * Get last event
+   *
+   * @return Last event or NULL if queue is empty
+   */
+  Licq::UserEvent* back() const;
+
+  /**
+   * Get event at a position in the queue
+   * Compacts the queue first if events have been removed from the middle so
+   *   looping over all events stays linear.
+   *
+   * @param index Position of event, zero is the first event
+   * @return Event or NULL if index is out of range
+   */
+  Licq::UserEvent* at(size_t index) const;
+
+  /**
+   * Find an event by id
+   *
+   * @param id Event id
+   * @return Event or NULL if not in queue
+   */
+  Licq::UserEvent* find(int id) const;
+
+  /**
+   * Remove first event from queue
+   *
+   * @return Removed event or NULL if queue is empty
+   */
+  Licq::UserEvent* pop();
+
+  /**
+   * Remove an event from queue
+   *
+   * @param id Event id
+   * @return Removed event or NULL if not in queue
+   */
+  Licq::UserEvent* remove(int id);
+
+private:
+  struct Slot
+  {
+    int id;
+    Licq::UserEvent* event;     ///< NULL if event has been removed
+  };
+
+  /// Drop empty slots from both ends of the queue
+  void trim();
+
+  /// Remove all empty slots and rebuild the index
+  void compact() const;
+
+  // Compacting doesn't change the contents so it's allowed for const access
+  mutable std::deque<Slot> mySlots;
+  mutable std::map<int, unsigned long> myIndex; ///< Event id to slot sequence number
+  unsigned long myFirstSeq;             ///< Sequence number of first slot
+  mutable size_t myHoles;
+};
+
+} // namespace LicqDaemon
+
+#endif
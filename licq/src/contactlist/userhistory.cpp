@@ -38,6 +38,7 @@
 #include <licq/userid.h>
 
 #include "../gettext.h"
+#include "historywriter.h"
 
 #define MAX_HISTORY_MSG_SIZE 8192
 
@@ -45,6 +46,7 @@ using Licq::UserId;
 using Licq::gLog;
 using Licq::gTranslator;
 using LicqDaemon::UserHistory;
+using LicqDaemon::gHistoryWriter;
 using std::list;
 using std::string;
 
@@ -57,6 +59,13 @@ UserHistory::~UserHistory()
 {
 }
 
+void UserHistory::setFile(const string& filename)
+{
+  if (!myFilename.empty() && myFilename != filename)
+    gHistoryWriter.closeFile(myFilename);
+  myFilename = filename;
+}
+
 
 /* szResult[0] != ':' doubles to check if strlen(szResult) < 1 */
 #define GET_VALID_LINE_OR_BREAK(dest) \
@@ -81,10 +90,20 @@ UserHistory::~UserHistory()
   }
 
 bool UserHistory::load(Licq::HistoryList& lHistory, const string& userEncoding) const
+{
+  long position = 0;
+  return load(lHistory, userEncoding, position, 0);
+}
+
+bool UserHistory::load(Licq::HistoryList& lHistory, const string& userEncoding,
+    long& position, size_t maxEntries, long end) const
 {
   if (myFilename.empty())
     return false;
 
+  // Make sure all queued entries are in the file before reading it
+  gHistoryWriter.flush();
+
   FILE* f = fopen(myFilename.c_str(), "r");
   if (f == NULL)
   {
@@ -100,6 +119,15 @@ bool UserHistory::load(Licq::HistoryList& lHistory, const string& userEncoding)
     }
   }
 
+  if (position > 0 && fseek(f, position, SEEK_SET) != 0)
+  {
+    gLog.warning(tr("Unable to read history file (%s): %s."),
+        myFilename.c_str(), strerror(errno));
+    fclose(f);
+    return false;
+  }
+  size_t count = 0;
+
   // Expression to match message headers
   boost::regex headRegex("\\[ ([SR]) \\| (\\d+) \\| (\\d+) \\| (\\d+) \\| (\\d+) \\].*");
 
@@ -112,6 +140,15 @@ bool UserHistory::load(Licq::HistoryList& lHistory, const string& userEncoding)
       szResult = fgets(sz, sizeof(sz), f);
     if (szResult == NULL) break;
 
+    if ((maxEntries > 0 && count >= maxEntries) ||
+        (end >= 0 && ftell(f) - static_cast<long>(strlen(sz)) >= end))
+    {
+      // Next call should start at this header
+      position = ftell(f) - strlen(sz);
+      fclose(f);
+      return true;
+    }
+
     // Validate header line and extract fields
     boost::cmatch headMatch;
     if (!boost::regex_match(sz, headMatch, headRegex))
@@ -369,21 +406,142 @@ bool UserHistory::load(Licq::HistoryList& lHistory, const string& userEncoding)
     {
       e->SetPending(false);
       lHistory.push_back(e);
+      ++count;
     }
     if (szResult == NULL) break;
   }
 
+  // Next call should only get entries added after this one
+  position = ftell(f);
+
   // Close the file
   fclose(f);
   return true;
 }
 
+bool UserHistory::loadTail(Licq::HistoryList& history, const string& userEncoding,
+    size_t count, time_t since, long end) const
+{
+  if (myFilename.empty())
+    return false;
+
+  // Make sure all queued entries are in the file before reading it
+  gHistoryWriter.flush();
+
+  int fd = open(myFilename.c_str(), O_RDONLY);
+  if (fd == -1)
+  {
+    if (errno == ENOENT)
+      return true;
+
+    gLog.warning(tr("Unable to open history file (%s): %s."),
+        myFilename.c_str(), strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  // Read backwards in growing blocks until we've seen enough headers
+  // tail holds the data from tailStart to end of file (or given end)
+  if (end < 0 || end > st.st_size)
+    end = st.st_size;
+  string tail;
+  off_t tailStart = end;
+  off_t blockSize = 16 * 1024;
+  long position;
+  while (true)
+  {
+    off_t readStart = (tailStart > blockSize ? tailStart - blockSize : 0);
+    string block(tailStart - readStart, '\0');
+    if (!block.empty() && pread(fd, &block[0], block.size(), readStart) !=
+        static_cast<ssize_t>(block.size()))
+    {
+      gLog.warning(tr("Unable to read history file (%s): %s."),
+          myFilename.c_str(), strerror(errno));
+      close(fd);
+      return false;
+    }
+    tail.insert(0, block);
+    tailStart = readStart;
+    blockSize *= 2;
+
+    // Walk headers from newest to oldest to find the oldest entry to include
+    bool done = (tailStart == 0);
+    position = -1;
+    size_t headers = 0;
+    size_t pos = tail.size();
+    while (pos > 0)
+    {
+      pos = tail.rfind('[', pos - 1);
+      if (pos == string::npos)
+        break;
+
+      // Can't tell if this starts a line without reading further back
+      if (pos == 0 && tailStart > 0)
+        break;
+      if (pos > 0 && tail[pos - 1] != '\n')
+        continue;
+
+      char dir;
+      unsigned long subCommand, command, flags;
+      long entryTime;
+      if (sscanf(tail.c_str() + pos, "[ %c | %lu | %lu | %lu | %ld ]",
+          &dir, &subCommand, &command, &flags, &entryTime) != 5)
+        continue;
+
+      ++headers;
+      if (headers > count && entryTime < since)
+      {
+        done = true;
+        break;
+      }
+      position = tailStart + pos;
+    }
+
+    if (done)
+      break;
+  }
+  close(fd);
+
+  if (position == -1)
+    return true;
+  return load(history, userEncoding, position, 0, end);
+}
+
+long UserHistory::size() const
+{
+  if (myFilename.empty())
+    return -1;
+
+  // Make sure all queued entries are in the file before checking it
+  gHistoryWriter.flush();
+
+  struct stat st;
+  if (stat(myFilename.c_str(), &st) != 0)
+    return (errno == ENOENT ? 0 : -1);
+  return st.st_size;
+}
+
 void UserHistory::write(const string& buf, bool append)
 {
   if (myFilename.empty() || buf.empty())
     return;
 
-  int fd = open(myFilename.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 00600);
+  if (append)
+  {
+    gHistoryWriter.append(myFilename, buf);
+    return;
+  }
+
+  // Pending entries must not end up after the new content
+  gHistoryWriter.closeFile(myFilename);
+
+  int fd = open(myFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 00600);
   if (fd == -1)
   {
     gLog.error(tr("Unable to open history file (%s): %s."),
@@ -391,8 +549,6 @@ void UserHistory::write(const string& buf, bool append)
     return;
   }
   ::write(fd, buf.c_str(), buf.size());
-  if (append)
-    ::write(fd, "\n", 1);
   close(fd);
 }
 
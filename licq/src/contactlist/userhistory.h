@@ -20,6 +20,7 @@
 #ifndef LICQDAEMON_CONTACTLIST_USERHISTORY_H
 #define LICQDAEMON_CONTACTLIST_USERHISTORY_H
 
+#include <ctime>
 #include <string>
 
 #include <licq/contactlist/user.h> // HistoryList
@@ -39,8 +40,7 @@ public:
    *
    * @param filename Absolute filename for history file
    */
-  void setFile(const std::string& filename)
-  { myFilename = filename; }
+  void setFile(const std::string& filename);
 
   /**
    * Read history from file
@@ -52,6 +52,46 @@ public:
    */
   bool load(Licq::HistoryList& history, const std::string& userEncoding) const;
 
+  /**
+   * Read part of history from file
+   * Entries appended after the last call will be returned by the next call.
+   *
+   * @param history List to append history entries to
+   * @param userEncoding Default encoding to use if unknown
+   * @param position File offset to start reading from, updated to offset of
+   *                 first entry not read
+   * @param maxEntries Maximum number of entries to read, zero for no limit
+   * @param end File offset to stop reading at, -1 to read to end of file
+   * @return True if history was read
+   */
+  bool load(Licq::HistoryList& history, const std::string& userEncoding,
+      long& position, size_t maxEntries, long end = -1) const;
+
+  /**
+   * Read the most recent entries from history file
+   * The file is scanned backwards from the end so only the part that is
+   * returned is parsed.
+   *
+   * @param history List to append history entries to
+   * @param userEncoding Default encoding to use if unknown
+   * @param count Number of entries to read from end of history
+   * @param since Also read any entries before the last count entries that
+   *              are newer than this
+   * @param end File offset to treat as end of history, -1 for end of file
+   * @return True if history was read
+   */
+  bool loadTail(Licq::HistoryList& history, const std::string& userEncoding,
+      size_t count, time_t since, long end = -1) const;
+
+  /**
+   * Get current size of history file
+   * Queued entries are written first so the size includes everything
+   * appended so far.
+   *
+   * @return Size of history file, zero if there is no file or -1 on error
+   */
+  long size() const;
+
   /**
    * Frees up memory used by a history list
    *
@@ -61,6 +101,8 @@ public:
 
   /**
    * Write to the history file, creating it if necessary
+   * Appended entries are queued to the history writer and written in the
+   * background, overwriting the file is done immediately.
    *
    * @param buf String with data to write
    * @param append True to append data or false to overwrite file
@@ -28,6 +28,7 @@
 #include <licq/logging/log.h>
 #include <licq/pluginsignal.h>
 #include <licq/protocolsignal.h>
+#include <licq/thread/mutexlocker.h>
 
 #include "../daemon.h"
 #include "../gettext.h"
@@ -78,6 +79,8 @@ UserManager::~UserManager()
 
 void UserManager::shutdown()
 {
+  saveNewMessages();
+
   UserMap::iterator iter;
   for (iter = myUsers.begin(); iter != myUsers.end(); ++iter)
     delete iter->second;
@@ -94,6 +97,28 @@ void UserManager::shutdown()
   myOwners.clear();
 }
 
+void UserManager::newMessagesChanged(const UserId& userId)
+{
+  Licq::MutexLocker lock(myNewMessagesMutex);
+  myNewMessagesChanged.insert(userId);
+}
+
+void UserManager::saveNewMessages()
+{
+  std::set<UserId> changed;
+  {
+    Licq::MutexLocker lock(myNewMessagesMutex);
+    changed.swap(myNewMessagesChanged);
+  }
+
+  BOOST_FOREACH(const UserId& userId, changed)
+  {
+    UserWriteGuard u(userId);
+    if (u.isLocked())
+      u->save(User::SaveNewMessagesInfo);
+  }
+}
+
 void UserManager::addOwner(const UserId& userId)
 {
   if (!userId.isOwner())
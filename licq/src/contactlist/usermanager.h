@@ -25,6 +25,7 @@
 #include <map>
 #include <set>
 
+#include <licq/thread/mutex.h>
 #include <licq/thread/readwritemutex.h>
 #include <licq/userid.h>
 
@@ -51,6 +52,20 @@ public:
   bool Load();
   void writeToUserHistory(Licq::User* user, const std::string& text);
 
+  /**
+   * Remember that the number of unread events for a user must be saved
+   * Called by user when events are added or removed, user may be locked
+   *
+   * @param userId Id of user
+   */
+  void newMessagesChanged(const Licq::UserId& userId);
+
+  /**
+   * Save number of unread events for all users that have changed
+   * Called regularly and at shutdown
+   */
+  void saveNewMessages();
+
   /**
    * Load owners and users for a protocol
    * Called by ProtocolManager when protocol is loaded
@@ -214,6 +229,8 @@ private:
   UserMap myUsers;
   OwnerMap myOwners;
   std::set<Licq::UserId> myConfiguredOwners;
+  std::set<Licq::UserId> myNewMessagesChanged;
+  Licq::Mutex myNewMessagesMutex;
   bool m_bAllowSave;
   std::string myDefaultEncoding;
 };
@@ -34,10 +34,12 @@ LicqDaemon::ConversationManager LicqDaemon::gConvoManager;
 Licq::ConversationManager& Licq::gConvoManager(LicqDaemon::gConvoManager);
 
 
-Conversation::Conversation(int id, const UserId& ownerId, int socketId)
+Conversation::Conversation(int id, const UserId& ownerId, int socketId,
+    ConversationManager* manager)
   : myId(id),
     myOwnerId(ownerId),
-    mySocketId(socketId)
+    mySocketId(socketId),
+    myManager(manager)
 {
   // Empty
 }
@@ -89,8 +91,25 @@ int Conversation::socketId() const
 
 bool Conversation::addUser(const UserId& userId)
 {
+  // Manager must be locked first so let it handle the update
+  if (myManager != NULL)
+    return myManager->addUser(this, userId);
+
   MutexLocker lock(myMutex);
+  return addUserUnlocked(userId);
+}
 
+bool Conversation::removeUser(const UserId& userId)
+{
+  if (myManager != NULL)
+    return myManager->removeUser(this, userId);
+
+  MutexLocker lock(myMutex);
+  return removeUserUnlocked(userId);
+}
+
+bool Conversation::addUserUnlocked(const UserId& userId)
+{
   BOOST_FOREACH(const UserId& i, myUsers)
   {
     if (i == userId)
@@ -101,9 +120,8 @@ bool Conversation::addUser(const UserId& userId)
   return true;
 }
 
-bool Conversation::removeUser(const UserId& userId)
+bool Conversation::removeUserUnlocked(const UserId& userId)
 {
-  MutexLocker lock(myMutex);
   std::list<Licq::UserId>::iterator i;
   for (i = myUsers.begin(); i != myUsers.end(); ++i)
     if (*i == userId)
@@ -117,6 +135,7 @@ bool Conversation::removeUser(const UserId& userId)
 ConversationManager::ConversationManager()
 {
   myLastConvoId = 0;
+  myMutex.setName("convomanager");
 }
 
 ConversationManager::~ConversationManager()
@@ -126,7 +145,7 @@ ConversationManager::~ConversationManager()
 
 Licq::Conversation* ConversationManager::add(const UserId& ownerId, int socketId)
 {
-  MutexLocker lock(myMutex);
+  myMutex.lockWrite();
 
   // Find next free conversation id
   do
@@ -137,47 +156,131 @@ Licq::Conversation* ConversationManager::add(const UserId& ownerId, int socketId
   }
   while (myConversations.count(myLastConvoId) > 0);
 
-  Conversation* convo = new Conversation(myLastConvoId, ownerId, socketId);
+  Conversation* convo = new Conversation(myLastConvoId, ownerId, socketId, this);
   myConversations[myLastConvoId] = convo;
+  mySocketIndex[socketId].insert(myLastConvoId);
+
+  myMutex.unlockWrite();
   return convo;
 }
 
 bool ConversationManager::remove(int convoId)
 {
-  MutexLocker lock(myMutex);
+  myMutex.lockWrite();
   std::map<int, Conversation*>::iterator i = myConversations.find(convoId);
   if (i == myConversations.end())
+  {
+    myMutex.unlockWrite();
     return false;
-  delete i->second;
+  }
+  Conversation* convo = i->second;
   myConversations.erase(i);
+
+  std::map<int, ConvoIdSet>::iterator socketIter =
+      mySocketIndex.find(convo->socketId());
+  if (socketIter != mySocketIndex.end())
+  {
+    socketIter->second.erase(convoId);
+    if (socketIter->second.empty())
+      mySocketIndex.erase(socketIter);
+  }
+
+  {
+    MutexLocker convoLock(convo->myMutex);
+    BOOST_FOREACH(const UserId& userId, convo->myUsers)
+    {
+      std::map<UserId, ConvoIdSet>::iterator userIter = myUserIndex.find(userId);
+      if (userIter == myUserIndex.end())
+        continue;
+      userIter->second.erase(convoId);
+      if (userIter->second.empty())
+        myUserIndex.erase(userIter);
+    }
+  }
+
+  myMutex.unlockWrite();
+  delete convo;
   return true;
 }
 
 Licq::Conversation* ConversationManager::get(int convoId)
 {
-  MutexLocker lock(myMutex);
+  myMutex.lockRead();
+  Conversation* convo = NULL;
   std::map<int, Conversation*>::iterator i = myConversations.find(convoId);
   if (i != myConversations.end())
-    return i->second;
-  return NULL;
+    convo = i->second;
+  myMutex.unlockRead();
+  return convo;
 }
 
 Licq::Conversation* ConversationManager::getFromSocket(int socketId)
 {
-  MutexLocker lock(myMutex);
-  std::map<int, Conversation*>::iterator i;
-  for (i = myConversations.begin(); i != myConversations.end(); ++i)
-    if (i->second->socketId() == socketId)
-      return i->second;
-  return NULL;
+  myMutex.lockRead();
+  Conversation* convo = NULL;
+  std::map<int, ConvoIdSet>::const_iterator i = mySocketIndex.find(socketId);
+  if (i != mySocketIndex.end())
+    convo = getFirst(i->second);
+  myMutex.unlockRead();
+  return convo;
 }
 
 Licq::Conversation* ConversationManager::getFromUser(const UserId& userId)
 {
-  MutexLocker lock(myMutex);
-  std::map<int, Conversation*>::iterator i;
-  for (i = myConversations.begin(); i != myConversations.end(); ++i)
-    if (i->second->hasUser(userId))
-      return i->second;
-  return NULL;
+  myMutex.lockRead();
+  Conversation* convo = NULL;
+  std::map<UserId, ConvoIdSet>::const_iterator i = myUserIndex.find(userId);
+  if (i != myUserIndex.end())
+    convo = getFirst(i->second);
+  myMutex.unlockRead();
+  return convo;
+}
+
+Conversation* ConversationManager::getFirst(const ConvoIdSet& ids) const
+{
+  // Index entries are removed when empty
+  std::map<int, Conversation*>::const_iterator i =
+      myConversations.find(*ids.begin());
+  return (i != myConversations.end() ? i->second : NULL);
+}
+
+bool ConversationManager::addUser(Conversation* convo, const UserId& userId)
+{
+  myMutex.lockWrite();
+  bool added;
+  {
+    MutexLocker convoLock(convo->myMutex);
+    added = convo->addUserUnlocked(userId);
+  }
+
+  // Conversation may already have been removed from the manager
+  if (added && myConversations.count(convo->id()) > 0)
+    myUserIndex[userId].insert(convo->id());
+
+  myMutex.unlockWrite();
+  return added;
+}
+
+bool ConversationManager::removeUser(Conversation* convo, const UserId& userId)
+{
+  myMutex.lockWrite();
+  bool removed;
+  {
+    MutexLocker convoLock(convo->myMutex);
+    removed = convo->removeUserUnlocked(userId);
+  }
+
+  if (removed)
+  {
+    std::map<UserId, ConvoIdSet>::iterator i = myUserIndex.find(userId);
+    if (i != myUserIndex.end())
+    {
+      i->second.erase(convo->id());
+      if (i->second.empty())
+        myUserIndex.erase(i);
+    }
+  }
+
+  myMutex.unlockWrite();
+  return removed;
 }
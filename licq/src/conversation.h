@@ -24,17 +24,29 @@
 
 #include <list>
 #include <map>
+#include <set>
 
 #include <licq/thread/mutex.h>
+#include <licq/thread/readwritemutex.h>
 #include <licq/userid.h>
 
 namespace LicqDaemon
 {
+class ConversationManager;
 
 class Conversation : public Licq::Conversation
 {
 public:
-  Conversation(int id, const Licq::UserId& ownerId, int socketId);
+  /**
+   * Constructor
+   *
+   * @param id Conversation id
+   * @param ownerId Owner of the conversation
+   * @param socketId Socket associated with the conversation
+   * @param manager Manager to keep updated when users are added or removed
+   */
+  Conversation(int id, const Licq::UserId& ownerId, int socketId,
+      ConversationManager* manager = NULL);
   ~Conversation();
 
   // From Licq::Conversation
@@ -48,11 +60,18 @@ public:
   bool removeUser(const Licq::UserId& userId);
 
 private:
+  friend class ConversationManager;
+
+  // Unlocked versions of addUser/removeUser, caller must hold myMutex
+  bool addUserUnlocked(const Licq::UserId& userId);
+  bool removeUserUnlocked(const Licq::UserId& userId);
+
   const int myId;
   Licq::UserId myOwnerId;
   std::list<Licq::UserId> myUsers;
   mutable Licq::Mutex myMutex;
-  int mySocketId;
+  const int mySocketId;
+  ConversationManager* const myManager;
 };
 
 class ConversationManager : public Licq::ConversationManager
@@ -69,9 +88,36 @@ public:
   Licq::Conversation* getFromUser(const Licq::UserId& userId);
 
 private:
+  friend class Conversation;
+
+  /**
+   * Add a user to a conversation and update user index
+   * Called from Conversation::addUser()
+   */
+  bool addUser(Conversation* convo, const Licq::UserId& userId);
+
+  /**
+   * Remove a user from a conversation and update user index
+   * Called from Conversation::removeUser()
+   */
+  bool removeUser(Conversation* convo, const Licq::UserId& userId);
+
+  // Conversation ids are kept sorted so lookups return the oldest match
+  typedef std::set<int> ConvoIdSet;
+
+  /**
+   * Get first conversation in an index entry
+   * Caller must hold myMutex
+   */
+  Conversation* getFirst(const ConvoIdSet& ids) const;
+
   std::map<int, Conversation*> myConversations;
+  std::map<int, ConvoIdSet> mySocketIndex;
+  std::map<Licq::UserId, ConvoIdSet> myUserIndex;
   int myLastConvoId;
-  Licq::Mutex myMutex;
+
+  // Lock order is manager before conversation
+  mutable Licq::ReadWriteMutex myMutex;
 };
 
 extern ConversationManager gConvoManager;
@@ -45,6 +45,7 @@
 #include <licq/translator.h>
 #include <licq/userevents.h>
 
+#include "contactlist/historywriter.h"
 #include "contactlist/usermanager.h"
 #include "gettext.h"
 #include "filter.h"
@@ -148,6 +149,10 @@ void Daemon::initialize()
   licqConf.get("SendTypingNotification", mySendTypingNotification, true);
   licqConf.get("IgnoreTypes", myIgnoreTypes, 0);
 
+  // Force history to disk after each write, costly but safer on crashes
+  bool syncHistory;
+  licqConf.get("SyncHistory", syncHistory, false);
+
   unsigned long color;
   licqConf.get("ForegroundColor", color, 0x00000000);
   Licq::Color::setDefaultForeground(color);
@@ -156,6 +161,9 @@ void Daemon::initialize()
 
   releaseLicqConf();
 
+  // Write history from a background thread so protocol threads don't block
+  gHistoryWriter.start(syncHistory);
+
   // Initialize the random number generator
   srand(time(NULL));
 }
@@ -43,10 +43,14 @@
 #include <cctype>
 #include <list>
 #include <string>
+#include <poll.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <vector>
 
 #include <licq/contactlist/owner.h>
 #include <licq/contactlist/user.h>
@@ -179,6 +183,9 @@ struct command_t
 
 static int process_tok(const command_t *table,const char *tok);
 
+// Event tag of last message or url sent, reported to socket clients
+static unsigned long lastEventTag = 0;
+
 static std::string buffer_get_ids(const std::string& buffer, unsigned long* protocolId)
 {
   std::string name(buffer);
@@ -324,11 +331,14 @@ static int fifo_message(int argc, const char* const* argv)
   }
 
   Licq::UserId userId(atoid(argv[1]));
-  if (userId.isValid())
-    gProtocolManager.sendMessage(userId, gTranslator.toUtf8(argv[2]));
-  else
+  if (!userId.isValid())
+  {
     ReportBadBuddy(argv[0], argv[1]);
+    return -1;
+  }
 
+  lastEventTag = gProtocolManager.sendMessage(userId,
+      gTranslator.toUtf8(argv[2]));
   return 0;
 }
 
@@ -342,15 +352,15 @@ static int fifo_url(int argc, const char* const* argv)
   }
 
   Licq::UserId userId(atoid(argv[1]));
-  if (userId.isValid())
+  if (!userId.isValid())
   {
-    const char* szDescr = (argc > 3) ? argv[3] : "" ;
-    gProtocolManager.sendUrl(userId, gTranslator.toUtf8(argv[2]),
-        gTranslator.toUtf8(szDescr));
-  }
-  else
     ReportBadBuddy(argv[0],argv[1]);
+    return -1;
+  }
 
+  const char* szDescr = (argc > 3) ? argv[3] : "" ;
+  lastEventTag = gProtocolManager.sendUrl(userId, gTranslator.toUtf8(argv[2]),
+      gTranslator.toUtf8(szDescr));
   return 0;
 }
 
@@ -799,7 +809,29 @@ static int process_tok(const command_t *table,const char *tok)
 // Declare global Fifo (internal for daemon)
 LicqDaemon::Fifo LicqDaemon::gFifo;
 
+// Commands to run from each input before letting the main loop continue
+static const size_t MAX_COMMANDS_PER_EVENT = 100;
+
+// Unprocessed input to buffer before we stop reading, also limits line length
+static const size_t MAX_INPUT_BUFFER = 64 * 1024;
+
+// Unsent results to buffer for a client before we stop running its commands
+static const size_t MAX_OUTPUT_BUFFER = 256 * 1024;
+
+static const size_t MAX_CLIENTS = 32;
+
+static void setNonBlocking(int fd)
+{
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
 Fifo::Fifo()
+  : myMainLoop(NULL),
+    fifo_fd(-1),
+    myFifoEvents(0),
+    mySocketFd(-1),
+    myMoreScheduled(false)
 {
   // Empty
 }
@@ -811,6 +843,7 @@ Fifo::~Fifo()
 
 void Fifo::initialize(Licq::MainLoop& mainLoop)
 {
+  myMainLoop = &mainLoop;
   string filename = gDaemon.baseDir() + "licq_fifo";
 
   // Open the fifo
@@ -842,53 +875,372 @@ void Fifo::initialize(Licq::MainLoop& mainLoop)
 
   // Register callback from main loop when there is data to read
   if (fifo_fd != -1)
-    mainLoop.addRawFile(fifo_fd, this);
+  {
+    setNonBlocking(fifo_fd);
+    updateFifoEvents();
+  }
+
+  openSocket();
+}
+
+void Fifo::openSocket()
+{
+  mySocketPath = gDaemon.baseDir() + "licq_socket";
+
+  struct sockaddr_un addr;
+  if (mySocketPath.size() >= sizeof(addr.sun_path))
+  {
+    gLog.warning(tr("Path to fifo socket is too long, disabling socket"));
+    mySocketPath.clear();
+    return;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, mySocketPath.c_str());
+
+  // Remove socket left behind by a previous instance
+  struct stat buf;
+  if (lstat(mySocketPath.c_str(), &buf) == 0 && S_ISSOCK(buf.st_mode))
+    unlink(mySocketPath.c_str());
+
+  mySocketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (mySocketFd == -1)
+  {
+    gLog.warning(tr("Unable to create fifo socket: %s"), strerror(errno));
+    mySocketPath.clear();
+    return;
+  }
+
+  mode_t oldMask = umask(0077);
+  int ret = bind(mySocketFd, reinterpret_cast<struct sockaddr*>(&addr),
+      sizeof(addr));
+  umask(oldMask);
+  if (ret == -1 || listen(mySocketFd, SOMAXCONN) == -1)
+  {
+    gLog.warning(tr("Unable to listen on fifo socket %s: %s"),
+        mySocketPath.c_str(), strerror(errno));
+    close(mySocketFd);
+    mySocketFd = -1;
+    mySocketPath.clear();
+    return;
+  }
+
+  setNonBlocking(mySocketFd);
+  myMainLoop->addRawFile(mySocketFd, this);
 }
 
 void Fifo::shutdown()
 {
+  while (!myClients.empty())
+  {
+    close(myClients.begin()->first);
+    myClients.erase(myClients.begin());
+  }
+
+  if (mySocketFd != -1)
+  {
+    close(mySocketFd);
+    mySocketFd = -1;
+  }
+  if (!mySocketPath.empty())
+    unlink(mySocketPath.c_str());
+
   if (fifo_fd != -1)
     close(fifo_fd);
+  fifo_fd = -1;
 }
 
-void Fifo::rawFileEvent(int /*id*/, int /*fd*/, int /*revents*/)
+void Fifo::rawFileEvent(int /*id*/, int fd, int revents)
 {
-  char szBuf[1024];
-  ssize_t readret = read(fifo_fd, szBuf, sizeof(szBuf));
-  if (readret <= 0)
+  if (fd == fifo_fd)
+  {
+    readFifo();
+    if (runCommands(myInputBuffer, NULL))
+      scheduleMore();
+    updateFifoEvents();
     return;
-  myInputBuffer.append(szBuf, readret);
+  }
 
-  // Handle each line in the buffer (and don't assume it's only one at a time)
-  size_t nlpos;
-  while ((nlpos = myInputBuffer.find('\n')) != string::npos)
+  if (fd == mySocketFd)
+  {
+    acceptClients();
+    return;
+  }
+
+  ClientMap::iterator iter = myClients.find(fd);
+  if (iter == myClients.end())
+    return;
+  Client& client(iter->second);
+
+  if ((revents & (POLLIN | POLLHUP | POLLERR)) && !client.eof &&
+      !readClient(fd, client))
+  {
+    closeClient(fd);
+    return;
+  }
+
+  if (runCommands(client.input, &client))
+    scheduleMore();
+
+  if (!writeClient(fd, client) || !updateClientEvents(fd, client))
+    closeClient(fd);
+}
+
+void Fifo::timeoutEvent(int /*id*/)
+{
+  myMoreScheduled = false;
+  bool more = false;
+
+  if (fifo_fd != -1)
+  {
+    if (runCommands(myInputBuffer, NULL))
+      more = true;
+    updateFifoEvents();
+  }
+
+  ClientMap::iterator iter = myClients.begin();
+  while (iter != myClients.end())
+  {
+    int fd = iter->first;
+    Client& client(iter->second);
+    // Advance before client may be removed from map
+    ++iter;
+
+    if (runCommands(client.input, &client))
+      more = true;
+    if (!writeClient(fd, client) || !updateClientEvents(fd, client))
+      closeClient(fd);
+  }
+
+  if (more)
+    scheduleMore();
+}
+
+void Fifo::acceptClients()
+{
+  while (true)
   {
-    // Extract first line from buffer
-    size_t copylen = (nlpos < sizeof(szBuf) ? nlpos+1 : sizeof(szBuf));
-    myInputBuffer.copy(szBuf, 0, copylen);
-    szBuf[copylen] = '\0';
-    myInputBuffer.erase(0, nlpos+1);
+    int fd = accept(mySocketFd, NULL, NULL);
+    if (fd == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        gLog.warning(tr("Unable to accept fifo socket client: %s"),
+            strerror(errno));
+      return;
+    }
 
-    int argc, index;
-    const char* argv[MAX_ARGV];
+    if (myClients.size() >= MAX_CLIENTS)
+    {
+      gLog.warning(tr("Too many fifo socket clients, rejecting connection"));
+      close(fd);
+      continue;
+    }
 
-    gLog.info(tr("%sReceived string: %s"), L_FIFOxSTR, szBuf);
-    line2argv(szBuf, argv, &argc, sizeof(argv) / sizeof(argv[0]) );
-    index = process_tok(fifocmd_table,argv[0]);
+    setNonBlocking(fd);
+    Client& client(myClients[fd]);
+    client.commandCount = 0;
+    client.events = 0;
+    client.eof = false;
+    updateClientEvents(fd, client);
+    gLog.debug(tr("%sClient connected to socket"), L_FIFOxSTR);
+  }
+}
 
-    switch (index)
+void Fifo::readFifo()
+{
+  char buf[4096];
+  while (myInputBuffer.size() < MAX_INPUT_BUFFER)
+  {
+    ssize_t ret = read(fifo_fd, buf, sizeof(buf));
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      break;
+    myInputBuffer.append(buf, ret);
+  }
+
+  // Drop line that will never fit instead of blocking the fifo forever
+  if (myInputBuffer.size() >= MAX_INPUT_BUFFER &&
+      myInputBuffer.find('\n') == string::npos)
+  {
+    gLog.warning(tr("%sLine too long, ignoring"), L_FIFOxSTR);
+    myInputBuffer.clear();
+  }
+}
+
+bool Fifo::readClient(int fd, Client& client)
+{
+  char buf[4096];
+  while (client.input.size() < MAX_INPUT_BUFFER)
+  {
+    ssize_t ret = read(fd, buf, sizeof(buf));
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret == -1)
+      return (errno == EAGAIN || errno == EWOULDBLOCK);
+    if (ret == 0)
     {
-      case CL_UNKNOWN:
+      // Client is done sending, finish its commands before disconnecting
+      client.eof = true;
+      break;
+    }
+    client.input.append(buf, ret);
+  }
+
+  if (client.input.size() >= MAX_INPUT_BUFFER &&
+      client.input.find('\n') == string::npos)
+  {
+    gLog.warning(tr("%sLine too long, disconnecting client"), L_FIFOxSTR);
+    return false;
+  }
+  return true;
+}
+
+bool Fifo::writeClient(int fd, Client& client)
+{
+  while (!client.output.empty())
+  {
+    ssize_t ret = write(fd, client.output.data(), client.output.size());
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret == -1)
+      return (errno == EAGAIN || errno == EWOULDBLOCK);
+    client.output.erase(0, ret);
+  }
+  return true;
+}
+
+bool Fifo::runCommands(string& buffer, Client* client)
+{
+  size_t pos = 0;
+  size_t nlpos;
+  for (size_t count = 0; count < MAX_COMMANDS_PER_EVENT; ++count)
+  {
+    // Don't run commands for a client that isn't reading its results
+    if (client != NULL && client->output.size() >= MAX_OUTPUT_BUFFER)
+      break;
+
+    nlpos = buffer.find('\n', pos);
+    if (nlpos == string::npos)
+      break;
+
+    runCommand(buffer.substr(pos, nlpos - pos), client);
+    pos = nlpos + 1;
+  }
+  buffer.erase(0, pos);
+
+  if (client != NULL && client->output.size() >= MAX_OUTPUT_BUFFER)
+    return false;
+  return buffer.find('\n') != string::npos;
+}
+
+void Fifo::runCommand(const string& line, Client* client)
+{
+  // Ignore empty lines, they don't get a result either
+  if (line.find_first_not_of(" \t\r\v\f") == string::npos)
+    return;
+
+  if (client == NULL)
+    gLog.info(tr("%sReceived string: %s"), L_FIFOxSTR, line.c_str());
+  else
+    gLog.debug(tr("%sReceived string: %s"), L_FIFOxSTR, line.c_str());
+
+  std::vector<char> buf(line.begin(), line.end());
+  buf.push_back('\0');
+
+  int argc, index;
+  const char* argv[MAX_ARGV];
+  line2argv(&buf[0], argv, &argc, sizeof(argv) / sizeof(argv[0]) );
+  index = process_tok(fifocmd_table,argv[0]);
+
+  const char* result;
+  lastEventTag = 0;
+  switch (index)
+  {
+    case CL_UNKNOWN:
+      // Socket clients get the result back so don't fill the log for them
+      if (client == NULL)
         gLog.info(tr("%s: '%s' Unknown fifo command. Try 'help'\n"),
             L_FIFOxSTR,argv[0]);
-        break;
-      case CL_NONE:
-        break;
-      default:
-        argv[0] = fifocmd_table[index].szName;
-        if (fifocmd_table[index].fnc)
-          fifocmd_table[index].fnc(argc, argv);
-        break;
-    }
+      result = "unknown";
+      break;
+    case CL_NONE:
+      return;
+    default:
+      argv[0] = fifocmd_table[index].szName;
+      result = "ok";
+      if (fifocmd_table[index].fnc &&
+          fifocmd_table[index].fnc(argc, argv) != 0)
+        result = "error";
+      break;
   }
+
+  if (client == NULL)
+    return;
+
+  // Result line: <command number> <result> [<event tag>]
+  char reply[64];
+  ++client->commandCount;
+  if (lastEventTag != 0)
+    snprintf(reply, sizeof(reply), "%lu %s %lu\n", client->commandCount,
+        result, lastEventTag);
+  else
+    snprintf(reply, sizeof(reply), "%lu %s\n", client->commandCount, result);
+  gLog.debug(tr("%sResult for '%s': %s"), L_FIFOxSTR, argv[0], result);
+  client->output.append(reply);
+}
+
+void Fifo::updateFifoEvents()
+{
+  // Stop reading while there is a backlog of commands to run
+  setEvents(fifo_fd, myFifoEvents,
+      myInputBuffer.size() < MAX_INPUT_BUFFER ? POLLIN : 0);
+}
+
+bool Fifo::updateClientEvents(int fd, Client& client)
+{
+  int events = 0;
+  if (!client.eof && client.input.size() < MAX_INPUT_BUFFER &&
+      client.output.size() < MAX_OUTPUT_BUFFER)
+    events |= POLLIN;
+  if (!client.output.empty())
+    events |= POLLOUT;
+
+  // Client has hung up and got all its results
+  if (client.eof && client.output.empty() &&
+      client.input.find('\n') == string::npos)
+    return false;
+
+  setEvents(fd, client.events, events);
+  return true;
+}
+
+void Fifo::setEvents(int fd, int& current, int events)
+{
+  if (events == current)
+    return;
+
+  myMainLoop->removeRawFile(fd);
+  if (events != 0)
+    myMainLoop->addRawFile(fd, this, events);
+  current = events;
+}
+
+void Fifo::closeClient(int fd)
+{
+  gLog.debug(tr("%sClient disconnected from socket"), L_FIFOxSTR);
+  myMainLoop->removeRawFile(fd);
+  close(fd);
+  myClients.erase(fd);
+}
+
+void Fifo::scheduleMore()
+{
+  if (myMoreScheduled)
+    return;
+
+  myMainLoop->addTimeout(0, this, CLicq::TimeoutFifoCommands);
+  myMoreScheduled = true;
 }
@@ -22,6 +22,7 @@
 
 #include <boost/noncopyable.hpp>
 #include <cstdio>
+#include <map>
 #include <string>
 
 #include <licq/mainloop.h>
@@ -29,6 +30,17 @@
 namespace LicqDaemon
 {
 
+/**
+ * Command channel for scripts
+ *
+ * Commands are read from the licq_fifo FIFO in the base directory. The same
+ * commands are accepted from several clients connected to the
+ * licq_socket UNIX socket. Socket clients get one result line back for each
+ * command so scripts can pipeline many commands and check each result.
+ *
+ * Commands are run from the main loop. Only a limited number of commands are
+ * run each time so a busy client can't starve other clients or the daemon.
+ */
 class Fifo : public Licq::MainLoopCallback, private boost::noncopyable
 {
 public:
@@ -48,11 +60,101 @@ public:
   void shutdown();
 
 private:
+  struct Client
+  {
+    std::string input;
+    std::string output;
+    unsigned long commandCount;
+    int events;
+    bool eof;
+  };
+  typedef std::map<int, Client> ClientMap;
+
   // From Licq::MainLoopCallback
   void rawFileEvent(int id, int fd, int revents);
+  void timeoutEvent(int id);
+
+  /**
+   * Create listening socket for clients
+   */
+  void openSocket();
+
+  /**
+   * Accept pending connections on listening socket
+   */
+  void acceptClients();
+
+  /**
+   * Read available data from the fifo
+   */
+  void readFifo();
+
+  /**
+   * Read available data from a client
+   *
+   * @return False if client should be disconnected
+   */
+  bool readClient(int fd, Client& client);
+
+  /**
+   * Write pending output to a client
+   *
+   * @return False if client should be disconnected
+   */
+  bool writeClient(int fd, Client& client);
+
+  /**
+   * Run complete command lines from an input buffer
+   *
+   * @param buffer Input buffer, processed lines are removed
+   * @param client Client to write results to or NULL for the fifo
+   * @return True if there are more commands ready to run
+   */
+  bool runCommands(std::string& buffer, Client* client);
+
+  /**
+   * Run a single command line
+   *
+   * @param line Command line without line break
+   * @param client Client to write result to or NULL for the fifo
+   */
+  void runCommand(const std::string& line, Client* client);
+
+  /**
+   * Update events monitored for the fifo
+   */
+  void updateFifoEvents();
+
+  /**
+   * Update events monitored for a client
+   *
+   * @return False if client is finished and should be disconnected
+   */
+  bool updateClientEvents(int fd, Client& client);
+
+  /**
+   * Change events monitored by main loop for a descriptor
+   */
+  void setEvents(int fd, int& current, int events);
+
+  /**
+   * Disconnect a client
+   */
+  void closeClient(int fd);
+
+  /**
+   * Make sure buffered commands are run on next main loop iteration
+   */
+  void scheduleMore();
 
+  Licq::MainLoop* myMainLoop;
   int fifo_fd;
+  int myFifoEvents;
   std::string myInputBuffer;
+  int mySocketFd;
+  std::string mySocketPath;
+  ClientMap myClients;
+  bool myMoreScheduled;
 };
 
 extern Fifo gFifo;
@@ -20,6 +20,9 @@
 #include "gpghelper.h"
 #include "config.h"
 
+#include <boost/lexical_cast.hpp>
+#include <cerrno>
+#include <cstdlib>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -58,19 +61,140 @@ bool Licq::GpgHelper::haveGpgSupport() const
 }
 
 
+#ifdef HAVE_LIBGPGME
+namespace
+{
+
+/**
+ * Output buffer for gpgme
+ * Allocated with malloc so it can be handed to the caller as is and always
+ * has room for a terminating null so it never needs to be copied.
+ */
+struct OutputBuffer
+{
+  char* data;
+  size_t size;
+  size_t capacity;
+  size_t pos;
+};
+
+ssize_t outputRead(void* handle, void* buffer, size_t size)
+{
+  OutputBuffer* out = static_cast<OutputBuffer*>(handle);
+  if (out->pos >= out->size)
+    return 0;
+  if (size > out->size - out->pos)
+    size = out->size - out->pos;
+  memcpy(buffer, out->data + out->pos, size);
+  out->pos += size;
+  return size;
+}
+
+ssize_t outputWrite(void* handle, const void* buffer, size_t size)
+{
+  OutputBuffer* out = static_cast<OutputBuffer*>(handle);
+  size_t end = out->pos + size;
+  if (end + 1 > out->capacity)
+  {
+    size_t capacity = out->capacity * 2;
+    if (capacity < end + 1)
+      capacity = end + 1;
+    char* data = static_cast<char*>(realloc(out->data, capacity));
+    if (data == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+    out->data = data;
+    out->capacity = capacity;
+  }
+  memcpy(out->data + out->pos, buffer, size);
+  out->pos = end;
+  if (end > out->size)
+    out->size = end;
+  return size;
+}
+
+off_t outputSeek(void* handle, off_t offset, int whence)
+{
+  OutputBuffer* out = static_cast<OutputBuffer*>(handle);
+  off_t pos;
+  switch (whence)
+  {
+    case SEEK_SET: pos = offset; break;
+    case SEEK_CUR: pos = static_cast<off_t>(out->pos) + offset; break;
+    case SEEK_END: pos = static_cast<off_t>(out->size) + offset; break;
+    default: pos = -1;
+  }
+  if (pos < 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  out->pos = pos;
+  return pos;
+}
+
+gpgme_data_cbs outputCallbacks = { &outputRead, &outputWrite, &outputSeek, NULL };
+
+/**
+ * Create a gpgme data object writing to an output buffer
+ *
+ * @param out Buffer to initialize
+ * @param sizeHint Expected size of output
+ * @param data Data object to create
+ * @return True on success
+ */
+bool newOutput(OutputBuffer& out, size_t sizeHint, gpgme_data_t* data)
+{
+  out.size = 0;
+  out.pos = 0;
+  out.capacity = sizeHint + 1;
+  out.data = static_cast<char*>(malloc(out.capacity));
+  if (out.data == NULL)
+    return false;
+  if (gpgme_data_new_from_cbs(data, &outputCallbacks, &out) != GPG_ERR_NO_ERROR)
+  {
+    free(out.data);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Get data from output buffer as a null terminated string
+ *
+ * @return String to be freed by caller or NULL if output is empty
+ */
+char* takeOutput(OutputBuffer& out)
+{
+  if (out.size == 0)
+  {
+    free(out.data);
+    return NULL;
+  }
+  out.data[out.size] = '\0';
+  return out.data;
+}
+
+} // namespace
+#endif
+
 GpgHelper::GpgHelper()
   : myKeysIni("licq_gpg.conf")
 {
-#ifdef HAVE_LIBGPGME
-  mCtx = 0;
-#endif
+  // Empty
 }
 
 
 GpgHelper::~GpgHelper()
 {
 #ifdef HAVE_LIBGPGME
-  if (mCtx) gpgme_release(mCtx);
+  std::map<Licq::UserId, CachedKey>::iterator iter;
+  for (iter = myKeyCache.begin(); iter != myKeyCache.end(); ++iter)
+    gpgme_key_unref(iter->second.key);
+  for (size_t i = 0; i < myContexts.size(); ++i)
+    gpgme_release(myContexts[i]);
 #endif
 }
 
@@ -78,34 +202,34 @@ GpgHelper::~GpgHelper()
 char* GpgHelper::Decrypt(const char *szCipher)
 {
 #ifdef HAVE_LIBGPGME
-  if (!mCtx) return 0;
+  if (szCipher == NULL)
+    return 0;
 
-  size_t nRead = 0;
+  // Let gpgme read directly from the message instead of a copy of it
+  size_t cipherLen = strlen(szCipher);
   gpgme_data_t cipher, plain;
+  if (gpgme_data_new_from_mem(&cipher, szCipher, cipherLen, 0) != GPG_ERR_NO_ERROR)
+    return 0;
 
-  MutexLocker lock(myMutex);
-  if (gpgme_data_new(&cipher) != GPG_ERR_NO_ERROR) return 0;
-  char *buf = strdup(szCipher);
-  gpgme_error_t err;
-  gpgme_data_write(cipher, buf, strlen(buf));
-  free(buf);
-
-  if (gpgme_data_new(&plain) != GPG_ERR_NO_ERROR)
+  OutputBuffer out;
+  if (!newOutput(out, cipherLen, &plain))
   {
     gpgme_data_release(cipher);
     return 0;
   }
 
-  gpgme_data_seek(cipher, 0, SEEK_SET);
-  if ((err = gpgme_op_decrypt(mCtx, cipher, plain)) != GPG_ERR_NO_ERROR)
-    gLog.warning(tr("[GPG] gpgme message decryption failed: %s"), gpgme_strerror(err));
-  
+  gpgme_ctx_t ctx = acquireContext();
+  if (ctx != NULL)
+  {
+    gpgme_error_t err = gpgme_op_decrypt(ctx, cipher, plain);
+    releaseContext(ctx);
+    if (err != GPG_ERR_NO_ERROR)
+      gLog.warning(tr("[GPG] gpgme message decryption failed: %s"), gpgme_strerror(err));
+  }
+
   gpgme_data_release(cipher);
-  buf = gpgme_data_release_and_get_mem(plain, &nRead);
-  if (!buf) return 0;
-  buf = (char *)realloc(buf, nRead+1);
-  buf[nRead] = 0;
-  return buf;
+  gpgme_data_release(plain);
+  return takeOutput(out);
 #else
   (void)szCipher;
   return 0;
@@ -115,62 +239,47 @@ char* GpgHelper::Decrypt(const char *szCipher)
 char* GpgHelper::Encrypt(const char *szPlain, const Licq::UserId& userId)
 {
 #ifdef HAVE_LIBGPGME
-  if (!mCtx) return 0;
   if (!szPlain) return 0;
 
-  char iniKey[4096];
-  string key;
-  sprintf(iniKey, "%s.%lu", userId.accountId().c_str(), userId.protocolId());
-  myKeysIni.setSection("keys");
+  gpgme_ctx_t ctx = acquireContext();
+  if (ctx == NULL)
+    return 0;
 
+  gpgme_key_t rcps[2];
+  rcps[0] = getRecipientKey(ctx, userId);
+  rcps[1] = 0;
+  if (rcps[0] == NULL)
   {
-    Licq::UserReadGuard u(userId);
-    if (u.isLocked())
-      key = u->gpgKey();
-  }
-
-  if (key.empty() && !myKeysIni.get(iniKey, key))
+    releaseContext(ctx);
     return 0;
+  }
 
   gLog.info(tr("[GPG] Encrypting message to %s."), userId.toString().c_str());
 
-  MutexLocker lock(myMutex);
-  gpgme_key_t rcps[2];
+  size_t plainLen = strlen(szPlain);
   gpgme_data_t plain = 0, cipher = 0;
-  gpgme_error_t err;
-  char *szCipher = 0;
-  size_t nRead = 0;
+  OutputBuffer out;
+  char* szCipher = 0;
 
-  rcps[1] = 0;
-  // Still use the old method, gpgme_get_key requires the fingerprint, which
-  // actually isn't very helpful.
-  if (gpgme_op_keylist_start (mCtx, key.c_str(), 0) != GPG_ERR_NO_ERROR)
-    gLog.error(tr("[GPG] Couldn't use gpgme recipient: %s"), key.c_str());
-  else
+  if (gpgme_data_new_from_mem(&plain, szPlain, plainLen, 0) == GPG_ERR_NO_ERROR)
   {
-    if (gpgme_op_keylist_next(mCtx, rcps) != GPG_ERR_NO_ERROR)
-      gLog.error(tr("[GPG] Couldn't get key: %s"), key.c_str());
-    else
+    // Armored output is about 4/3 of input plus headers
+    if (newOutput(out, plainLen * 2 + 1024, &cipher))
     {
-      if (gpgme_data_new_from_mem(&plain, szPlain, strlen(szPlain), 0) == GPG_ERR_NO_ERROR &&
-          gpgme_data_new(&cipher) == GPG_ERR_NO_ERROR)
+      gpgme_error_t err = gpgme_op_encrypt(ctx, rcps, GPGME_ENCRYPT_ALWAYS_TRUST, plain, cipher);
+      gpgme_data_release(cipher);
+      if (err == GPG_ERR_NO_ERROR)
+        szCipher = takeOutput(out);
+      else
       {
-        if ((err = gpgme_op_encrypt(mCtx, rcps, GPGME_ENCRYPT_ALWAYS_TRUST, plain, cipher)) == GPG_ERR_NO_ERROR)
-        {
-          szCipher = gpgme_data_release_and_get_mem(cipher, &nRead);
-          cipher = 0;
-          szCipher = (char *)realloc(szCipher, nRead + 1);
-          szCipher[nRead] = 0;
-        }
-        else
-          gLog.error(tr("[GPG] Encryption failed: %s"), gpgme_strerror(err));
+        gLog.error(tr("[GPG] Encryption failed: %s"), gpgme_strerror(err));
+        free(out.data);
       }
     }
-
-    if (cipher) gpgme_data_release(cipher);
-    if (plain) gpgme_data_release(plain);
+    gpgme_data_release(plain);
   }
 
+  releaseContext(ctx);
   gpgme_key_unref(rcps[0]);
   return szCipher;
 #else
@@ -184,14 +293,16 @@ list<GpgKey>* GpgHelper::getKeyList() const
 {
   list<GpgKey>* keyList = new list<GpgKey>();
 #ifdef HAVE_LIBGPGME
-  MutexLocker lock(myMutex);
+  gpgme_ctx_t ctx = acquireContext();
+  if (ctx == NULL)
+    return keyList;
 
-  int err = gpgme_op_keylist_start(mCtx, NULL, 0);
+  int err = gpgme_op_keylist_start(ctx, NULL, 0);
 
   while (err == 0)
   {
     gpgme_key_t key;
-    err = gpgme_op_keylist_next(mCtx, &key);
+    err = gpgme_op_keylist_next(ctx, &key);
     if (err)
       break;
     gpgme_user_id_t uid = key->uids;
@@ -215,6 +326,7 @@ list<GpgKey>* GpgHelper::getKeyList() const
     }
     gpgme_key_release(key);
   }
+  releaseContext(ctx);
 #endif
   return keyList;
 }
@@ -233,13 +345,108 @@ void GpgHelper::initialize()
   if (gpgme_engine_check_version(GPGME_PROTOCOL_OpenPGP) != GPG_ERR_NO_ERROR)
     gLog.error(tr("[GPG] gpgme engine OpenPGP not found"));
 
-  gpgme_new(&mCtx);
-  gpgme_set_protocol(mCtx, GPGME_PROTOCOL_OpenPGP);
-  gpgme_set_armor(mCtx, 1);
-  gpgme_set_passphrase_cb(mCtx, PassphraseCallback, this);
+  // One context per core so messages can be handled in parallel
+  long numContexts = sysconf(_SC_NPROCESSORS_ONLN);
+  if (numContexts < 1)
+    numContexts = 1;
+  if (numContexts > static_cast<long>(MaxContexts))
+    numContexts = MaxContexts;
+
+  MutexLocker lock(myMutex);
+  for (long i = 0; i < numContexts; ++i)
+  {
+    gpgme_ctx_t ctx;
+    if (gpgme_new(&ctx) != GPG_ERR_NO_ERROR)
+      break;
+    gpgme_set_protocol(ctx, GPGME_PROTOCOL_OpenPGP);
+    gpgme_set_armor(ctx, 1);
+    gpgme_set_passphrase_cb(ctx, PassphraseCallback, this);
+    myContexts.push_back(ctx);
+    myIdleContexts.push_back(ctx);
+  }
 #endif
 }
 
+#ifdef HAVE_LIBGPGME
+gpgme_ctx_t GpgHelper::acquireContext() const
+{
+  MutexLocker lock(myMutex);
+  if (myContexts.empty())
+    return NULL;
+
+  while (myIdleContexts.empty())
+    myContextAvailable.wait(myMutex);
+
+  gpgme_ctx_t ctx = myIdleContexts.back();
+  myIdleContexts.pop_back();
+  return ctx;
+}
+
+void GpgHelper::releaseContext(gpgme_ctx_t ctx) const
+{
+  MutexLocker lock(myMutex);
+  myIdleContexts.push_back(ctx);
+  myContextAvailable.signal();
+}
+
+gpgme_key_t GpgHelper::getRecipientKey(gpgme_ctx_t ctx, const Licq::UserId& userId)
+{
+  // Key set for user takes precedence over licq_gpg.conf
+  string userKeyId;
+  {
+    Licq::UserReadGuard u(userId);
+    if (u.isLocked())
+      userKeyId = u->gpgKey();
+  }
+
+  string keyId;
+  {
+    MutexLocker lock(myMutex);
+    std::map<Licq::UserId, CachedKey>::const_iterator iter = myKeyCache.find(userId);
+    if (iter != myKeyCache.end() && iter->second.userKeyId == userKeyId)
+    {
+      gpgme_key_ref(iter->second.key);
+      return iter->second.key;
+    }
+
+    keyId = userKeyId;
+    if (keyId.empty())
+    {
+      myKeysIni.setSection("keys");
+      if (!myKeysIni.get(userId.accountId() + "." +
+          boost::lexical_cast<string>(userId.protocolId()), keyId))
+        return NULL;
+    }
+  }
+
+  // Still use the old method, gpgme_get_key requires the fingerprint, which
+  // actually isn't very helpful.
+  gpgme_key_t key = NULL;
+  if (gpgme_op_keylist_start(ctx, keyId.c_str(), 0) != GPG_ERR_NO_ERROR)
+  {
+    gLog.error(tr("[GPG] Couldn't use gpgme recipient: %s"), keyId.c_str());
+    return NULL;
+  }
+  if (gpgme_op_keylist_next(ctx, &key) != GPG_ERR_NO_ERROR)
+  {
+    gLog.error(tr("[GPG] Couldn't get key: %s"), keyId.c_str());
+    gpgme_op_keylist_end(ctx);
+    return NULL;
+  }
+  gpgme_op_keylist_end(ctx);
+
+  // Failed lookups aren't cached as the key may be imported later
+  MutexLocker lock(myMutex);
+  CachedKey& cached(myKeyCache[userId]);
+  if (cached.key != NULL)
+    gpgme_key_unref(cached.key);
+  cached.userKeyId = userKeyId;
+  cached.key = key;
+  gpgme_key_ref(key);
+  return key;
+}
+#endif
+
 #ifdef HAVE_LIBGPGME
 gpgme_error_t GpgHelper::PassphraseCallback(void* helperPtr, const char *,
     const char *, int prev_was_bad, int fd)
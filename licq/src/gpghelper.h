@@ -28,8 +28,13 @@
 #include <gpgme.h>
 #endif
 
+#include <map>
+#include <vector>
+
 #include <licq/inifile.h>
+#include <licq/thread/condition.h>
 #include <licq/thread/mutex.h>
+#include <licq/userid.h>
 
 namespace LicqDaemon
 {
@@ -48,9 +53,45 @@ public:
 
 private:
 #ifdef HAVE_LIBGPGME
+  /// Maximum number of contexts in pool
+  static const unsigned MaxContexts = 8;
+
+  /**
+   * Recipient key for a user
+   */
+  struct CachedKey
+  {
+    CachedKey() : key(NULL) { }
+
+    std::string userKeyId;      ///< Key set in user data when key was cached
+    gpgme_key_t key;
+  };
+
   static gpgme_error_t PassphraseCallback(void* helperPtr, const char *, const char*, int, int);
 
-  gpgme_ctx_t mCtx;
+  /**
+   * Get a context from the pool, waits until one is available
+   */
+  gpgme_ctx_t acquireContext() const;
+
+  /**
+   * Return a context to the pool
+   */
+  void releaseContext(gpgme_ctx_t ctx) const;
+
+  /**
+   * Get recipient key for a user, using cached key if still valid
+   *
+   * @param ctx Context to use if key must be looked up
+   * @param userId User to get key for
+   * @return Key with an extra reference or NULL if user has no key
+   */
+  gpgme_key_t getRecipientKey(gpgme_ctx_t ctx, const Licq::UserId& userId);
+
+  std::vector<gpgme_ctx_t> myContexts;
+  mutable std::vector<gpgme_ctx_t> myIdleContexts;
+  mutable Licq::Condition myContextAvailable;
+  std::map<Licq::UserId, CachedKey> myKeyCache;
 #endif
   std::string myGpgPassphrase;
   Licq::IniFile myKeysIni;
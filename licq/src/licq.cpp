@@ -43,6 +43,7 @@
 #include <licq/inifile.h>
 #include <licq/version.h>
 
+#include "contactlist/historywriter.h"
 #include "contactlist/usermanager.h"
 #include "daemon.h"
 #include "filter.h"
@@ -53,6 +54,7 @@
 #include "oneventmanager.h"
 #include "plugin/pluginmanager.h"
 #include "sarmanager.h"
+#include "spawnserver.h"
 #include "statistics.h"
 
 #ifdef USE_FIFO
@@ -336,6 +338,9 @@ bool CLicq::Init(int argc, char **argv)
   myConsoleLog->setLogLevel(Licq::Log::Error, true);
   myConsoleLog->setUseColors(bUseColor);
 
+  // Start command helper while we're still small and single threaded
+  LicqDaemon::gSpawnServer.start();
+
   // Redirect stdout and stderr if asked to
   if (!redirect.empty()) {
     if (bRedirect_ok)
@@ -689,9 +694,10 @@ void CLicq::rawFileEvent(int /*id*/, int /*fd*/, int /*revents*/)
 
     case NotifyShuttingDown:
       // Time to quit, but wait for plugins to shut down first
-      myMainLoop.addTimeout(PluginManager::MAX_WAIT_PLUGIN * 1000, this, 2);
+      myMainLoop.addTimeout(PluginManager::MAX_WAIT_PLUGIN * 1000, this,
+          TimeoutShutdown);
       // Stop flushing statistics
-      myMainLoop.removeTimeout(1);
+      myMainLoop.removeTimeout(TimeoutFlush);
       break;
   }
 }
@@ -700,12 +706,15 @@ void CLicq::timeoutEvent(int id)
 {
   switch (id)
   {
-    case 1:
+    case TimeoutFlush:
       // Flush statistics data regulary
       gStatistics.flush();
+
+      // Unread event counts aren't saved on every change
+      gUserManager.saveNewMessages();
       break;
 
-    case 2:
+    case TimeoutShutdown:
       // Timeout waiting for plugins to shut down
       myMainLoop.quit();
       break;
@@ -740,7 +749,7 @@ int CLicq::Main()
   gDaemon.autoLogon();
 
   // Flush statistics data regulary
-  myMainLoop.addTimeout(60*1000, this, 1, false);
+  myMainLoop.addTimeout(60*1000, this, TimeoutFlush, false);
 
   // Run
   myMainLoop.run();
@@ -751,6 +760,11 @@ int CLicq::Main()
 
   gUserManager.shutdown();
 
+  // Write any history still queued
+  LicqDaemon::gHistoryWriter.stop();
+
+  LicqDaemon::gSpawnServer.stop();
+
   // Flush statistics counters
   gStatistics.flush();
 
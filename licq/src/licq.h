@@ -62,6 +62,14 @@ public:
   static const char NotifyReapPlugin = 'P';
   static const char NotifyShuttingDown = 'X';
 
+  // Ids of timeouts in the main loop, including ones used by the fifo
+  enum MainLoopTimeout
+  {
+    TimeoutFlush = 1,           // Save statistics and unread counts
+    TimeoutShutdown = 2,        // Stop waiting for plugins to exit
+    TimeoutFifoCommands = 3     // Run buffered fifo commands
+  };
+
   /**
    * Send a notification to the main thread
    *
@@ -21,6 +21,7 @@
  */
 
 #include "adjustablelogsink.h"
+#include "logdistributor.h"
 
 #include <licq/thread/mutexlocker.h>
 
@@ -50,35 +51,47 @@ bool AdjustableLogSink::isLoggingPackets() const
 
 void AdjustableLogSink::setLogLevel(Licq::Log::Level level, bool enable)
 {
-  MutexLocker locker(myMutex);
-  if (enable)
-    myLogLevels |= (1 << level);
-  else
-    myLogLevels &= ~(1 << level);
+  {
+    MutexLocker locker(myMutex);
+    if (enable)
+      myLogLevels |= (1 << level);
+    else
+      myLogLevels &= ~(1 << level);
+  }
+  LogDistributor::levelsChanged();
 }
 
 void AdjustableLogSink::setLogPackets(bool enable)
 {
-  MutexLocker locker(myMutex);
-  if (enable)
-    myLogLevels |= PacketBit;
-  else
-    myLogLevels &= ~PacketBit;
+  {
+    MutexLocker locker(myMutex);
+    if (enable)
+      myLogLevels |= PacketBit;
+    else
+      myLogLevels &= ~PacketBit;
+  }
+  LogDistributor::levelsChanged();
 }
 
 void AdjustableLogSink::setAllLogLevels(bool enable)
 {
-  MutexLocker locker(myMutex);
-  if (enable)
-    myLogLevels |= AllLevelsMask;
-  else
-    myLogLevels &= ~AllLevelsMask;
+  {
+    MutexLocker locker(myMutex);
+    if (enable)
+      myLogLevels |= AllLevelsMask;
+    else
+      myLogLevels &= ~AllLevelsMask;
+  }
+  LogDistributor::levelsChanged();
 }
 
 void AdjustableLogSink::setLogLevelsFromBitmask(unsigned int levels)
 {
-  MutexLocker locker(myMutex);
-  myLogLevels = levels & (AllLevelsMask | PacketBit);
+  {
+    MutexLocker locker(myMutex);
+    myLogLevels = levels & (AllLevelsMask | PacketBit);
+  }
+  LogDistributor::levelsChanged();
 }
 
 unsigned int AdjustableLogSink::getLogLevelsBitmask() const
@@ -88,12 +88,16 @@ static inline std::string vaToString(const char* format, va_list args)
 
 void Licq::Log::log(Level level, const char* format, va_list args)
 {
+  if (!isLogging(level))
+    return;
   log(level, vaToString(format, args));
 }
 
 void Licq::Log::packet(Level level, const uint8_t* data,
                        size_t size, const char* format, va_list args)
 {
+  if (!isLogging(level))
+    return;
   packet(level, data, size, vaToString(format, args));
 }
 
@@ -107,6 +111,11 @@ Log::Log(const std::string& owner, LogSink& sink) :
   // Empty
 }
 
+bool Log::isLogging(Level level)
+{
+  return mySink.isLogging(level);
+}
+
 void Log::log(Level level, const std::string& msg)
 {
   if (!mySink.isLogging(level))
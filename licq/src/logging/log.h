@@ -38,6 +38,7 @@ public:
   Log(const std::string& owner, Licq::LogSink& sink);
 
   // From Licq::Log
+  bool isLogging(Level level);
   void log(Level level, const std::string& msg);
   void packet(Level level, const uint8_t* data, size_t size,
               const std::string& msg);
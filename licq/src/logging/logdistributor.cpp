@@ -26,41 +26,85 @@ using Licq::LogSink;
 using Licq::MutexLocker;
 using namespace LicqDaemon;
 
+volatile unsigned int LogDistributor::ourGeneration = 0;
+
+LogDistributor::LogDistributor() :
+  myCache(0)
+{
+  // Empty
+}
+
+void LogDistributor::levelsChanged()
+{
+  __sync_add_and_fetch(&ourGeneration, 1);
+}
+
 void LogDistributor::registerSink(LogSink::Ptr sink)
 {
-  MutexLocker locker(myMutex);
-  if (std::find(mySinks.begin(), mySinks.end(), sink) != mySinks.end())
-    return;
+  {
+    MutexLocker locker(myMutex);
+    if (std::find(mySinks.begin(), mySinks.end(), sink) != mySinks.end())
+      return;
 
-  mySinks.push_back(sink);
+    mySinks.push_back(sink);
+  }
+  levelsChanged();
 }
 
 void LogDistributor::unregisterSink(LogSink::Ptr sink)
 {
-  MutexLocker locker(myMutex);
-  mySinks.remove(sink);
+  {
+    MutexLocker locker(myMutex);
+    mySinks.remove(sink);
+  }
+  levelsChanged();
 }
 
-bool LogDistributor::isLogging(Licq::Log::Level level) const
+bool LogDistributor::isCached(unsigned int bit) const
 {
-  MutexLocker locker(myMutex);
-  BOOST_FOREACH(LogSink::Ptr sink, mySinks)
+  // Read the generation before asking the sinks, if a sink changes while we
+  // are asking, the generation will have moved on and our answer is stored
+  // for a generation no one will look for.
+  const unsigned int generation = (ourGeneration & 0xffff) << 16;
+  const unsigned int oldCache = myCache;
+  unsigned int cache = oldCache;
+  if ((cache & 0xffff0000) != generation)
+    cache = generation;
+  else if (cache & (0x100 << bit))
+    return cache & (1 << bit);
+
+  bool logging = false;
   {
-    if (sink->isLogging(level))
-      return true;
+    MutexLocker locker(myMutex);
+    BOOST_FOREACH(LogSink::Ptr sink, mySinks)
+    {
+      if (bit == PacketsBit ? sink->isLoggingPackets() :
+          sink->isLogging(static_cast<Licq::Log::Level>(bit)))
+      {
+        logging = true;
+        break;
+      }
+    }
   }
-  return false;
+
+  unsigned int newCache = cache | (0x100 << bit);
+  if (logging)
+    newCache |= (1 << bit);
+
+  // Only store if no one else updated the cache meanwhile, the answer we
+  // return is still good for this call
+  __sync_bool_compare_and_swap(&myCache, oldCache, newCache);
+  return logging;
+}
+
+bool LogDistributor::isLogging(Licq::Log::Level level) const
+{
+  return isCached(level);
 }
 
 bool LogDistributor::isLoggingPackets() const
 {
-  MutexLocker locker(myMutex);
-  BOOST_FOREACH(LogSink::Ptr sink, mySinks)
-  {
-    if (sink->isLoggingPackets())
-      return true;
-  }
-  return false;
+  return isCached(PacketsBit);
 }
 
 void LogDistributor::log(Message::Ptr message)
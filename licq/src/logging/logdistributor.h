@@ -34,6 +34,17 @@ namespace LicqDaemon
 class LogDistributor : public Licq::LogSink
 {
 public:
+  LogDistributor();
+
+  /**
+   * Tells all distributors that the set of levels logged by some sink has
+   * changed so that cached answers to isLogging() must be recomputed.
+   *
+   * Must be called after the change has been made. Sinks whose answers never
+   * change after they have been registered don't need to call this.
+   */
+  static void levelsChanged();
+
   /**
    * Registers a sink that will receive a copy of future log messages.
    *
@@ -54,8 +65,29 @@ public:
   void log(Message::Ptr message);
 
 private:
+  /**
+   * Look up @a bit in the cached level mask, asking the sinks if the cache
+   * is stale or doesn't know the answer yet.
+   *
+   * @param bit Bit in the mask, the log level or PacketsBit.
+   */
+  bool isCached(unsigned int bit) const;
+
+  /// Bit used in the cached mask for isLoggingPackets()
+  static const unsigned int PacketsBit = 0;
+
+  /// Bumped every time any sink changes its levels
+  static volatile unsigned int ourGeneration;
+
   mutable Licq::Mutex myMutex;
 
+  /**
+   * Cached answers from the sinks, read without holding myMutex.
+   * Upper 16 bits is the generation the cache is valid for, bits 8-15 tells
+   * which levels are known and bits 0-7 holds the answers for those.
+   */
+  mutable volatile unsigned int myCache;
+
   typedef std::list<LogSink::Ptr> LogSinkList;
   LogSinkList mySinks;
 };
@@ -20,6 +20,8 @@
 #include "../logdistributor.h"
 #include "mocklogsink.h"
 
+#include <licq/logging/pluginlogsink.h>
+
 #include <gtest/gtest.h>
 
 using ::testing::_;
@@ -146,4 +148,66 @@ TEST_F(LogDistributorFixture, logPacketWorks)
   EXPECT_TRUE(distributor.isLoggingPackets());
 }
 
+TEST_F(LogDistributorFixture, isLoggingIsCached)
+{
+  EXPECT_CALL(myMockSink1, isLogging(Log::Info))
+      .WillOnce(Return(false));
+  EXPECT_CALL(myMockSink1, isLoggingPackets())
+      .WillOnce(Return(true));
+
+  distributor.registerSink(mySink1);
+
+  EXPECT_FALSE(distributor.isLogging(Log::Info));
+  EXPECT_FALSE(distributor.isLogging(Log::Info));
+  EXPECT_TRUE(distributor.isLoggingPackets());
+  EXPECT_TRUE(distributor.isLoggingPackets());
+}
+
+TEST_F(LogDistributorFixture, levelsChangedInvalidatesCache)
+{
+  EXPECT_CALL(myMockSink1, isLogging(Log::Info))
+      .WillOnce(Return(false))
+      .WillOnce(Return(true));
+
+  distributor.registerSink(mySink1);
+
+  EXPECT_FALSE(distributor.isLogging(Log::Info));
+  LogDistributor::levelsChanged();
+  EXPECT_TRUE(distributor.isLogging(Log::Info));
+}
+
+TEST_F(LogDistributorFixture, registerSinkInvalidatesCache)
+{
+  EXPECT_CALL(myMockSink1, isLogging(Log::Debug))
+      .WillRepeatedly(Return(false));
+  EXPECT_CALL(myMockSink2, isLogging(Log::Debug))
+      .WillOnce(Return(true));
+
+  distributor.registerSink(mySink1);
+  EXPECT_FALSE(distributor.isLogging(Log::Debug));
+
+  distributor.registerSink(mySink2);
+  EXPECT_TRUE(distributor.isLogging(Log::Debug));
+
+  distributor.unregisterSink(mySink2);
+  EXPECT_FALSE(distributor.isLogging(Log::Debug));
+}
+
+TEST(LogDistributor, followsAdjustableSink)
+{
+  Licq::AdjustableLogSink::Ptr sink(new Licq::PluginLogSink());
+  LogDistributor distributor;
+  distributor.registerSink(sink);
+
+  EXPECT_FALSE(distributor.isLogging(Log::Warning));
+  sink->setLogLevel(Log::Warning, true);
+  EXPECT_TRUE(distributor.isLogging(Log::Warning));
+  sink->setAllLogLevels(false);
+  EXPECT_FALSE(distributor.isLogging(Log::Warning));
+
+  EXPECT_FALSE(distributor.isLoggingPackets());
+  sink->setLogPackets(true);
+  EXPECT_TRUE(distributor.isLoggingPackets());
+}
+
 } // namespace LicqTest
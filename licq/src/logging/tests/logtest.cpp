@@ -49,7 +49,7 @@ public:
                                   Field(&Licq::LogSink::Message::sender,
                                         "test")))));
     EXPECT_CALL(myLogSink, isLogging(GetParam()))
-        .WillOnce(Return(true));
+        .WillRepeatedly(Return(true));
   }
 
   void log(const std::string& msg)
@@ -155,6 +155,18 @@ TEST(Log, shouldNotLogIfIsLoggingReturnsFalse)
   log.packet(Licq::Log::Info, 0, 0, "foobar");
 }
 
+TEST(Log, isLoggingAsksSink)
+{
+  StrictMock<MockLogSink> logSink;
+  EXPECT_CALL(logSink, isLogging(Licq::Log::Debug))
+      .WillOnce(Return(false))
+      .WillOnce(Return(true));
+
+  Log log("test", logSink);
+  EXPECT_FALSE(log.isLogging(Licq::Log::Debug));
+  EXPECT_TRUE(log.isLogging(Licq::Log::Debug));
+}
+
 TEST(Log, packet)
 {
   const uint8_t packet[] = { 1, 2, 3, 4 };
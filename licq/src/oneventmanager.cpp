@@ -26,11 +26,12 @@
 #include <licq/thread/mutexlocker.h>
 
 #include <boost/foreach.hpp>
-#include <cstdlib> // system, atoi
+#include <cstdlib> // atoi
 #include <ctime> // time
 #include <sstream>
 
 #include "daemon.h"
+#include "spawnserver.h"
 
 using namespace LicqDaemon;
 using Licq::UserId;
@@ -444,8 +445,8 @@ void OnEventManager::performOnEvent(OnEventData::OnEventType event, const Licq::
 
   if (!param.empty())
   {
-    string fullCmd = data->command() + " " + param + " &";
-    system(fullCmd.c_str());
+    // Throttled per event type so a burst of events only plays one sound
+    gSpawnServer.spawn(data->command() + " " + param, event);
   }
 
 SkipPerformOnEvent:
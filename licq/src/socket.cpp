@@ -676,6 +676,58 @@ bool TCPSocket::send(const void* buf, size_t length)
 #endif
 }
 
+ssize_t TCPSocket::sendNonBlocking(const void* buf, size_t length)
+{
+  if (m_pSSL == NULL)
+  {
+    while (true)
+    {
+      ssize_t bytesSent = ::socket_send(myDescriptor, buf, length, MSG_DONTWAIT);
+      if (bytesSent >= 0)
+        return bytesSent;
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      myErrorType = ErrorErrno;
+      return -1;
+    }
+  }
+
+#ifdef USE_OPENSSL
+  // SSL_write can't take a per call flag so make descriptor non-blocking
+  // while writing. Partial writes let the caller keep the rest queued.
+  pthread_mutex_lock(&mutex_ssl);
+  SSL_set_mode(m_pSSL, SSL_MODE_ENABLE_PARTIAL_WRITE |
+      SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  int f = fcntl(myDescriptor, F_GETFL);
+  fcntl(myDescriptor, F_SETFL, f | O_NONBLOCK);
+  ERR_clear_error();
+  int bytesSent = SSL_write(m_pSSL, buf, length);
+  int err = SSL_get_error(m_pSSL, bytesSent);
+  fcntl(myDescriptor, F_SETFL, f & ~O_NONBLOCK);
+  pthread_mutex_unlock(&mutex_ssl);
+
+  switch (err)
+  {
+    case SSL_ERROR_NONE:
+      return bytesSent;
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      return 0;
+    case SSL_ERROR_SSL:
+      myErrorType = ErrorInternal;
+      ERR_clear_error();
+      return -1;
+    default:
+      myErrorType = ErrorErrno;
+      return -1;
+  }
+#else
+  return -1;
+#endif
+}
+
 ssize_t TCPSocket::receive(void* buf, size_t maxlength)
 {
   // If SSL not enabled for this socket, use normal receive
@@ -0,0 +1,366 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "spawnserver.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib> // system
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef HAVE_POSIX_SPAWN
+# include <spawn.h>
+#endif
+
+#ifdef __sun
+# define _PATH_BSHELL "/bin/sh"
+#else
+# include <paths.h>
+#endif
+
+#include <licq/logging/log.h>
+#include <licq/thread/mutexlocker.h>
+
+#include "gettext.h"
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+extern char** environ;
+
+using Licq::MutexLocker;
+using Licq::gLog;
+using LicqDaemon::SpawnServer;
+using std::string;
+
+// Declare global SpawnServer (internal for daemon)
+SpawnServer LicqDaemon::gSpawnServer;
+
+namespace
+{
+
+enum SendResult
+{
+  SendOk,
+  SendBusy,
+  SendFailed
+};
+
+unsigned long msecSince(const timeval& start, const timeval& now)
+{
+  long msec = (now.tv_sec - start.tv_sec) * 1000 +
+      (now.tv_usec - start.tv_usec) / 1000;
+  return (msec > 0 ? msec : 0);
+}
+
+/**
+ * Start a command from the helper process
+ *
+ * @return Process id of the new process or -1 on failure
+ */
+pid_t launchCommand(const string& command)
+{
+  const char* argv[] = { "sh", "-c", command.c_str(), NULL };
+
+#ifdef HAVE_POSIX_SPAWN
+  // Commands should get default signal handling, not what the helper uses
+  posix_spawnattr_t attr;
+  ::posix_spawnattr_init(&attr);
+  sigset_t signals;
+  ::sigemptyset(&signals);
+  ::posix_spawnattr_setsigmask(&attr, &signals);
+  ::sigaddset(&signals, SIGHUP);
+  ::sigaddset(&signals, SIGINT);
+  ::sigaddset(&signals, SIGTERM);
+  ::sigaddset(&signals, SIGPIPE);
+  ::posix_spawnattr_setsigdefault(&attr, &signals);
+  ::posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+  pid_t pid;
+  int ret = ::posix_spawn(&pid, _PATH_BSHELL, NULL, &attr,
+      const_cast<char* const*>(argv), environ);
+  ::posix_spawnattr_destroy(&attr);
+  return (ret == 0 ? pid : -1);
+#else
+  pid_t pid = ::fork();
+  if (pid == 0)
+  {
+    ::signal(SIGHUP, SIG_DFL);
+    ::signal(SIGINT, SIG_DFL);
+    ::signal(SIGTERM, SIG_DFL);
+    ::signal(SIGPIPE, SIG_DFL);
+    ::execv(_PATH_BSHELL, const_cast<char* const*>(argv));
+    ::_exit(127);
+  }
+  return pid;
+#endif
+}
+
+/**
+ * Main loop for the helper process
+ * Reads commands from the socket and starts them until the socket is closed.
+ *
+ * @param sock Socket connected to the daemon
+ */
+void runHelper(int sock)
+{
+  // Shutdown is handled by the daemon closing the socket so don't let signals
+  // meant for the daemon kill the helper
+  ::signal(SIGHUP, SIG_IGN);
+  ::signal(SIGINT, SIG_IGN);
+  ::signal(SIGTERM, SIG_IGN);
+  ::signal(SIGPIPE, SIG_IGN);
+  ::signal(SIGSEGV, SIG_DFL);
+  ::signal(SIGABRT, SIG_DFL);
+  ::signal(SIGCHLD, SIG_DFL);
+
+  // Close anything else inherited from the daemon
+  for (int fd = STDERR_FILENO + 1; fd < 256; ++fd)
+    if (fd != sock)
+      ::close(fd);
+
+  std::deque<string> pending;
+  unsigned running = 0;
+  string buffer;
+
+  while (true)
+  {
+    // Reap finished commands
+    while (running > 0 && ::waitpid(-1, NULL, WNOHANG) > 0)
+      --running;
+
+    while (running < SpawnServer::MaxRunning && !pending.empty())
+    {
+      if (launchCommand(pending.front()) > 0)
+        ++running;
+      pending.pop_front();
+    }
+
+    // Only wake up regularly if there are commands to reap
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ret = ::poll(&pfd, 1, (running > 0 ? 100 : -1));
+    if (ret < 0 && errno != EINTR)
+      break;
+    if (ret <= 0)
+      continue;
+
+    char buf[4096];
+    ssize_t len = ::read(sock, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+    buffer.append(buf, len);
+
+    // Each command is preceded by its length
+    uint32_t size;
+    while (buffer.size() >= sizeof(size))
+    {
+      memcpy(&size, buffer.data(), sizeof(size));
+      if (buffer.size() < sizeof(size) + size)
+        break;
+      if (pending.size() < SpawnServer::MaxPending)
+        pending.push_back(buffer.substr(sizeof(size), size));
+      buffer.erase(0, sizeof(size) + size);
+    }
+  }
+
+  ::_exit(0);
+}
+
+/**
+ * Send a command to the helper process
+ */
+SendResult sendToHelper(int sock, const string& command)
+{
+  uint32_t size = command.size();
+  string frame(reinterpret_cast<const char*>(&size), sizeof(size));
+  frame += command;
+
+  size_t sent = 0;
+  while (sent < frame.size())
+  {
+    ssize_t ret = ::send(sock, frame.data() + sent, frame.size() - sent,
+        MSG_NOSIGNAL);
+    if (ret >= 0)
+    {
+      sent += ret;
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      return SendFailed;
+
+    // Helper isn't keeping up, drop command rather than wait for it
+    if (sent == 0)
+      return SendBusy;
+
+    // Never leave half a command in the stream
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    if (::poll(&pfd, 1, 1000) <= 0)
+      return SendFailed;
+  }
+  return SendOk;
+}
+
+} // namespace
+
+SpawnServer::SpawnServer()
+  : mySocket(-1),
+    myHelperPid(-1)
+{
+  // Empty
+}
+
+SpawnServer::~SpawnServer()
+{
+  stop();
+}
+
+bool SpawnServer::start()
+{
+  MutexLocker lock(myMutex);
+  if (mySocket != -1)
+    return true;
+
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+  {
+    gLog.warning(tr("Unable to create socket for command helper: %s"),
+        strerror(errno));
+    return false;
+  }
+
+  // Commands started by either process shouldn't inherit the sockets
+  ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+  pid_t pid = ::fork();
+  if (pid < 0)
+  {
+    gLog.warning(tr("Unable to start command helper: %s"), strerror(errno));
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return false;
+  }
+
+  if (pid == 0)
+  {
+    ::close(fds[0]);
+    runHelper(fds[1]);
+  }
+
+  ::close(fds[1]);
+  ::fcntl(fds[0], F_SETFL, ::fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  mySocket = fds[0];
+  myHelperPid = pid;
+  return true;
+}
+
+void SpawnServer::stop()
+{
+  MutexLocker lock(myMutex);
+  if (mySocket == -1)
+    return;
+
+  // Helper exits when the socket is closed
+  ::close(mySocket);
+  mySocket = -1;
+  ::waitpid(myHelperPid, NULL, 0);
+  myHelperPid = -1;
+}
+
+bool SpawnServer::spawn(const string& command, int group)
+{
+  if (command.empty())
+    return false;
+
+  MutexLocker lock(myMutex);
+  if (group >= 0 && !allowLaunch(command, group))
+    return false;
+
+  if (mySocket != -1 && command.size() <= MaxCommandSize)
+  {
+    switch (sendToHelper(mySocket, command))
+    {
+      case SendOk:
+        return true;
+
+      case SendBusy:
+        gLog.warning(tr("Command helper is busy, skipping command: %s"),
+            command.c_str());
+        return false;
+
+      case SendFailed:
+        gLog.warning(tr("Command helper has stopped, "
+            "commands will be started directly"));
+        ::close(mySocket);
+        mySocket = -1;
+        ::waitpid(myHelperPid, NULL, WNOHANG);
+        myHelperPid = -1;
+        break;
+    }
+  }
+  lock.unlock();
+
+  // No helper available, start command from here
+  string fullCmd = command + " &";
+  return (::system(fullCmd.c_str()) != -1);
+}
+
+bool SpawnServer::allowLaunch(const string& command, int group)
+{
+  timeval now;
+  ::gettimeofday(&now, NULL);
+
+  GroupState& state(myGroups[group]);
+
+  // Forget launches outside the rate limit period
+  while (!state.launches.empty() &&
+      msecSince(state.launches.front(), now) >= RateLimitPeriod)
+    state.launches.pop_front();
+
+  // Coalesce bursts of the same command (e.g. one sound per burst)
+  if (!state.launches.empty() && state.lastCommand == command &&
+      msecSince(state.launches.back(), now) < CoalesceTime)
+    return false;
+
+  if (state.launches.size() >= RateLimitCount)
+    return false;
+
+  state.launches.push_back(now);
+  state.lastCommand = command;
+  return true;
+}
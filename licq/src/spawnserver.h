@@ -0,0 +1,121 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef LICQDAEMON_SPAWNSERVER_H
+#define LICQDAEMON_SPAWNSERVER_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <licq/thread/mutex.h>
+
+namespace LicqDaemon
+{
+
+/**
+ * Launcher for external commands such as on event sounds
+ *
+ * A small helper process is forked at startup, before plugins are loaded, so
+ * the daemon itself never needs to fork once it has grown large. Commands are
+ * passed to the helper over a socket and started with posix_spawn(). The
+ * helper limits how many commands may run at the same time.
+ *
+ * Requests are also throttled per group (e.g. on event type) before being
+ * sent to the helper. An identical command within a short time is coalesced
+ * and each group has a maximum number of launches per time period.
+ */
+class SpawnServer
+{
+public:
+  /// Maximum number of commands running at the same time
+  static const unsigned MaxRunning = 8;
+
+  /// Maximum number of commands waiting for a free slot in the helper
+  static const unsigned MaxPending = 32;
+
+  /// Maximum length of a command
+  static const size_t MaxCommandSize = 4096;
+
+  /// Identical commands within this time (ms) are only started once
+  static const unsigned CoalesceTime = 1000;
+
+  /// Maximum number of commands per group and rate limit period
+  static const unsigned RateLimitCount = 5;
+
+  /// Rate limit period (ms)
+  static const unsigned RateLimitPeriod = 10000;
+
+  SpawnServer();
+  ~SpawnServer();
+
+  /**
+   * Start helper process
+   * Should be called as early as possible while the process is still small
+   * and has no other threads.
+   *
+   * @return True if helper was started
+   */
+  bool start();
+
+  /**
+   * Stop helper process
+   * Commands already started are left running.
+   */
+  void stop();
+
+  /**
+   * Start a shell command in the background
+   * Never waits for the command to finish. If the helper isn't running,
+   * the command is started with system() instead.
+   *
+   * @param command Command line to pass to the shell
+   * @param group Group to use for throttling or negative to not throttle
+   * @return True if command was started, false if it was dropped
+   */
+  bool spawn(const std::string& command, int group = -1);
+
+private:
+  struct GroupState
+  {
+    std::string lastCommand;
+    std::deque<timeval> launches;
+  };
+
+  /**
+   * Check and update throttling for a group
+   * Caller must hold myMutex
+   *
+   * @return True if command may be started
+   */
+  bool allowLaunch(const std::string& command, int group);
+
+  Licq::Mutex myMutex;
+  int mySocket;
+  pid_t myHelperPid;
+  std::map<int, GroupState> myGroups;
+};
+
+extern SpawnServer gSpawnServer;
+
+} // namespace LicqDaemon
+
+#endif
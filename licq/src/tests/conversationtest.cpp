@@ -113,4 +113,58 @@ TEST(ConvoManager, convoList)
   gConvoManager.remove(convoId2);
 }
 
+TEST(ConvoManager, userIndex)
+{
+  UserId ownerId(0x54657374, "owner");
+  UserId user1(ownerId, "uno");
+  UserId user2(ownerId, "second");
+  const Licq::Conversation* const nullConvo = NULL;
+
+  Licq::Conversation* convo1 = gConvoManager.add(ownerId, 5);
+  Licq::Conversation* convo2 = gConvoManager.add(ownerId, 8);
+  EXPECT_EQ(nullConvo, gConvoManager.getFromUser(user1));
+
+  // Oldest conversation with a user should be returned
+  EXPECT_TRUE(convo2->addUser(user1));
+  EXPECT_TRUE(convo1->addUser(user1));
+  EXPECT_TRUE(convo2->addUser(user2));
+  EXPECT_EQ(convo1, gConvoManager.getFromUser(user1));
+  EXPECT_EQ(convo2, gConvoManager.getFromUser(user2));
+
+  // Failed add or remove must not change index
+  EXPECT_FALSE(convo1->addUser(user1));
+  EXPECT_FALSE(convo1->removeUser(user2));
+  EXPECT_EQ(convo1, gConvoManager.getFromUser(user1));
+  EXPECT_EQ(convo2, gConvoManager.getFromUser(user2));
+
+  EXPECT_TRUE(convo1->removeUser(user1));
+  EXPECT_EQ(convo2, gConvoManager.getFromUser(user1));
+
+  // Removing conversation should drop it from the index
+  EXPECT_TRUE(gConvoManager.remove(convo2->id()));
+  EXPECT_EQ(nullConvo, gConvoManager.getFromUser(user1));
+  EXPECT_EQ(nullConvo, gConvoManager.getFromUser(user2));
+  EXPECT_EQ(nullConvo, gConvoManager.getFromSocket(8));
+
+  // Cleanup
+  gConvoManager.remove(convo1->id());
+}
+
+TEST(ConvoManager, sharedSocket)
+{
+  UserId ownerId(0x54657374, "owner");
+  const Licq::Conversation* const nullConvo = NULL;
+
+  Licq::Conversation* convo1 = gConvoManager.add(ownerId, 5);
+  Licq::Conversation* convo2 = gConvoManager.add(ownerId, 5);
+  int convoId1 = convo1->id();
+  int convoId2 = convo2->id();
+
+  EXPECT_EQ(convo1, gConvoManager.getFromSocket(5));
+  EXPECT_TRUE(gConvoManager.remove(convoId1));
+  EXPECT_EQ(convo2, gConvoManager.getFromSocket(5));
+  EXPECT_TRUE(gConvoManager.remove(convoId2));
+  EXPECT_EQ(nullConvo, gConvoManager.getFromSocket(5));
+}
+
 } // namespace LicqTest
@@ -28,6 +28,7 @@ class LogDummy : public Licq::Log
 {
 public:
   // Licq::Log
+  bool isLogging(Level /*level*/) { return false; }
   void log(Level /*level*/, const std::string& /*msg*/) {}
   void packet(Level /*level*/, const uint8_t* /*data*/, size_t /*size*/,
               const std::string& /*msg*/) {}
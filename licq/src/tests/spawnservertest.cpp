@@ -0,0 +1,122 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "../spawnserver.h"
+
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+using LicqDaemon::SpawnServer;
+using std::string;
+
+namespace LicqTest {
+
+class SpawnServerFixture : public ::testing::Test
+{
+public:
+  SpawnServer myServer;
+  string myFile;
+
+  SpawnServerFixture() :
+    myFile("/tmp/testspawnserver.out")
+  {
+    ::unlink(myFile.c_str());
+  }
+
+  ~SpawnServerFixture()
+  {
+    myServer.stop();
+    ::unlink(myFile.c_str());
+  }
+
+  bool waitForFile()
+  {
+    // Commands run in the background so give them some time
+    for (int i = 0; i < 200; ++i)
+    {
+      if (::access(myFile.c_str(), F_OK) == 0)
+        return true;
+      ::usleep(10*1000);
+    }
+    return false;
+  }
+};
+
+TEST_F(SpawnServerFixture, helperStartsCommand)
+{
+  ASSERT_TRUE(myServer.start());
+  EXPECT_TRUE(myServer.spawn("touch " + myFile));
+  EXPECT_TRUE(waitForFile());
+}
+
+TEST_F(SpawnServerFixture, startsCommandWithoutHelper)
+{
+  EXPECT_TRUE(myServer.spawn("touch " + myFile));
+  EXPECT_TRUE(waitForFile());
+}
+
+TEST_F(SpawnServerFixture, emptyCommandIsIgnored)
+{
+  EXPECT_FALSE(myServer.spawn(""));
+}
+
+TEST_F(SpawnServerFixture, burstIsCoalesced)
+{
+  ASSERT_TRUE(myServer.start());
+  EXPECT_TRUE(myServer.spawn("true", 1));
+  EXPECT_FALSE(myServer.spawn("true", 1));
+
+  // Other groups and ungrouped commands are not affected
+  EXPECT_TRUE(myServer.spawn("true", 2));
+  EXPECT_TRUE(myServer.spawn("true"));
+  EXPECT_TRUE(myServer.spawn("true"));
+}
+
+TEST_F(SpawnServerFixture, groupIsRateLimited)
+{
+  ASSERT_TRUE(myServer.start());
+  char command[32];
+  unsigned started = 0;
+  for (int i = 0; i < 10; ++i)
+  {
+    snprintf(command, sizeof(command), "true %i", i);
+    if (myServer.spawn(command, 1))
+      ++started;
+  }
+  EXPECT_EQ(5u, started);
+
+  // Rate limit is per group
+  EXPECT_TRUE(myServer.spawn("true", 2));
+}
+
+TEST_F(SpawnServerFixture, stopAndRestart)
+{
+  ASSERT_TRUE(myServer.start());
+  EXPECT_TRUE(myServer.start());
+  myServer.stop();
+  myServer.stop();
+  ASSERT_TRUE(myServer.start());
+  EXPECT_TRUE(myServer.spawn("touch " + myFile));
+  EXPECT_TRUE(waitForFile());
+}
+
+} // namespace LicqTest
@@ -21,6 +21,7 @@
 
 #include <licq/userevents.h>
 
+#include <cstdio>
 #include <cstdlib>
 #include <sstream>
 
@@ -136,14 +137,18 @@ UserEvent::~UserEvent()
 //-----NToNS--------------------------------------------------------------------
 string addStrWithColons(const string& oldStr)
 {
-  string str = ":";
-  str += oldStr;
-  size_t pos = 0;
-  while ((pos = str.find('\n', pos)) < str.size())
+  // Build result in one pass instead of inserting into the middle of it
+  string str;
+  str.reserve(oldStr.size() + oldStr.size() / 32 + 2);
+  str += ':';
+  size_t start = 0, pos;
+  while ((pos = oldStr.find('\n', start)) != string::npos)
   {
-    str.insert(pos+1, ":");
-    pos += 2;
+    str.append(oldStr, start, pos + 1 - start);
+    str += ':';
+    start = pos + 1;
   }
+  str.append(oldStr, start, string::npos);
   return str;
 }
 
@@ -174,23 +179,16 @@ string UserEvent::historyHeader(bool isReceiver) const
     m_nCommand = CommandRcvOnline;
 
   // Format: "[ x | 1234 | 1234 | 1234 | 123456789 ]\n"
-  stringstream buf;
-  buf << "[ " << (isReceiver ? 'R' : 'S') << " | ";
-  buf.fill('0');
-  buf.width(4);
-  buf << (myEventType != TypeUnknownSys ? myEventType :
-      (dynamic_cast<const EventUnknownSysMsg*>(this))->subCommand());
-  buf << " | ";
-  buf.width(4);
-  buf << m_nCommand;
-  buf << " | ";
-  buf.width(4);
-  buf << (((unsigned short)((m_nFlags | FlagUnicode) >> 16)) & 0x809F);
-  buf << " | ";
-  buf.width(1);
-  buf << (unsigned long)m_tTime << " ]\n";
-
-  return buf.str();
+  char buf[64];
+  int len = snprintf(buf, sizeof(buf), "[ %c | %04u | %04u | %04u | %lu ]\n",
+      (isReceiver ? 'R' : 'S'),
+      static_cast<unsigned>(myEventType != TypeUnknownSys ? myEventType :
+          (dynamic_cast<const EventUnknownSysMsg*>(this))->subCommand()),
+      static_cast<unsigned>(m_nCommand),
+      static_cast<unsigned>(((unsigned short)((m_nFlags | FlagUnicode) >> 16)) & 0x809F),
+      (unsigned long)m_tTime);
+
+  return string(buf, len);
 }
 
 
@@ -18,6 +18,7 @@
  */
 
 #include "msn.h"
+#include "msn_constants.h"
 #include "msnpacket.h"
 #include <licq/logging/log.h>
 
@@ -58,13 +59,13 @@ void CMSN::ProcessSBPacket(const Licq::UserId& socketUserId, CMSNBuffer* packet,
   CMSNPacket *pReply;
   bool bSkipPacket;
 
-  //while (!packet->End())
-  {
-    pReply = 0;
-    bSkipPacket = true;
-    string strCmd = packet->unpackRawString(3);
+  pReply = 0;
+  bSkipPacket = true;
+  string strCmd = packet->unpackRawString(3);
 
-    if (strCmd == "IRO")
+  switch (commandCode(strCmd))
+  {
+    case MSN_COMMAND('I', 'R', 'O'):
     {
       packet->SkipParameter(); // Seq
       packet->SkipParameter(); // current user to add
@@ -100,13 +101,15 @@ void CMSN::ProcessSBPacket(const Licq::UserId& socketUserId, CMSNBuffer* packet,
           Licq::PluginSignal::ConvoJoin, userId, 0, SocketToCID(nSock)));
 
       gLog.info("%s joined the conversation", userId.toString().c_str());
+      break;
     }
-    else if (strCmd == "ANS")
+    case MSN_COMMAND('A', 'N', 'S'):
     {
       // Send our capabilities
       Send_SB_Packet(Licq::UserId(), new CPS_MsnClientCaps(), sock);
+      break;
     }
-    else if (strCmd == "MSG")
+    case MSN_COMMAND('M', 'S', 'G'):
     {
       Licq::UserId userId(myOwnerId, packet->GetParameter());
       packet->SkipParameter(); // Nick
@@ -211,8 +214,9 @@ void CMSN::ProcessSBPacket(const Licq::UserId& socketUserId, CMSNBuffer* packet,
         gLog.info("Message from %s with unknown content type (%s)",
             userId.accountId().c_str(), strType.c_str());
       }
+      break;
     }
-    else if (strCmd == "ACK")
+    case MSN_COMMAND('A', 'C', 'K'):
     {
       string strId = packet->GetParameter();
       unsigned long nSeq = (unsigned long)atoi(strId.c_str());
@@ -258,8 +262,9 @@ void CMSN::ProcessSBPacket(const Licq::UserId& socketUserId, CMSNBuffer* packet,
 	// P2P response
 	//packet->SkipRN();
       }
+      break;
     }
-    else if (strCmd == "USR")
+    case MSN_COMMAND('U', 'S', 'R'):
     {
       SStartMessage *pStart = 0;
       StartList::iterator it;
@@ -277,8 +282,9 @@ void CMSN::ProcessSBPacket(const Licq::UserId& socketUserId, CMSNBuffer* packet,
         pReply = new CPS_MSNCall(pStart->userId.accountId());
 	pStart->m_nSeq = pReply->Sequence();
       }
+      break;
     }
-    else if (strCmd == "JOI")
+    case MSN_COMMAND('J', 'O', 'I'):
     {
       UserId userId(myOwnerId, packet->GetParameter());
       gLog.info("%s joined the conversation", userId.toString().c_str());
@@ -320,14 +326,15 @@ void CMSN::ProcessSBPacket(const Licq::UserId& socketUserId, CMSNBuffer* packet,
       if (pStart)
       {
         if (pStart->m_pEvent)
-          m_pEvents.push_back(pStart->m_pEvent);
+          addEvent(pStart->m_pEvent);
 
         Send_SB_Packet(pStart->userId, pStart->m_pPacket, sock, false);
 
         delete pStart;
       }
+      break;
     }
-    else if (strCmd == "BYE")
+    case MSN_COMMAND('B', 'Y', 'E'):
     {
       // closed the window and connection
       UserId userId(myOwnerId, packet->GetParameter());
@@ -353,8 +360,9 @@ void CMSN::ProcessSBPacket(const Licq::UserId& socketUserId, CMSNBuffer* packet,
         if (convo != NULL)
           gConvoManager.remove(convo->id());
       }
+      break;
     }
-    else if (strCmd == "217")
+    case MSN_COMMAND('2', '1', '7'):
     {
       unsigned long nSeq = packet->GetParameterUnsignedLong();
 
@@ -374,19 +382,21 @@ void CMSN::ProcessSBPacket(const Licq::UserId& socketUserId, CMSNBuffer* packet,
           break; 
         }
       }
+      break;
     }
-    else
+    default:
     {
       gLog.warning("Unhandled command (%s)", strCmd.c_str());
+      break;
     }
-  
-    // Get the next packet
-    if (bSkipPacket)
-      packet->SkipPacket();
-    
-    if (pReply)
-      Send_SB_Packet(socketUserId, pReply, sock);
   }
+
+  // Get the next packet
+  if (bSkipPacket)
+    packet->SkipPacket();
+
+  if (pReply)
+    Send_SB_Packet(socketUserId, pReply, sock);
   
   //delete packet;
 }
@@ -582,7 +592,7 @@ void CMSN::MSNSendMessage(unsigned long eventId, const UserId& userId, const str
 
   if (nSocket > 0)
   {
-    m_pEvents.push_back(e);
+    addEvent(e);
 
     Licq::TCPSocket* sock = dynamic_cast<Licq::TCPSocket*>(myMainLoop.getSocketFromFd(nSocket));
 
@@ -18,6 +18,7 @@
  */
 
 #include "msn.h"
+#include "msn_constants.h"
 #include "msnpacket.h"
 #include <licq/logging/log.h>
 
@@ -55,22 +56,24 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
 {
   CMSNPacket *pReply;
   
-//while (!m_pPacketBuf->End())
-  {
-    pReply = 0;
-    string strCmd = packet->unpackRawString(3);
+  pReply = 0;
+  string strCmd = packet->unpackRawString(3);
 
-    if (strCmd == "VER")
+  switch (commandCode(strCmd))
+  {
+    case MSN_COMMAND('V', 'E', 'R'):
     {
       // Don't really care about this packet's data.
       pReply = new CPS_MSNClientVersion(myOwnerId.accountId());
+      break;
     }
-    else if (strCmd == "CVR")
+    case MSN_COMMAND('C', 'V', 'R'):
     {
       // Don't really care about this packet's data.
       pReply = new CPS_MSNUser(myOwnerId.accountId());
+      break;
     }
-    else if (strCmd == "XFR")
+    case MSN_COMMAND('X', 'F', 'R'):
     {
       //Time to transfer to a new server
       packet->SkipParameter(); // Seq
@@ -98,11 +101,12 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
         closeSocket(myServerSocket, false);
         myServerSocket = NULL;
 
-        // Make the new connection
-        Logon(myOwnerId, myStatus, host.c_str(), port);
+        // Connect to the new server without blocking the main loop
+        connectToServer(host, port);
       }
+      break;
     }
-    else if (strCmd == "USR")
+    case MSN_COMMAND('U', 'S', 'R'):
     {
       packet->SkipParameter(); // Seq
       string strType = packet->GetParameter();
@@ -113,6 +117,7 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
         string strNick = packet->GetParameter();
         string strDecodedNick = Decode(strNick);
         gLog.info("%s logged in", strDecodedNick.c_str());
+        myReconnectAttempts = 0;
        
         // Set our alias here
         unsigned long listVersion;
@@ -135,15 +140,17 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
         // Make an SSL connection to authenticate
         MSNAuthenticate();
       }
+      break;
     }
-    else if (strCmd == "CHL")
+    case MSN_COMMAND('C', 'H', 'L'):
     {
       packet->SkipParameter(); // Seq
       string strHash = packet->GetParameter();
       
       pReply = new CPS_MSNChallenge(strHash);
+      break;
     }
-    else if (strCmd == "SYN")
+    case MSN_COMMAND('S', 'Y', 'N'):
     {
       packet->SkipParameter();
       string strVersion = packet->GetParameter();
@@ -162,8 +169,9 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
       //  pReply = new CPS_MSNAddUser(user->accountId());
       //  SendPacket(pReply);
       //}
+      break;
     }
-    else if (strCmd == "LST")
+    case MSN_COMMAND('L', 'S', 'T'):
     {
       // Add user
       string strUser = packet->GetParameter();
@@ -207,12 +215,14 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
             Licq::PluginSignal::SignalUser,
             Licq::PluginSignal::UserInfo, u->id()));
       }
+      break;
     }
-    else if (strCmd == "LSG")
+    case MSN_COMMAND('L', 'S', 'G'):
     {
       // Add group
+      break;
     }
-    else if (strCmd == "ADD")
+    case MSN_COMMAND('A', 'D', 'D'):
     {
       packet->SkipParameter(); // What's this?
       string strList = packet->GetParameter();
@@ -258,8 +268,9 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
               Licq::PluginSignal::UserBasic, u->id()));
         }
       }
+      break;
     }
-    else if (strCmd == "REM")
+    case MSN_COMMAND('R', 'E', 'M'):
     {      
       packet->SkipParameter(); // seq
       packet->SkipParameter(); // list
@@ -273,8 +284,9 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
       }
 
       gLog.info("Removed %s from contact list", strUser.c_str()); 
+      break;
     }
-    else if (strCmd == "REA")
+    case MSN_COMMAND('R', 'E', 'A'):
     {
       packet->SkipParameter(); // seq
       string strVersion = packet->GetParameter();
@@ -295,8 +307,9 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
       }
       
       gLog.info("%s renamed successfully", strUser.c_str());
+      break;
     }
-    else if (strCmd == "CHG")
+    case MSN_COMMAND('C', 'H', 'G'):
     {
       packet->SkipParameter(); // seq
       string strStatus = packet->GetParameter();
@@ -320,8 +333,10 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
       Licq::OwnerWriteGuard o(myOwnerId);
       if (o.isLocked())
         o->statusChanged(status);
+      break;
     }
-    else if (strCmd == "ILN" || strCmd == "NLN")
+    case MSN_COMMAND('I', 'L', 'N'):
+    case MSN_COMMAND('N', 'L', 'N'):
     {
       if (strCmd == "ILN")
         packet->SkipParameter(); // seq
@@ -368,8 +383,9 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
         gLog.info("%s changed status (%s)", u->getAlias().c_str(), strStatus.c_str());
         u->statusChanged(status);
       }
+      break;
     }
-    else if (strCmd == "FLN")
+    case MSN_COMMAND('F', 'L', 'N'):
     {
       UserId userId(myOwnerId, packet->GetParameter());
 
@@ -394,8 +410,9 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
           break;
         }
       }
+      break;
     }
-    else if (strCmd == "RNG")
+    case MSN_COMMAND('R', 'N', 'G'):
     {
       string strSessionID = packet->GetParameter();
       string strServer = packet->GetParameter();
@@ -404,8 +421,9 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
       Licq::UserId userId(myOwnerId, packet->GetParameter());
 
       MSNSBConnectAnswer(strServer, strSessionID, strCookie, userId);
+      break;
     }
-    else if (strCmd == "MSG")
+    case MSN_COMMAND('M', 'S', 'G'):
     {
       packet->SkipParameter(); // 'Hotmail'
       packet->SkipParameter(); // 'Hotmail' again
@@ -462,12 +480,14 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
           gOnEventManager.performOnEvent(OnEventData::OnEventSysMsg, *o);
         }
       }
+      break;
     }
-    else if (strCmd == "QNG")
+    case MSN_COMMAND('Q', 'N', 'G'):
     {
       m_bWaitingPingReply = false;
+      break;
     }
-    else if (strCmd == "913")
+    case MSN_COMMAND('9', '1', '3'):
     {
       unsigned long nSeq = packet->GetParameterUnsignedLong();
 
@@ -487,35 +507,42 @@ void CMSN::ProcessServerPacket(CMSNBuffer *packet)
           break; 
         }
       }
+      break;
     }
-    else if (strCmd == "GTC")
+    case MSN_COMMAND('G', 'T', 'C'):
     {
+      break;
     }
-    else if (strCmd == "BLP")
+    case MSN_COMMAND('B', 'L', 'P'):
     {
+      break;
     }
-    else if (strCmd == "PRP")
+    case MSN_COMMAND('P', 'R', 'P'):
     {
-    }    
-    else if (strCmd == "QRY")
+      break;
+    }
+    case MSN_COMMAND('Q', 'R', 'Y'):
     {
       m_bCanPing = true;
+      break;
     }
-    else if (strCmd == "NOT")
+    case MSN_COMMAND('N', 'O', 'T'):
     {
       // For the moment, skip the notification... consider it spam from MSN
       unsigned long nSize = packet->GetParameterUnsignedLong(); // size
       packet->SkipRN(); // Skip \r\n
       packet->Skip(nSize);
+      break;
     }
-    else
+    default:
     {
       gLog.warning("Unhandled command (%s)", strCmd.c_str());
+      break;
     }
-    
-    if (pReply)
-      SendPacket(pReply);
   }
+
+  if (pReply)
+    SendPacket(pReply);
 }
 
 void CMSN::SendPacket(CMSNPacket *p)
@@ -542,16 +569,9 @@ void CMSN::Logon(const Licq::UserId& ownerId, unsigned status, string host, int
       return;
     }
     myPassword = o->password();
-    if (host.empty())
-      host = o->serverHost();
-    if (port == 0)
-      port = o->serverPort();
   }
 
-  if (host.empty())
-    host = defaultServerHost();
-  if (port <= 0)
-    port = defaultServerPort();
+  getServerAddress(host, port);
 
   myServerSocket = new Licq::TCPSocket(myOwnerId);
   gLog.info("Server found at %s:%d", host.c_str(), port);
@@ -571,6 +591,25 @@ void CMSN::Logon(const Licq::UserId& ownerId, unsigned status, string host, int
   myStatus = status;
 }
 
+void CMSN::getServerAddress(string& host, int& port)
+{
+  {
+    Licq::OwnerReadGuard o(myOwnerId);
+    if (o.isLocked())
+    {
+      if (host.empty())
+        host = o->serverHost();
+      if (port == 0)
+        port = o->serverPort();
+    }
+  }
+
+  if (host.empty())
+    host = defaultServerHost();
+  if (port <= 0)
+    port = defaultServerPort();
+}
+
 void CMSN::MSNChangeStatus(unsigned status)
 {
   string msnStatus;
@@ -602,6 +641,8 @@ void CMSN::MSNChangeStatus(unsigned status)
 
 void CMSN::MSNLogoff(bool bDisconnected)
 {
+  cancelReconnect();
+
   if (myServerSocket == NULL)
     return;
 
@@ -19,8 +19,10 @@
 
 #include <cctype>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <list>
+#include <pthread.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <string>
@@ -72,8 +74,12 @@ char *strndup(const char *s, size_t n)
 CMSN::CMSN()
   : myServerSocket(NULL),
     mySslSocket(NULL),
-    m_vlPacketBucket(211),
-    myNextTimeoutId(1)
+    myNextTimeoutId(1),
+    myReconnectPending(false),
+    myReconnectThreadRunning(false),
+    myReconnectAttempts(0),
+    myReconnectSocket(NULL),
+    myRedirectQueued(false)
 {
   m_bWaitingPingReply = m_bCanPing = false;
   m_pPacketBuf = 0;
@@ -100,205 +106,100 @@ int CMSN::defaultServerPort() const
   return 1863;
 }
 
-void CMSN::StorePacket(SBuffer *_pBuf, int _nSock)
+void CMSN::addEvent(Licq::Event* e)
 {
-  if (_pBuf->m_bStored == false)
-  {
-    BufferList &b = m_vlPacketBucket[HashValue(_nSock)];
-    b.push_front(_pBuf);
-  }
-}
-
-void CMSN::RemovePacket(const Licq::UserId& userId, int _nSock, int nSize)
-{
-  BufferList &b = m_vlPacketBucket[HashValue(_nSock)];
-  BufferList::iterator it;
-  SBuffer *pNewBuf = 0;
-  int nNewSize = 0;
-
-  for (it = b.begin(); it != b.end(); it++)
+  // Sequence numbers wrap at 9999, an event still waiting for its ack then
+  // will never get one so fail it instead of losing it
+  EventMap::iterator it = m_pEvents.find(e->Sequence());
+  if (it != m_pEvents.end() && it->second != e)
   {
-    if ((*it)->myUserId == userId)
-    {
-      // Found a packet that has part of another packet at the end
-      // so we have to save it and put it back on the queue.
-      if (nSize)
-      {
-	nNewSize = (*it)->m_pBuf->getDataSize() - nSize;
-	if (nNewSize)
-	{
-	  pNewBuf = new SBuffer;
-	  pNewBuf->myUserId = userId;
-	  pNewBuf->m_pBuf = new CMSNBuffer(nNewSize);
-	  pNewBuf->m_pBuf->packRaw((*it)->m_pBuf->getDataStart()+nSize, nNewSize);
-	  pNewBuf->m_bStored = true;
-	}			   
-      }
-      
-      b.erase(it);
-      break;
-    }
+    gLog.warning("Sequence %hu reused, failing unacknowledged event",
+        e->Sequence());
+    it->second->m_eResult = Licq::Event::ResultFailed;
+    Licq::gPluginManager.pushPluginEvent(it->second);
   }
 
-  // Now add it here
-  if (pNewBuf)
-    b.push_front(pNewBuf);
+  m_pEvents[e->Sequence()] = e;
 }
 
-SBuffer *CMSN::RetrievePacket(const Licq::UserId& userId, int _nSock)
-{
-  BufferList &b = m_vlPacketBucket[HashValue(_nSock)];
-  BufferList::iterator it;
-  for (it = b.begin(); it != b.end(); it++)
-  {
-    if ((*it)->myUserId == userId)
-      return *it;
-  }
-
-  return 0;
-}
-  
 Licq::Event *CMSN::RetrieveEvent(unsigned long _nTag)
 {
-  Licq::Event *e = 0;
+  EventMap::iterator it = m_pEvents.find(_nTag);
+  if (it == m_pEvents.end())
+    return NULL;
 
-  list<Licq::Event*>::iterator it;
-  for (it = m_pEvents.begin(); it != m_pEvents.end(); it++)
-  {
-    if ((*it)->Sequence() == _nTag)
-    {
-      e = *it;
-      m_pEvents.erase(it);
-      break;
-    }
-  }
-  
+  Licq::Event* e = it->second;
+  m_pEvents.erase(it);
   return e;
 }
 
-void CMSN::HandlePacket(Licq::TCPSocket* sock, CMSNBuffer& packet, const Licq::UserId& userId)
+/**
+ * Get size of the next complete command in a stream
+ *
+ * @param data Received data
+ * @param pos Start of command in data
+ * @return Size of command including any payload or zero if incomplete
+ */
+static size_t commandSize(const string& data, size_t pos)
 {
-  int _nSocket = sock->Descriptor();
-  SBuffer* pBuf = RetrievePacket(userId, _nSocket);
-  bool bProcess = false;
-
-  if (pBuf)
-    *(pBuf->m_pBuf) += packet;
+  size_t lineEnd = data.find("\r\n", pos);
+  if (lineEnd == string::npos)
+    return 0;
+  size_t size = lineEnd + 2 - pos;
+
+  // MSG and NOT have a payload, its size is the last parameter
+  int sizeParam;
+  if (data.compare(pos, 3, "MSG") == 0)
+    sizeParam = 3;
+  else if (data.compare(pos, 3, "NOT") == 0)
+    sizeParam = 1;
   else
+    return size;
+
+  size_t paramStart = pos;
+  for (int i = 0; i < sizeParam && paramStart < lineEnd; ++i)
   {
-    pBuf = new SBuffer;
-    pBuf->m_pBuf = new CMSNBuffer(packet);
-    pBuf->myUserId = userId;
-    pBuf->m_bStored = false;
+    paramStart = data.find_first_of(' ', paramStart);
+    if (paramStart == string::npos || paramStart > lineEnd)
+      return size;
+    paramStart = data.find_first_not_of(' ', paramStart);
   }
+  size += strtoul(data.c_str() + paramStart, NULL, 10);
 
-  do
-  {
-    char *szNeedle;
-    CMSNBuffer *pPart = 0;
-    unsigned long nFullSize = 0;
-    bProcess = false;
+  return (data.size() - pos >= size ? size : 0);
+}
 
-    if ((szNeedle = strstr((char *)pBuf->m_pBuf->getDataStart(),
-                           "\r\n")))
-    {
-      bool isMSG = (memcmp(pBuf->m_pBuf->getDataStart(), "MSG", 3) == 0);
+void CMSN::HandlePacket(Licq::TCPSocket* sock, CMSNBuffer& packet, const Licq::UserId& userId)
+{
+  int sd = sock->Descriptor();
 
-      if (/*memcmp(pBuf->m_pBuf->getDataStart(), "MSG", 3) == 0*/ isMSG ||
-          memcmp(pBuf->m_pBuf->getDataStart(), "NOT", 3) == 0)
-      {
-        pBuf->m_pBuf->SkipParameter(); // MSG, NOT
-        if (isMSG)
-        {
-          pBuf->m_pBuf->SkipParameter(); // Hotmail
-          pBuf->m_pBuf->SkipParameter(); // Hotmail
-        }
-        string strSize = pBuf->m_pBuf->GetParameter();
-        int nSize = atoi(strSize.c_str());
-
-        // Cut the packet instead of passing it all along
-        // we might receive 1 full packet and part of another.
-        if (nSize <= (pBuf->m_pBuf->getDataPosWrite() - pBuf->m_pBuf->getDataPosRead()))
-        {
-          nFullSize = nSize + pBuf->m_pBuf->getDataPosRead() - pBuf->m_pBuf->getDataStart() + 1;
-          if (pBuf->m_pBuf->getDataSize() > nFullSize)
-          {
-            // Hack to save the part and delete the rest
-            if (pBuf->m_bStored == false)
-            {
-              StorePacket(pBuf, _nSocket);
-              pBuf->m_bStored = true;
-            }
-
-            // We have a packet, with part of another one at the end
-            pPart = new CMSNBuffer(nFullSize);
-            pPart->packRaw(pBuf->m_pBuf->getDataStart(), nFullSize);
-          }
-          bProcess = true;
-        }
-      }
-      else //if(memcmp(pBuf->m_pBuf->getDataStart(), "ACK", 3) == 0)
-      {
-        int nSize = szNeedle - pBuf->m_pBuf->getDataStart() +2;
-
-        // Cut the packet instead of passing it all along
-        // we might receive 1 full packet and part of another.
-        if (nSize <= (pBuf->m_pBuf->getDataPosWrite() - pBuf->m_pBuf->getDataPosRead()))
-        {
-          nFullSize = nSize + pBuf->m_pBuf->getDataPosRead() - pBuf->m_pBuf->getDataStart();
-
-          if (pBuf->m_pBuf->getDataSize() > nFullSize)
-          {
-            // Hack to save the part and delete the rest
-            if (pBuf->m_bStored == false)
-            {
-              StorePacket(pBuf, _nSocket);
-              pBuf->m_bStored = true;
-            }
-
-            // We have a packet, with part of another one at the end
-            pPart = new CMSNBuffer(nFullSize);
-            pPart->packRaw(pBuf->m_pBuf->getDataStart(), nFullSize);
-          }
-          bProcess = true;
-        }
-      }
+  // Take pending data out of the map while processing, the entry is left as
+  // a marker so we can tell if the socket gets closed by a command
+  string data;
+  data.swap(myPendingData[sd]);
+  data.append(packet.getDataStart(), packet.getDataSize());
 
-      if (!bProcess)
-      {
-        // Save it
-        StorePacket(pBuf, _nSocket);
-        pBuf->m_bStored = true;
-      }
+  size_t pos = 0;
+  size_t size;
+  while ((size = commandSize(data, pos)) > 0)
+  {
+    CMSNBuffer command(size);
+    command.packRaw(data.data() + pos, size);
+    pos += size;
 
-      pBuf->m_pBuf->Reset();
-    }
+    if (sock == myServerSocket)
+      ProcessServerPacket(&command);
     else
-    {
-      // Need to save it, doens't have much data yet
-      StorePacket(pBuf, _nSocket);
-      pBuf->m_bStored = true;
-      bProcess = false;
-    }
+      ProcessSBPacket(userId, &command, sock);
 
-    if (bProcess)
-    {
-      // Handle it, and then remove it from the queue
-      if (sock == myServerSocket)
-        ProcessServerPacket(pPart ? pPart : pBuf->m_pBuf);
-      else
-        ProcessSBPacket(userId, pPart ? pPart : pBuf->m_pBuf, sock);
-      RemovePacket(userId, _nSocket, nFullSize);
-      if (pPart)
-        delete pPart;
-      else
-        delete pBuf;
-      pBuf = RetrievePacket(userId, _nSocket);
-    }
-    else
-      pBuf = 0;
+    // Socket closed, drop anything else received on it
+    if (myPendingData.find(sd) == myPendingData.end())
+      return;
+  }
 
-  } while (pBuf);
+  // Save incomplete command until more data arrives
+  data.erase(0, pos);
+  myPendingData[sd].swap(data);
 }
 
 string CMSN::Decode(const string &strIn)
@@ -352,15 +253,29 @@ int CMSN::run()
   myMainLoop.addTimeout(60*1000, this, 0, false);
 
   myMainLoop.addRawFile(getReadPipe(), this);
+  myMainLoop.addRawFile(myReconnectPipe.getReadFd(), this);
   myMainLoop.run();
 
   // Close out now
   MSNLogoff();
+
+  // Wait for any connect still in progress
+  if (myReconnectThreadRunning)
+  {
+    pthread_join(myReconnectThread, NULL);
+    delete myReconnectSocket;
+  }
   return 0;
 }
 
 void CMSN::rawFileEvent(int /*id*/, int fd, int /*revents*/)
 {
+  if (fd == myReconnectPipe.getReadFd())
+  {
+    reconnectDone();
+    return;
+  }
+
   char c;
   read(fd, &c, 1);
   switch (c)
@@ -380,6 +295,13 @@ void CMSN::rawFileEvent(int /*id*/, int fd, int /*revents*/)
 
 void CMSN::ProcessSignal(const Licq::ProtocolSignal* s)
 {
+  if (myServerSocket == NULL && s->signal() == Licq::ProtocolSignal::SignalLogoff)
+  {
+    // Not connected but we might be waiting to reconnect
+    cancelReconnect();
+    return;
+  }
+
   if (myServerSocket == NULL && s->signal() != Licq::ProtocolSignal::SignalLogon)
     return;
 
@@ -391,6 +313,7 @@ void CMSN::ProcessSignal(const Licq::ProtocolSignal* s)
       {
         const Licq::ProtoLogonSignal* sig =
             dynamic_cast<const Licq::ProtoLogonSignal*>(s);
+        cancelReconnect();
         Logon(sig->userId(), sig->status());
       }
       break;
@@ -504,10 +427,9 @@ void CMSN::socketEvent(int /*id*/, Licq::INetSocket* inetSocket, int /*revents*/
     {
       // Time to reconnect
       gLog.info("Disconnected from server, reconnecting");
-      sleep(1);
       closeSocket(myServerSocket, false);
       myServerSocket = NULL;
-      Logon(myOwnerId, myStatus);
+      scheduleReconnect();
     }
   }
 
@@ -534,6 +456,7 @@ void CMSN::socketEvent(int /*id*/, Licq::INetSocket* inetSocket, int /*revents*/
 
 void CMSN::closeSocket(Licq::TCPSocket* sock, bool clearUser)
 {
+  myPendingData.erase(sock->Descriptor());
   myMainLoop.removeSocket(sock);
   sock->CloseConnection();
 
@@ -555,10 +478,137 @@ void CMSN::timeoutEvent(int id)
 {
   if (id == 0)
     sendServerPing();
+  else if (id == ReconnectTimeoutId)
+    startReconnect();
   else
     typingTimeout(id);
 }
 
+void CMSN::scheduleReconnect()
+{
+  int delay = ReconnectMaxDelay;
+  if (myReconnectAttempts < 16 &&
+      (ReconnectMinDelay << myReconnectAttempts) < ReconnectMaxDelay)
+    delay = ReconnectMinDelay << myReconnectAttempts;
+
+  // Add jitter so clients dropped at the same time don't return together
+  delay += rand() % (delay / 4 + 1);
+  ++myReconnectAttempts;
+
+  gLog.info("Reconnecting in %d seconds", delay / 1000);
+  myReconnectPending = true;
+  myMainLoop.addTimeout(delay, this, ReconnectTimeoutId, true);
+}
+
+void CMSN::cancelReconnect()
+{
+  if (!myReconnectPending)
+    return;
+
+  myMainLoop.removeTimeout(ReconnectTimeoutId);
+  myReconnectPending = false;
+  myReconnectAttempts = 0;
+  myRedirectQueued = false;
+}
+
+void CMSN::startReconnect()
+{
+  if (myReconnectThreadRunning)
+    return;
+
+  // Already connected again by a new logon
+  if (myServerSocket != NULL)
+  {
+    myReconnectPending = false;
+    return;
+  }
+
+  connectToServer(string(), 0);
+}
+
+void CMSN::connectToServer(const string& host, int port)
+{
+  if (myReconnectThreadRunning)
+  {
+    // Follow a redirect once the running connect is done, a plain
+    // reconnect is already covered by the running one
+    if (!host.empty())
+    {
+      myRedirectQueued = true;
+      myRedirectHost = host;
+      myRedirectPort = port;
+      myReconnectPending = true;
+    }
+    return;
+  }
+
+  myReconnectHost = host;
+  myReconnectPort = port;
+  getServerAddress(myReconnectHost, myReconnectPort);
+  gLog.info("Server found at %s:%d", myReconnectHost.c_str(), myReconnectPort);
+
+  myReconnectPending = true;
+  myReconnectSocket = new Licq::TCPSocket(myOwnerId);
+  if (pthread_create(&myReconnectThread, NULL, &reconnectThread, this) != 0)
+  {
+    delete myReconnectSocket;
+    myReconnectSocket = NULL;
+    scheduleReconnect();
+    return;
+  }
+  myReconnectThreadRunning = true;
+}
+
+void* CMSN::reconnectThread(void* msn)
+{
+  CMSN* p = static_cast<CMSN*>(msn);
+  p->myReconnectResult = p->myReconnectSocket->connectTo(p->myReconnectHost,
+      p->myReconnectPort);
+  p->myReconnectPipe.putChar('C');
+  return NULL;
+}
+
+void CMSN::reconnectDone()
+{
+  myReconnectPipe.getChar();
+  pthread_join(myReconnectThread, NULL);
+  myReconnectThreadRunning = false;
+
+  Licq::TCPSocket* sock = myReconnectSocket;
+  myReconnectSocket = NULL;
+
+  // Reconnect was cancelled or replaced by a new logon while connecting
+  if (!myReconnectPending || myServerSocket != NULL)
+  {
+    delete sock;
+    myRedirectQueued = false;
+    return;
+  }
+
+  // Server redirected us while connecting, go there instead
+  if (myRedirectQueued)
+  {
+    delete sock;
+    myRedirectQueued = false;
+    connectToServer(myRedirectHost, myRedirectPort);
+    return;
+  }
+
+  if (!myReconnectResult)
+  {
+    gLog.info("Connect failed to %s", myReconnectHost.c_str());
+    delete sock;
+    scheduleReconnect();
+    return;
+  }
+
+  myReconnectPending = false;
+  myMainLoop.removeTimeout(ReconnectTimeoutId);
+  myServerSocket = sock;
+  myMainLoop.addSocket(myServerSocket, this);
+  SendPacket(new CPS_MSNVersion());
+}
+
 void CMSN::WaitDataEvent(CMSNDataEvent *_pEvent)
 {
   m_lMSNEvents.push_back(_pEvent);
@@ -23,10 +23,12 @@
 #include <licq/plugin/protocolpluginhelper.h>
 
 #include <list>
+#include <map>
 #include <string>
 #include <vector>
 
 #include <licq/mainloop.h>
+#include <licq/pipe.h>
 #include <licq/userid.h>
 
 #include "msnbuffer.h"
@@ -62,15 +64,6 @@ char *strndup(const char *s, size_t n);
 class CMSNPacket;
 class CMSNDataEvent;
 
-struct SBuffer
-{
-  CMSNBuffer *m_pBuf;
-  Licq::UserId myUserId;
-  bool m_bStored;
-};
-
-typedef std::list<SBuffer *> BufferList;
-
 struct SStartMessage
 {
   CMSNPacket *m_pPacket;
@@ -92,6 +85,9 @@ struct TypingTimeout
 
 typedef std::list<TypingTimeout> TypingTimeoutList;
 
+// Events waiting for acknowledgement by sequence
+typedef std::map<unsigned long, Licq::Event*> EventMap;
+
 class CMSN : public Licq::ProtocolPluginHelper, public Licq::MainLoopCallback
 {
 public:
@@ -149,12 +145,31 @@ private:
   void MSNGetDisplayPicture(const Licq::UserId& userId, const std::string& msnObject);
 
   // Internal functions
-  int HashValue(int n) { return n % 211; }
-  void StorePacket(SBuffer *, int);
-  void RemovePacket(const Licq::UserId& userId, int socketId, int size = 0);
-  SBuffer* RetrievePacket(const Licq::UserId& userId, int socketId);
-  Licq::Event* RetrieveEvent(unsigned long);
-  void HandlePacket(Licq::TCPSocket* sock, CMSNBuffer&, const Licq::UserId& userId);
+  /**
+   * Remember an event until the server acknowledges it
+   * An older event still waiting with the same sequence is failed.
+   *
+   * @param e Event with sequence of the sent packet
+   */
+  void addEvent(Licq::Event* e);
+
+  /**
+   * Take an acknowledged event
+   *
+   * @param tag Sequence from the acknowledgement
+   * @return Event or NULL if no event is waiting for the sequence
+   */
+  Licq::Event* RetrieveEvent(unsigned long tag);
+
+  /**
+   * Split received data into commands and process them
+   * Incomplete commands are kept until more data arrives on the socket.
+   *
+   * @param sock Socket data was received on
+   * @param packet Received data
+   * @param userId User associated with the socket
+   */
+  void HandlePacket(Licq::TCPSocket* sock, CMSNBuffer& packet, const Licq::UserId& userId);
   unsigned long SocketToCID(int);
   static std::string Decode(const std::string& strIn);
   static std::string Encode(const std::string& strIn);
@@ -201,6 +216,59 @@ private:
    */
   void typingTimeout(int id);
 
+  /**
+   * Get address of notification server from owner or defaults
+   *
+   * @param host Host name, left unchanged if already set
+   * @param port Port number, left unchanged if already set
+   */
+  void getServerAddress(std::string& host, int& port);
+
+  /**
+   * Schedule a new connection after losing the server
+   * Delay doubles with each failed attempt and has some random jitter added.
+   */
+  void scheduleReconnect();
+
+  /**
+   * Stop a pending reconnect
+   * A connect already running in the background is discarded when done.
+   */
+  void cancelReconnect();
+
+  /**
+   * Start connecting to the server in a background thread
+   */
+  void startReconnect();
+
+  /**
+   * Connect to a server in a background thread
+   * Used both for reconnects and for redirects from the server, the login
+   *   handshake is started from reconnectDone() when connected.
+   * If a connect is already running, the target is queued and connected to
+   *   when the running attempt is done.
+   *
+   * @param host Server to connect to, empty for the configured server
+   * @param port Server port, zero for the configured port
+   */
+  void connectToServer(const std::string& host, int port);
+
+  /**
+   * Handle result from background connect
+   */
+  void reconnectDone();
+
+  /**
+   * Thread entry point for connecting to the server
+   *
+   * @param msn Plugin object
+   */
+  static void* reconnectThread(void* msn);
+
+  static const int ReconnectTimeoutId = -1;
+  static const int ReconnectMinDelay = 1000;
+  static const int ReconnectMaxDelay = 300*1000;
+
   // Variables
   Licq::UserId myOwnerId;
   Licq::MainLoop myMainLoop;
@@ -208,8 +276,8 @@ private:
   Licq::TCPSocket* mySslSocket;
   CMSNBuffer *m_pPacketBuf,
              *m_pSSLPacket;
-  std::vector<BufferList> m_vlPacketBucket;
-  std::list<Licq::Event*> m_pEvents;
+  std::map<int, std::string> myPendingData;
+  EventMap m_pEvents;
   std::list<CMSNDataEvent*> m_lMSNEvents;
   StartList m_lStart;
   bool m_bWaitingPingReply,
@@ -218,6 +286,21 @@ private:
   TypingTimeoutList myOwnerTypingTimeouts;
   int myNextTimeoutId;
 
+  // Reconnect state, the socket, host, port and result are shared with the
+  // connect thread which signals through the pipe when it is done
+  bool myReconnectPending;
+  bool myReconnectThreadRunning;
+  int myReconnectAttempts;
+  pthread_t myReconnectThread;
+  Licq::Pipe myReconnectPipe;
+  Licq::TCPSocket* myReconnectSocket;
+  std::string myReconnectHost;
+  int myReconnectPort;
+  bool myReconnectResult;
+  bool myRedirectQueued;
+  std::string myRedirectHost;
+  int myRedirectPort;
+
   // Server variables
   unsigned myStatus;
   unsigned long m_nSessionStart;
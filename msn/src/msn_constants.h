@@ -20,11 +20,32 @@
 #ifndef LICQMSN_MSNCONSTANTS_H
 #define LICQMSN_MSNCONSTANTS_H
 
+#include <string>
+
 namespace LicqMsn
 {
 
 const char DP_EUF_GUID[] = "{A4268EEC-FEC5-49E5-95C3-F126696BDBF6}";
 
+/// Pack a three character command so it can be used as a case label
+#define MSN_COMMAND(a, b, c) \
+    ((static_cast<unsigned long>(static_cast<unsigned char>(a)) << 16) | \
+    (static_cast<unsigned long>(static_cast<unsigned char>(b)) << 8) | \
+    static_cast<unsigned long>(static_cast<unsigned char>(c)))
+
+/**
+ * Get packed code for a command
+ *
+ * @param command Command as read from a packet
+ * @return Command packed by MSN_COMMAND or zero if not three characters long
+ */
+inline unsigned long commandCode(const std::string& command)
+{
+  if (command.size() != 3)
+    return 0;
+  return MSN_COMMAND(command[0], command[1], command[2]);
+}
+
 } // namespace LicqMsn
 
 #endif
@@ -19,11 +19,13 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <strings.h>
+
 #include "msnbuffer.h"
 
 using namespace LicqMsn;
-using std::list;
 using std::string;
+using std::vector;
 
 CMSNBuffer::CMSNBuffer(CMSNBuffer &b)
   : Licq::Buffer(b)
@@ -60,116 +62,76 @@ CMSNBuffer::CMSNBuffer(Licq::Buffer& b)
 
 bool CMSNBuffer::ParseHeaders()
 {
-  char ctmp = 0;
-  int counter = 0;
-  string stmp = "", strHeader, strData;
-  struct SHeader *pHeader = 0;
-  
-  if (m_lHeader.size() > 0)
-    ClearHeaders();
+  myHeaders.clear();
 
-  while (!End())
+  const char* start = getDataStart();
+  const char* end = getDataPosWrite();
+  char* pos = getDataPosRead();
+
+  while (pos < end)
   {
-    *this >> ctmp;
-   
-    // Get header
-    while (ctmp != ':' && ctmp != '\r' && ctmp != 0)
-    {
-      stmp += ctmp;
-      *this >> ctmp;
-    }
-    
-    // Check for the end of the headers list
-    if (ctmp == '\r')
-    {
-      while (ctmp == '\r' || ctmp == '\n')
-      {
-        counter++;
-        *this >> ctmp;
-        
-        if (counter == 2)
-        {
-          setDataPosRead(getDataPosRead() - 1);
-          return true;
-        }
-      }
-      
-      counter = 0;
-    }
-    
-    *this >> ctmp; // skip ':'
-    
-    strHeader = stmp;
-    // Skip whitespace
-    while (ctmp == ' ' && ctmp != 0) *this >> ctmp;
-    
-    stmp = "";
-    
-    // Get data
-    while (ctmp != '\r' && ctmp != 0)
+    const char* lineEnd = static_cast<const char*>(memchr(pos, '\r', end - pos));
+    if (lineEnd == NULL)
+      lineEnd = end;
+    const char* colon = static_cast<const char*>(memchr(pos, ':', lineEnd - pos));
+
+    char* next = pos + (lineEnd - pos);
+    if (next < end && *next == '\r')
+      ++next;
+    if (next < end && *next == '\n')
+      ++next;
+
+    // An empty line ends the headers
+    if (colon == NULL)
     {
-      stmp += ctmp;
-      *this >> ctmp;
+      pos = next;
+      break;
     }
-    
-    // Finish the \n
-    *this >> ctmp;
-    
-    strData = stmp;
-    pHeader = new SHeader;
-    
-    if (!pHeader) return false;
-    pHeader->strHeader = strHeader;
-    pHeader->strValue = strData;
-    m_lHeader.push_back(pHeader);
-    
-    stmp = "";
+
+    const char* value = colon + 1;
+    while (value < lineEnd && *value == ' ')
+      ++value;
+
+    HeaderField header;
+    header.nameStart = pos - start;
+    header.nameLength = colon - pos;
+    header.valueStart = value - start;
+    header.valueLength = lineEnd - value;
+    myHeaders.push_back(header);
+
+    pos = next;
   }
-  
+
+  setDataPosRead(pos);
   return true;
 }
 
-string CMSNBuffer::GetValue(const string& strKey)
+const CMSNBuffer::HeaderField* CMSNBuffer::findHeader(const string& strKey) const
 {
-  string strReturn = "";
-  list<SHeader *>::iterator it;
-  for (it = m_lHeader.begin(); it != m_lHeader.end(); it++)
+  // Search backwards as the last header wins if there are duplicates
+  for (vector<HeaderField>::const_reverse_iterator it = myHeaders.rbegin();
+      it != myHeaders.rend(); ++it)
   {
-    if ((*it)->strHeader == strKey)
-    {
-      strReturn = (*it)->strValue;
-    }
+    if (it->nameLength == strKey.size() &&
+        strncasecmp(getDataStart() + it->nameStart, strKey.c_str(), it->nameLength) == 0)
+      return &*it;
   }
-  
-  return strReturn;
+
+  return NULL;
 }
 
-bool CMSNBuffer::HasHeader(const string& strKey)
+string CMSNBuffer::GetValue(const string& strKey)
 {
-  list<SHeader *>::iterator it;
-  for (it = m_lHeader.begin(); it != m_lHeader.end(); it++)
-  {
-    if ((*it)->strHeader == strKey)
-    {
-      return true;
-    }
-  }
-  
-  return false;
+  const HeaderField* header = findHeader(strKey);
+  if (header == NULL)
+    return string();
+
+  return string(getDataStart() + header->valueStart, header->valueLength);
 }
 
-void CMSNBuffer::ClearHeaders()
+bool CMSNBuffer::HasHeader(const string& strKey)
 {
-  list<SHeader *>::iterator it;
-  for (it = m_lHeader.begin(); it != m_lHeader.end(); ++it)
-  {
-    if (*it)
-    { 
-      delete *it;
-     *it = 0;
-    }
-  }
-  m_lHeader.clear();
+  return findHeader(strKey) != NULL;
 }
 
 void CMSNBuffer::SkipParameter()
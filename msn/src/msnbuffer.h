@@ -23,31 +23,39 @@
 #include <licq/buffer.h>
 
 #include <string>
-#include <list>
+#include <vector>
 
 namespace LicqMsn
 {
 
-struct SHeader
-{
-  std::string strHeader;
-  std::string strValue;
-};
-
 
 class CMSNBuffer : public Licq::Buffer
 {
 public:
   CMSNBuffer() : Licq::Buffer() { }
   CMSNBuffer(unsigned long n) : Licq::Buffer(n) { }
-  virtual ~CMSNBuffer() { ClearHeaders(); }
+  virtual ~CMSNBuffer() { }
   CMSNBuffer(CMSNBuffer &);
   CMSNBuffer(Licq::Buffer&);
 
+  /**
+   * Parse MIME headers starting at the read position
+   * Afterwards the read position is at the start of the body.
+   *
+   * @return True
+   */
   bool ParseHeaders();
+
+  /**
+   * Get value of a header, names are compared case insensitive
+   *
+   * @param key Header name
+   * @return Value of last header with the name or empty if not found
+   */
   std::string GetValue(const std::string& key);
+
   bool HasHeader(const std::string& key);
-  void ClearHeaders();
+  void ClearHeaders() { myHeaders.clear(); }
 
   void SkipParameter();
   void SkipRN();
@@ -58,7 +66,24 @@ public:
   void Skip(unsigned long);
 
 private:
-  std::list<SHeader*> m_lHeader;
+  // Location of a header in the buffer data
+  struct HeaderField
+  {
+    size_t nameStart;
+    size_t nameLength;
+    size_t valueStart;
+    size_t valueLength;
+  };
+
+  /**
+   * Find a parsed header
+   *
+   * @param key Header name
+   * @return Last header with the name or NULL if not found
+   */
+  const HeaderField* findHeader(const std::string& key) const;
+
+  std::vector<HeaderField> myHeaders;
 };
 
 } // namespace LicqMsn
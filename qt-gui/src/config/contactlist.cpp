@@ -66,6 +66,9 @@ void Config::ContactList::loadConfiguration(Licq::IniFile& iniFile)
   iniFile.get("ScrollBar", myAllowScrollBar, true);
   iniFile.get("SystemBackground", myUseSystemBackground, false);
   iniFile.get("DragMovesUser", myDragMovesUser, true);
+  iniFile.get("UpdateInterval", myUpdateInterval, 40);
+  if (myUpdateInterval < 0)
+    myUpdateInterval = 0;
 
   int flash;
   iniFile.get("Flash", flash, FlashUrgent);
@@ -177,6 +180,7 @@ void Config::ContactList::saveConfiguration(Licq::IniFile& iniFile) const
   iniFile.set("ScrollBar", myAllowScrollBar);
   iniFile.set("SystemBackground", myUseSystemBackground);
   iniFile.set("DragMovesUser", myDragMovesUser);
+  iniFile.set("UpdateInterval", myUpdateInterval);
   iniFile.set("GroupId", myGroupId);
 
   iniFile.set("NumColumns", myColumnCount);
@@ -110,6 +110,9 @@ public:
   bool useSystemBackground() const { return myUseSystemBackground; }
   bool dragMovesUser() const { return myDragMovesUser; }
 
+  /// Minimum time in ms between contact updates being passed on to the views
+  int updateInterval() const { return myUpdateInterval; }
+
   bool popupPicture() const { return myPopupPicture; }
   bool popupAlias() const { return myPopupAlias; }
   bool popupAuth() const { return myPopupAuth; }
@@ -251,6 +254,7 @@ private:
 
   // Contact list behaviour
   bool myDragMovesUser;
+  int myUpdateInterval;
 
   // Contact list sorting
   int mySortByStatus;
@@ -33,6 +33,7 @@ ContactGroup::ContactGroup(int id, const QString& name, unsigned showMask, unsig
     myGroupId(id),
     myName(name),
     myEvents(0),
+    myRowsValidFrom(0),
     myVisibleContacts(0),
     myShowMask(showMask),
     myHideMask(hideMask)
@@ -55,6 +56,7 @@ ContactGroup::ContactGroup(const Licq::Group* group)
     myName(QString::fromLocal8Bit(group->name().c_str())),
     mySortKey(group->sortIndex()),
     myEvents(0),
+    myRowsValidFrom(0),
     myVisibleContacts(0),
     myShowMask(0),
     myHideMask(ContactListModel::IgnoreStatus)
@@ -65,9 +67,10 @@ ContactGroup::ContactGroup(const Licq::Group* group)
 
 ContactGroup::~ContactGroup()
 {
-  // Remove all user instances in this group
+  // Remove all user instances in this group, the user instance removes itself
+  // from the list. Take them from the end so no rows have to be renumbered.
   while (!myUsers.isEmpty())
-    delete myUsers.takeFirst();
+    delete myUsers.last();
 
   for (int i = 0; i < 3; ++i)
     delete myBars[i];
@@ -116,13 +119,7 @@ ContactItem* ContactGroup::item(int row) const
 
 ContactUser* ContactGroup::user(ContactUserData* u) const
 {
-  foreach (ContactUser* instance, myUsers)
-  {
-    if (instance->userData() == u)
-      return instance;
-  }
-
-  return 0;
+  return myUserIndex.value(u, NULL);
 }
 
 int ContactGroup::rowCount() const
@@ -133,14 +130,30 @@ int ContactGroup::rowCount() const
 
 int ContactGroup::indexOf(ContactUser* user) const
 {
+  QHash<ContactUser*, int>::const_iterator i = myRows.constFind(user);
+  if (i == myRows.constEnd())
+    return 2;
+
+  if (i.value() >= myRowsValidFrom)
+  {
+    // Rows have moved since a user was removed, renumber the ones after it
+    for (int row = myRowsValidFrom; row < myUsers.size(); ++row)
+      myRows[myUsers.at(row)] = row;
+    myRowsValidFrom = myUsers.size();
+  }
+
   // The separator bars come first so add three to the index
-  return myUsers.indexOf(user) + 3;
+  return myRows.value(user) + 3;
 }
 
 void ContactGroup::addUser(ContactUser* user, ContactListModel::SubGroupType subGroup)
 {
   // Insert user in model
   emit beginInsert(this, rowCount());
+  if (myRowsValidFrom == myUsers.size())
+    ++myRowsValidFrom;
+  myRows.insert(user, myUsers.size());
+  myUserIndex.insert(user->userData(), user);
   myUsers.append(user);
   emit endInsert();
 
@@ -168,9 +181,17 @@ void ContactGroup::removeUser(ContactUser* user, ContactListModel::SubGroupType
   emit barDataChanged(myBars[subGroup], subGroup);
 
   // Remove user from model
-  emit beginRemove(this, indexOf(user));
-  myUsers.removeAll(user);
-  emit endRemove();
+  const int row = indexOf(user) - 3;
+  if (row >= 0)
+  {
+    emit beginRemove(this, row + 3);
+    myUsers.removeAt(row);
+    myUserIndex.remove(user->userData());
+    myRows.remove(user);
+    if (row < myRowsValidFrom)
+      myRowsValidFrom = row;
+    emit endRemove();
+  }
 
   // Update group data
   myEvents -= user->numEvents();
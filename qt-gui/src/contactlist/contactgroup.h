@@ -20,6 +20,7 @@
 #ifndef CONTACTGROUP_H
 #define CONTACTGROUP_H
 
+#include <QHash>
 #include <QList>
 #include <QString>
 #include <QVariant>
@@ -86,6 +87,12 @@ public:
   const QString& name() const
   { return myName; }
 
+  /**
+   * Get sort key for the group
+   */
+  int sortKey() const
+  { return mySortKey; }
+
   /**
    * Get number of items in this group (users and separator bars)
    */
@@ -232,6 +239,15 @@ private:
   int mySortKey;
   int myEvents;
   QList<ContactUser*> myUsers;
+
+  // Index of myUsers by user data, so lookups don't have to scan the group
+  QHash<ContactUserData*, ContactUser*> myUserIndex;
+
+  // Row of each user in myUsers. Removing a user shifts all following rows,
+  // so rows from myRowsValidFrom and up are recalculated when next needed.
+  mutable QHash<ContactUser*, int> myRows;
+  mutable int myRowsValidFrom;
+
   ContactBar* myBars[3];
   int myVisibleContacts;
   unsigned myShowMask;
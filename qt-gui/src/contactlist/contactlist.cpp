@@ -23,6 +23,7 @@
 #include <cstring>
 
 #include <QHash>
+#include <QPair>
 
 #include <licq/logging/log.h>
 #include <licq/contactlist/group.h>
@@ -70,11 +71,18 @@ QString ContactListModel::systemGroupName(int groupId)
 
 ContactListModel::ContactListModel(QObject* parent)
   : QAbstractItemModel(parent),
-    myBlockUpdates(false)
+    myBlockUpdates(false),
+    myStatsUpdates(0),
+    myStatsFlushes(0),
+    myStatsMsec(0)
 {
   assert(gGuiContactList == NULL);
   gGuiContactList = this;
 
+  myFlushTimer.setSingleShot(true);
+  connect(&myFlushTimer, SIGNAL(timeout()), SLOT(flushUserChanges()));
+  myStatsTime.start();
+
   ContactGroup* group;
 #define CREATE_SYSTEMGROUP(gid, showMask, hideMask) \
   group = new ContactGroup(gid, systemGroupName(gid), showMask, hideMask); \
@@ -120,6 +128,8 @@ void ContactListModel::connectGroup(ContactGroup* group)
 ContactListModel::~ContactListModel()
 {
   // Delete all users and groups
+  myChangedUsers.clear();
+  myUserIndex.clear();
   while (!myUsers.isEmpty())
     delete myUsers.takeFirst();
 
@@ -232,6 +242,7 @@ void ContactListModel::userUpdated(const Licq::UserId& userId, unsigned long sub
 
   // Forward signal to the ContactUserData object
   user->update(subSignal, argument);
+  ++myStatsUpdates;
 }
 
 void ContactListModel::configUpdated()
@@ -267,11 +278,59 @@ void ContactListModel::userDataChanged(const ContactUserData* user)
   if (myBlockUpdates)
     return;
 
-  // Emit signal that the user has changed in all groups
-  foreach (ContactUser* u, user->groupList())
+  // Many users may change at once, e.g. during logon. Collect them so the
+  // views get one update per group instead of one per user.
+  myChangedUsers.insert(user);
+  if (!myFlushTimer.isActive())
+    myFlushTimer.start(Config::ContactList::instance()->updateInterval());
+}
+
+void ContactListModel::flushUserChanges()
+{
+  QTime timer;
+  timer.start();
+
+  // Find the range of changed rows in each group
+  QHash<ContactGroup*, QPair<int, int> > ranges;
+  foreach (const ContactUserData* user, myChangedUsers)
+  {
+    foreach (ContactUser* u, user->groupList())
+    {
+      int row = u->group()->indexOf(u);
+      QHash<ContactGroup*, QPair<int, int> >::iterator i = ranges.find(u->group());
+      if (i == ranges.end())
+        ranges.insert(u->group(), qMakePair(row, row));
+      else
+      {
+        i.value().first = qMin(i.value().first, row);
+        i.value().second = qMax(i.value().second, row);
+      }
+    }
+  }
+  myChangedUsers.clear();
+
+  // Emit signal that the users have changed in all groups
+  QHash<ContactGroup*, QPair<int, int> >::const_iterator i;
+  for (i = ranges.constBegin(); i != ranges.constEnd(); ++i)
+  {
+    ContactGroup* group = i.key();
+    int first = i.value().first;
+    int last = i.value().second;
+    emit dataChanged(createIndex(first, 0, group->item(first)),
+        createIndex(last, myColumnCount - 1, group->item(last)));
+  }
+
+  myStatsMsec += timer.elapsed();
+  ++myStatsFlushes;
+  if (myStatsTime.elapsed() >= 1000)
   {
-    int row = u->group()->indexOf(u);
-    emit dataChanged(createIndex(row, 0, u), createIndex(row, myColumnCount - 1, u));
+    Licq::gLog.debug("Contact list: %i user updates in %i batches, "
+        "%i ms spent updating views", myStatsUpdates, myStatsFlushes,
+        myStatsMsec);
+    myStatsTime.restart();
+    myStatsUpdates = 0;
+    myStatsFlushes = 0;
+    myStatsMsec = 0;
   }
 }
 
@@ -332,6 +391,9 @@ void ContactListModel::reloadAll()
   myBlockUpdates = true;
 
   // Clear all old users
+  myChangedUsers.clear();
+  myFlushTimer.stop();
+  myUserIndex.clear();
   while (!myUsers.isEmpty())
     delete myUsers.takeFirst();
 
@@ -382,12 +444,7 @@ void ContactListModel::reloadAll()
 
 ContactUserData* ContactListModel::findUser(const Licq::UserId& userId) const
 {
-  foreach (ContactUserData* user, myUsers)
-  {
-    if (user->userId() == userId)
-      return user;
-  }
-  return 0;
+  return myUserIndex.value(userId, NULL);
 }
 
 int ContactListModel::groupRow(ContactGroup* group) const
@@ -404,6 +461,7 @@ void ContactListModel::addUser(const Licq::User* licqUser)
       SLOT(updateUserGroups(ContactUserData*, const Licq::User*)));
 
   myUsers.append(newUser);
+  myUserIndex.insert(newUser->userId(), newUser);
   updateUserGroups(newUser, licqUser);
 }
 
@@ -457,7 +515,9 @@ void ContactListModel::removeUser(const Licq::UserId& userId)
     delete u;
   }
 
-  myUsers.removeAll(user);
+  myChangedUsers.remove(user);
+  myUserIndex.remove(userId);
+  myUsers.removeOne(user);
   delete user;
 }
 
@@ -624,5 +684,8 @@ bool ContactListModel::setData(const QModelIndex& index, const QVariant& value,
 
 uint qHash(const Licq::UserId& userId)
 {
-  return qHash(userId.toString().c_str());
+  // Hash the account id in place, this is called for every user signal
+  const std::string& accountId = userId.accountId();
+  return qHash(QByteArray::fromRawData(accountId.data(), accountId.size())) ^
+      static_cast<uint>(userId.protocolId());
 }
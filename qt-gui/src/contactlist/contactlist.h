@@ -21,7 +21,11 @@
 #define CONTACTLISTMODEL_H
 
 #include <QAbstractItemModel>
+#include <QHash>
 #include <QList>
+#include <QSet>
+#include <QTime>
+#include <QTimer>
 
 #include <licq/userid.h>
 
@@ -360,12 +364,20 @@ private slots:
 
   /**
    * The model data for a user has changed
-   * Will send a dataChanged signal for the user in all groups it is present
+   * The user is remembered and a dataChanged signal will be sent for it in
+   * all groups it is present when the update timer fires.
    *
    * @param user The user data object that has changed
    */
   void userDataChanged(const ContactUserData* user);
 
+  /**
+   * Send dataChanged signals for all users changed since last time
+   * One signal is sent per group, covering all changed users in it, so the
+   * proxies only need to sort each group once for a batch of changes.
+   */
+  void flushUserChanges();
+
   /**
    * The model data for a group has changed
    * Will send a dataChanged signal for the group
@@ -458,8 +470,19 @@ private:
   QList<ContactGroup*> myGroups;
   ContactGroup* myAllUsersGroup;
   QList<ContactUserData*> myUsers;
+  QHash<Licq::UserId, ContactUserData*> myUserIndex;
   int myColumnCount;
   bool myBlockUpdates;
+
+  // Users changed since the last flush
+  QSet<const ContactUserData*> myChangedUsers;
+  QTimer myFlushTimer;
+
+  // Statistics for time spent passing updates to the views
+  QTime myStatsTime;
+  int myStatsUpdates;
+  int myStatsFlushes;
+  int myStatsMsec;
 };
 
 extern ContactListModel* gGuiContactList;
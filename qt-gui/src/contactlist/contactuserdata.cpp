@@ -63,6 +63,8 @@ ContactUserData::ContactUserData(const Licq::User* licqUser, QObject* parent)
     myEvents(0),
     myFlash(false),
     mySubGroup(ContactListModel::OfflineSubGroup),
+    mySortStatus(0),
+    mySortSecondary(0),
     myVisibility(false),
     myOnlCounter(0),
     myCarCounter(0),
@@ -405,21 +407,32 @@ void ContactUserData::updateSorting()
 
   // Set sorting
   mySortKey = "";
+  mySortStatus = 0;
+  mySortSecondary = 0;
   switch (Config::ContactList::instance()->sortByStatus())
   {
     case 0:  // no sorting
       break;
     case 1:  // sort by status
+      mySortStatus = sort;
       mySortKey.sprintf("%1x", sort);
       break;
     case 2:  // sort by status and last event
-      mySortKey.sprintf("%1x%016lx", sort, ULONG_MAX - myTouched);
+      mySortStatus = sort;
+      mySortSecondary = ULONG_MAX - myTouched;
+      mySortKey.sprintf("%1x%016lx", sort, mySortSecondary);
       break;
     case 3:  // sort by status and number of new messages
-      mySortKey.sprintf("%1x%016lx", sort, ULONG_MAX - myNewMessages);
+      mySortStatus = sort;
+      mySortSecondary = ULONG_MAX - myNewMessages;
+      mySortKey.sprintf("%1x%016lx", sort, mySortSecondary);
       break;
   }
   mySortKey += myText[0];
+
+  // Sorting is case insensitive, fold the name once here instead of in every
+  // comparison
+  mySortName = myText[0].toCaseFolded();
 }
 
 bool ContactUserData::updateText(const Licq::User* licqUser)
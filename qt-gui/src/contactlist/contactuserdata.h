@@ -95,6 +95,18 @@ public:
   ContactListModel::SubGroupType subGroup() const
   { return mySubGroup; }
 
+  /**
+   * Get sort keys, the same values that make up the SortRole string but
+   * stored separately so users can be compared without building variants
+   * Compare sortStatus() first, then sortSecondary() and last sortName().
+   */
+  int sortStatus() const
+  { return mySortStatus; }
+  unsigned long sortSecondary() const
+  { return mySortSecondary; }
+  const QString& sortName() const
+  { return mySortName; }
+
   /**
    * Get number of unread events
    */
@@ -253,6 +265,9 @@ private:
   unsigned int myExtendedStatus;
   ContactListModel::SubGroupType mySubGroup;
   QString mySortKey;
+  int mySortStatus;
+  unsigned long mySortSecondary;
+  QString mySortName;
   bool myVisibility;
 
   bool myFlashCounter;
@@ -19,7 +19,11 @@
 
 #include "sortedcontactlistproxy.h"
 
+#include "contactbar.h"
+#include "contactgroup.h"
 #include "contactlist.h"
+#include "contactuser.h"
+#include "contactuserdata.h"
 
 using namespace LicqQtGui;
 
@@ -44,8 +48,61 @@ void SortedContactListProxy::sort(int column, int role, Qt::SortOrder order)
   QSortFilterProxyModel::sort(column, Qt::AscendingOrder);
 }
 
+// Sort prefix for an item, same as the SortPrefixRole value
+static int sortPrefix(const ContactItem* item)
+{
+  switch (item->itemType())
+  {
+    case ContactListModel::UserItem:
+      return 2 * static_cast<const ContactUser*>(item)->userData()->subGroup() + 1;
+    case ContactListModel::BarItem:
+      return 2 * static_cast<const ContactBar*>(item)->subGroup();
+    default:
+      return 0;
+  }
+}
+
+// Ascending compare of two items from the same group on SortRole
+static bool sortKeyLessThan(const ContactItem* left, const ContactItem* right)
+{
+  if (left->itemType() == ContactListModel::GroupItem)
+    return static_cast<const ContactGroup*>(left)->sortKey() <
+        static_cast<const ContactGroup*>(right)->sortKey();
+
+  // Bars have empty sort key and prefixes are always different from users
+  if (left->itemType() != ContactListModel::UserItem ||
+      right->itemType() != ContactListModel::UserItem)
+    return false;
+
+  const ContactUserData* l = static_cast<const ContactUser*>(left)->userData();
+  const ContactUserData* r = static_cast<const ContactUser*>(right)->userData();
+  if (l->sortStatus() != r->sortStatus())
+    return l->sortStatus() < r->sortStatus();
+  if (l->sortSecondary() != r->sortSecondary())
+    return l->sortSecondary() < r->sortSecondary();
+  return l->sortName() < r->sortName();
+}
+
 bool SortedContactListProxy::lessThan(const QModelIndex& left, const QModelIndex& right) const
 {
+  // Items directly from the contact list can be compared using the keys
+  // cached in the items, this is the common case when sorting on SortRole
+  if (sortRole() == ContactListModel::SortRole &&
+      left.model() == gGuiContactList && right.model() == gGuiContactList)
+  {
+    const ContactItem* l = static_cast<const ContactItem*>(left.internalPointer());
+    const ContactItem* r = static_cast<const ContactItem*>(right.internalPointer());
+
+    int prefixDiff = sortPrefix(l) - sortPrefix(r);
+    if (prefixDiff != 0)
+      return (prefixDiff < 0);
+
+    if (mySortOrder == Qt::AscendingOrder)
+      return sortKeyLessThan(l, r);
+    else
+      return sortKeyLessThan(r, l);
+  }
+
   int prefixDiff = left.data(ContactListModel::SortPrefixRole).toInt() - right.data(ContactListModel::SortPrefixRole).toInt();
 
   // First sort on prefixes
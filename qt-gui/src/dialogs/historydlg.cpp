@@ -31,6 +31,7 @@
 #include <QPushButton>
 #include <QRegExp>
 #include <QShortcut>
+#include <QTimer>
 #include <QVBoxLayout>
 
 #include <licq/contactlist/owner.h>
@@ -41,6 +42,7 @@
 #include <licq/userevents.h>
 
 #include "config/chat.h"
+#include "config/emoticons.h"
 #include "core/licqgui.h"
 #include "core/signalmanager.h"
 #include "core/usermenu.h"
@@ -48,13 +50,22 @@
 #include "widgets/calendar.h"
 #include "widgets/historyview.h"
 
+#include "historyloader.h"
+
 
 using namespace LicqQtGui;
 /* TRANSLATOR LicqQtGui::HistoryDlg */
 
+// Number of entries to check for search matches before letting the GUI run
+static const int MatchScanChunk = 500;
+
 HistoryDlg::HistoryDlg(const Licq::UserId& userId, QWidget* parent)
   : QDialog(parent),
-    myUserId(userId)
+    myUserId(userId),
+    myLoader(NULL),
+    myLoading(false),
+    myDateSelected(false),
+    myMatchScanQueued(false)
 {
   Support::setWidgetProps(this, "UserHistoryDialog");
   setAttribute(Qt::WA_DeleteOnClose, true);
@@ -77,13 +88,13 @@ HistoryDlg::HistoryDlg(const Licq::UserId& userId, QWidget* parent)
   // Buttons to go to previos/next day with activity
   QHBoxLayout* navigateLayout = new QHBoxLayout();
   sidebarLayout->addLayout(navigateLayout);
-  QPushButton* previousDateButton = new QPushButton(tr("&Previous day"));
-  connect(previousDateButton, SIGNAL(clicked()), SLOT(previousDate()));
-  navigateLayout->addWidget(previousDateButton);
+  myPreviousDateButton = new QPushButton(tr("&Previous day"));
+  connect(myPreviousDateButton, SIGNAL(clicked()), SLOT(previousDate()));
+  navigateLayout->addWidget(myPreviousDateButton);
   navigateLayout->addStretch(1);
-  QPushButton* nextDateButton = new QPushButton(tr("&Next day"));
-  connect(nextDateButton, SIGNAL(clicked()), SLOT(nextDate()));
-  navigateLayout->addWidget(nextDateButton);
+  myNextDateButton = new QPushButton(tr("&Next day"));
+  connect(myNextDateButton, SIGNAL(clicked()), SLOT(nextDate()));
+  navigateLayout->addWidget(myNextDateButton);
 
   // Status label for showing various messages
   myStatusLabel = new QLabel();
@@ -154,6 +165,11 @@ HistoryDlg::HistoryDlg(const Licq::UserId& userId, QWidget* parent)
   QDialogButtonBox* buttons = new QDialogButtonBox(QDialogButtonBox::Close);
   connect(buttons, SIGNAL(rejected()), SLOT(close()));
   buttonsLayout->addWidget(buttons);
+  connect(Emoticons::self(), SIGNAL(themeChanged()), SLOT(emoticonsChanged()));
+
+  mySearchPos = myHistoryList.end();
+  myMatchPos = myHistoryList.end();
+  setControlsEnabled(false);
 
   show();
 
@@ -162,36 +178,9 @@ HistoryDlg::HistoryDlg(const Licq::UserId& userId, QWidget* parent)
 
     setTitle(*u);
 
-    bool validHistory = false;
-
     if (!u.isLocked())
     {
       myStatusLabel->setText(tr("Invalid user requested"));
-    }
-    // Fetch list of all history entries
-    else if (!u->GetHistory(myHistoryList))
-    {
-      myStatusLabel->setText(tr("Error loading history file"));
-    }
-    // No point in doing anything more if history is empty
-    else if (myHistoryList.empty())
-    {
-      myStatusLabel->setText(tr("History is empty"));
-    }
-    else
-    {
-      // No problems that should stop us from continuing
-      validHistory = true;
-    }
-
-    if (!validHistory)
-    {
-      myCalendar->setEnabled(false);
-      previousDateButton->setEnabled(false);
-      nextDateButton->setEnabled(false);
-      myPatternEdit->setEnabled(false);
-      myFindPrevButton->setEnabled(false);
-      myFindNextButton->setEnabled(false);
       return;
     }
 
@@ -220,22 +209,8 @@ HistoryDlg::HistoryDlg(const Licq::UserId& userId, QWidget* parent)
       myOwnerName = QString::fromUtf8(o->getAlias().c_str());
   }
 
-  // Mark all dates with activity so they are easier to find
-  Licq::HistoryList::iterator item;
-  for (item = myHistoryList.begin(); item != myHistoryList.end(); ++item)
-  {
-    QDate date = QDateTime::fromTime_t((*item)->Time()).date();
-    myCalendar->markDate(date);
-  }
-
-  // Limit calendar to dates where we have history entries
-  myCalendar->setMinimumDate(QDateTime::fromTime_t((*myHistoryList.begin())->Time()).date());
-  QDate lastDate = QDateTime::fromTime_t((*(--myHistoryList.end()))->Time()).date();
-  myCalendar->setMaximumDate(lastDate);
-  myCalendar->setSelectedDate(lastDate);
-  calenderClicked();
-
   // Catch sent messages and add them to history
+  // Connect before loading starts so nothing written meanwhile is missed
   connect(gLicqGui, SIGNAL(eventSent(const Licq::Event*)),
       SLOT(eventSent(const Licq::Event*)));
 
@@ -243,11 +218,134 @@ HistoryDlg::HistoryDlg(const Licq::UserId& userId, QWidget* parent)
   connect(gGuiSignalManager,
       SIGNAL(updatedUser(const Licq::UserId&, unsigned long, int, unsigned long)),
       SLOT(updatedUser(const Licq::UserId&, unsigned long, int)));
+
+  // Read history in the background and show it as it arrives
+  myStatusLabel->setText(tr("Loading history..."));
+  myLoader = new HistoryLoader(myUserId, this);
+  connect(myLoader, SIGNAL(entriesLoaded()), SLOT(historyLoaded()));
+  connect(myLoader, SIGNAL(finished()), SLOT(loadingFinished()));
+  myLoading = true;
+  myLoader->start(QThread::LowPriority);
 }
 
 HistoryDlg::~HistoryDlg()
 {
+  if (myLoader != NULL)
+  {
+    myLoader->stop();
+    myLoader->wait();
+  }
   Licq::User::ClearHistory(myHistoryList);
+  Licq::User::ClearHistory(myLiveEvents);
+}
+
+void HistoryDlg::historyLoaded()
+{
+  Licq::HistoryList entries;
+  myLoader->takeEntries(entries);
+  if (entries.empty())
+    return;
+
+  bool firstEntries = myHistoryList.empty();
+  QDate selectedDate = myCalendar->selectedDate();
+  bool selectedDateChanged = false;
+
+  // Splicing keeps iterators valid so new entries can be indexed in place
+  Licq::HistoryList::iterator first = entries.begin();
+  myHistoryList.splice(myHistoryList.end(), entries);
+  for (Licq::HistoryList::iterator item = first; item != myHistoryList.end(); ++item)
+  {
+    addToIndex(item);
+    if (QDateTime::fromTime_t((*item)->Time()).date() == selectedDate)
+      selectedDateChanged = true;
+  }
+
+  // Limit calendar to dates where we have history entries
+  myCalendar->setMinimumDate(myDateIndex.begin().key());
+  QDate lastDate = (--myDateIndex.end()).key();
+  myCalendar->setMaximumDate(lastDate);
+
+  if (firstEntries)
+    setControlsEnabled(true);
+
+  // Follow the latest date until the user picks one
+  if (!myDateSelected && lastDate != selectedDate)
+  {
+    myCalendar->setSelectedDate(lastDate);
+    selectedDateChanged = true;
+  }
+  if (selectedDateChanged)
+    showHistory();
+
+  // Include new entries in a running search
+  if (!myMatchRegExp.isEmpty() && myMatchPos == myHistoryList.end())
+    startMatchScan(first);
+
+  myStatusLabel->setText(tr("Loading history... (%1 entries)")
+      .arg(myHistoryList.size()));
+}
+
+void HistoryDlg::loadingFinished()
+{
+  // Pick up anything added after the last notification
+  historyLoaded();
+
+  myLoading = false;
+
+  // Add events from while loading unless the loader already read them
+  while (!myLiveEvents.empty())
+  {
+    Licq::UserEvent* event = myLiveEvents.front();
+    myLiveEvents.pop_front();
+    if (!isLoaded(event))
+      addMsg(event);
+    delete event;
+  }
+
+  if (myLoader->failed())
+    myStatusLabel->setText(tr("Error loading history file"));
+  else if (myHistoryList.empty())
+    myStatusLabel->setText(tr("History is empty"));
+  else
+    myStatusLabel->setText(QString());
+}
+
+bool HistoryDlg::isLoaded(const Licq::UserEvent* event) const
+{
+  // Entries are in time order so only the last ones need to be checked
+  Licq::HistoryList::const_reverse_iterator i;
+  for (i = myHistoryList.rbegin(); i != myHistoryList.rend() &&
+      (*i)->Time() >= event->Time(); ++i)
+  {
+    if ((*i)->Time() == event->Time() &&
+        (*i)->isReceiver() == event->isReceiver() &&
+        (*i)->text() == event->text())
+      return true;
+  }
+  return false;
+}
+
+void HistoryDlg::addToIndex(Licq::HistoryList::iterator item)
+{
+  QDate date = QDateTime::fromTime_t((*item)->Time()).date();
+  DateIndex::iterator i = myDateIndex.find(date);
+  if (i == myDateIndex.end())
+  {
+    // Mark all dates with activity so they are easier to find
+    myCalendar->markDate(date);
+    i = myDateIndex.insert(date, QList<Licq::HistoryList::iterator>());
+  }
+  i.value().append(item);
+}
+
+void HistoryDlg::setControlsEnabled(bool enable)
+{
+  myCalendar->setEnabled(enable);
+  myPreviousDateButton->setEnabled(enable);
+  myNextDateButton->setEnabled(enable);
+  myPatternEdit->setEnabled(enable);
+  myFindPrevButton->setEnabled(enable && !myPatternEdit->text().isEmpty());
+  myFindNextButton->setEnabled(enable && !myPatternEdit->text().isEmpty());
 }
 
 void HistoryDlg::updatedUser(const Licq::UserId& userId, unsigned long subSignal, int argument)
@@ -266,7 +364,8 @@ void HistoryDlg::updatedUser(const Licq::UserId& userId, unsigned long subSignal
       event = u->EventPeekId(argument);
     }
 
-    if (event != NULL && argument > 0 && argument > (*(--myHistoryList.end()))->Id())
+    if (event != NULL && argument > 0 && (myLoading || myHistoryList.empty() ||
+        argument > (*(--myHistoryList.end()))->Id()))
       addMsg(event);
   }
   else if (subSignal == Licq::PluginSignal::UserBasic)
@@ -302,11 +401,28 @@ void HistoryDlg::eventSent(const Licq::Event* event)
 
 void HistoryDlg::addMsg(const Licq::UserEvent* event)
 {
+  // Loaded entries are still arriving, add it after them
+  if (myLoading)
+  {
+    myLiveEvents.push_back(event->Copy());
+    return;
+  }
+
+  bool firstEntry = myHistoryList.empty();
   Licq::UserEvent* eventCopy = event->Copy();
   myHistoryList.push_back(eventCopy);
+  addToIndex(--myHistoryList.end());
   QDate date = QDateTime::fromTime_t(event->Time()).date();
-  myCalendar->markDate(date);
   myCalendar->setMaximumDate(date);
+
+  if (firstEntry)
+  {
+    myCalendar->setMinimumDate(date);
+    myCalendar->setSelectedDate(date);
+    setControlsEnabled(true);
+    myStatusLabel->setText(QString());
+    showHistory();
+  }
 }
 
 QRegExp HistoryDlg::getRegExp() const
@@ -328,17 +444,17 @@ void HistoryDlg::showHistory()
 
   QDateTime date;
 
-  // Go through all entries in the list
-  Licq::HistoryList::iterator item;
-  for (item = myHistoryList.begin(); item != myHistoryList.end(); ++item)
+  // Go through all entries from the selected date
+  DateIndex::const_iterator day = myDateIndex.constFind(myCalendar->selectedDate());
+  if (day == myDateIndex.constEnd())
+  {
+    myHistoryView->updateContent();
+    return;
+  }
+  foreach (Licq::HistoryList::iterator item, day.value())
   {
     date.setTime_t((*item)->Time());
 
-    // Skip those that aren't from the selected date
-    if (date.date() != myCalendar->selectedDate())
-      continue;
-
-    QString messageText = QString::fromUtf8((*item)->text().c_str());
     QString name = (*item)->isReceiver() ? myContactName : myOwnerName;
 
     QRegExp highlight;
@@ -349,7 +465,7 @@ void HistoryDlg::showHistory()
       highlight = getRegExp();
       highlight.setMinimal(true);
     }
-    messageText = HistoryView::toRichText(messageText, true, myUseHtml, highlight);
+    QString messageText = renderEntry(*item, highlight);
 
     // Add entry to history view
     myHistoryView->addMsg((*item)->isReceiver(), false,
@@ -368,8 +484,34 @@ void HistoryDlg::showHistory()
   myHistoryView->updateContent();
 }
 
+QString HistoryDlg::renderEntry(const Licq::UserEvent* event, const QRegExp& highlight)
+{
+  if (highlight.isEmpty())
+  {
+    QHash<const Licq::UserEvent*, QString>::const_iterator i = myRenderCache.constFind(event);
+    if (i != myRenderCache.constEnd())
+      return i.value();
+  }
+
+  QString messageText = HistoryView::toRichText(
+      QString::fromUtf8(event->text().c_str()), true, myUseHtml, highlight);
+
+  if (highlight.isEmpty())
+    myRenderCache.insert(event, messageText);
+  return messageText;
+}
+
+void HistoryDlg::emoticonsChanged()
+{
+  myRenderCache.clear();
+  showHistory();
+}
+
 void HistoryDlg::calenderClicked()
 {
+  // Stop following new dates once user has picked one
+  myDateSelected = true;
+
   // Clear search position
   mySearchPos = myHistoryList.end();
 
@@ -398,21 +540,14 @@ void HistoryDlg::find(bool backwards)
   if (regExp.indexIn("") != -1)
     return;
 
-  // If search pattern has changed, find all matching dates and mark them in the calendar
+  // If search pattern has changed, find all matching dates and mark them in
+  // the calendar. This is done in the background so matches show up as they
+  // are found.
   if (myPatternChanged)
   {
     myCalendar->clearMatches();
-
-    Licq::HistoryList::iterator i;
-    for (i = myHistoryList.begin(); i != myHistoryList.end(); ++i)
-    {
-      QString messageText = QString::fromUtf8((*i)->text().c_str());
-      if (messageText.contains(regExp))
-      {
-        QDate date = QDateTime::fromTime_t((*i)->Time()).date();
-        myCalendar->addMatch(date);
-      }
-    }
+    myMatchRegExp = regExp;
+    startMatchScan(myHistoryList.begin());
 
     // No need to do this again next time
     myPatternChanged = false;
@@ -423,18 +558,13 @@ void HistoryDlg::find(bool backwards)
   // If this is first search we need to find an entry to start searching from
   if (mySearchPos == myHistoryList.end())
   {
-    for (mySearchPos = myHistoryList.begin(); mySearchPos != myHistoryList.end(); ++mySearchPos)
-    {
-      QDate date = QDateTime::fromTime_t((*mySearchPos)->Time()).date();
-
-      // When searching backwards, set start to first entry after current day
-      if (date > myCalendar->selectedDate())
-        break;
-
-      // When searching forwards, set start to last entry before current day
-      if (!backwards && date >= myCalendar->selectedDate())
-        break;
-    }
+    // When searching backwards, set start to first entry after current day
+    // When searching forwards, set start to last entry before current day
+    DateIndex::const_iterator day = (backwards ?
+        myDateIndex.upperBound(myCalendar->selectedDate()) :
+        myDateIndex.lowerBound(myCalendar->selectedDate()));
+    if (day != myDateIndex.constEnd())
+      mySearchPos = day.value().first();
 
     // Back one step to actually get entry before current day
     if (!backwards)
@@ -477,6 +607,7 @@ void HistoryDlg::find(bool backwards)
   }
 
   QDate date = QDateTime::fromTime_t((*mySearchPos)->Time()).date();
+  myDateSelected = true;
   myCalendar->setSelectedDate(date);
   showHistory();
   myHistoryView->scrollToAnchor("SearchHit");
@@ -494,6 +625,10 @@ void HistoryDlg::searchTextChanged(const QString& text)
   // Mark that pattern has changed since previous search
   myPatternChanged = true;
 
+  // Old matches no longer apply
+  myMatchRegExp = QRegExp();
+  myMatchPos = myHistoryList.end();
+
   // Search field is cleared so clear status message and matching dates
   if (text.isEmpty())
   {
@@ -502,58 +637,64 @@ void HistoryDlg::searchTextChanged(const QString& text)
   }
 }
 
-void HistoryDlg::showUserMenu()
+void HistoryDlg::startMatchScan(Licq::HistoryList::iterator start)
 {
-  gUserMenu->setUser(myUserId);
+  myMatchPos = start;
+  if (!myMatchScanQueued && myMatchPos != myHistoryList.end())
+  {
+    myMatchScanQueued = true;
+    QTimer::singleShot(0, this, SLOT(scanMatches()));
+  }
 }
 
-void HistoryDlg::nextDate()
+void HistoryDlg::scanMatches()
 {
-  QDateTime date;
-  Licq::HistoryList::iterator item;
+  myMatchScanQueued = false;
 
-  // Find first entry in next date
-  for (item = myHistoryList.begin(); item != myHistoryList.end(); ++item)
+  for (int i = 0; i < MatchScanChunk && myMatchPos != myHistoryList.end(); ++i, ++myMatchPos)
   {
-    date.setTime_t((*item)->Time());
-
-    // Stop when we find an entry with date later then current
-    if (date.date() > myCalendar->selectedDate())
-      break;
+    QString messageText = QString::fromUtf8((*myMatchPos)->text().c_str());
+    if (messageText.contains(myMatchRegExp))
+    {
+      QDate date = QDateTime::fromTime_t((*myMatchPos)->Time()).date();
+      myCalendar->addMatch(date);
+    }
   }
 
-  // No later date found so go to oldest entry
-  if (item == myHistoryList.end())
-    date.setTime_t((*myHistoryList.begin())->Time());
-
-  myCalendar->setSelectedDate(date.date());
-  calenderClicked();
+  // Let the GUI handle events before continuing
+  startMatchScan(myMatchPos);
 }
 
-void HistoryDlg::previousDate()
+void HistoryDlg::showUserMenu()
 {
-  QDateTime date;
-  Licq::HistoryList::iterator item;
+  gUserMenu->setUser(myUserId);
+}
 
-  // Find first entry in next date
-  for (item = myHistoryList.begin(); item != myHistoryList.end(); ++item)
-  {
-    date.setTime_t((*item)->Time());
+void HistoryDlg::nextDate()
+{
+  if (myDateIndex.isEmpty())
+    return;
 
-    // Stop when we find an entry with date later then current
-    if (date.date() >= myCalendar->selectedDate())
-      break;
-  }
+  // Find next date with entries, if there is none go to oldest date
+  DateIndex::const_iterator day = myDateIndex.upperBound(myCalendar->selectedDate());
+  if (day == myDateIndex.constEnd())
+    day = myDateIndex.constBegin();
 
-  // Go back to last entry of previous day
-  --item;
+  myCalendar->setSelectedDate(day.key());
+  calenderClicked();
+}
 
-  // No earlier date, go to last
-  if (item == myHistoryList.end())
-    --item;
+void HistoryDlg::previousDate()
+{
+  if (myDateIndex.isEmpty())
+    return;
 
-  date.setTime_t((*item)->Time());
+  // Find previous date with entries, if there is none go to latest date
+  DateIndex::const_iterator day = myDateIndex.lowerBound(myCalendar->selectedDate());
+  if (day == myDateIndex.constBegin())
+    day = myDateIndex.constEnd();
+  --day;
 
-  myCalendar->setSelectedDate(date.date());
+  myCalendar->setSelectedDate(day.key());
   calenderClicked();
 }
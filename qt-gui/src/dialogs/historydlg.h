@@ -22,7 +22,13 @@
 
 #include "config.h"
 
+#include <QDate>
 #include <QDialog>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QRegExp>
+#include <QString>
 
 #include <licq/contactlist/user.h>
 #include <licq/userid.h>
@@ -32,7 +38,6 @@ class QCheckBox;
 class QLabel;
 class QLineEdit;
 class QPushButton;
-class QRegExp;
 
 namespace Licq
 {
@@ -42,6 +47,7 @@ class Event;
 namespace LicqQtGui
 {
 class Calendar;
+class HistoryLoader;
 class HistoryView;
 
 /**
@@ -110,6 +116,26 @@ private slots:
    */
   void previousDate();
 
+  /**
+   * Emoticon theme has changed, render entries again
+   */
+  void emoticonsChanged();
+
+  /**
+   * Loader thread has read more entries, add them to the dialog
+   */
+  void historyLoaded();
+
+  /**
+   * Loader thread has finished
+   */
+  void loadingFinished();
+
+  /**
+   * Check next part of the history for search matches to mark in calendar
+   */
+  void scanMatches();
+
 private slots:
   /**
    * A user was updated. Add to history if it was a message recieved for this user
@@ -135,6 +161,15 @@ private:
    */
   void addMsg(const Licq::UserEvent* event);
 
+  /**
+   * Check if an event is already among the entries read from file
+   * Entries read from file get new ids so they are compared by content.
+   *
+   * @param event Event to look for
+   * @return True if a matching entry has been loaded
+   */
+  bool isLoaded(const Licq::UserEvent* event) const;
+
   /**
    * Build a regular expression from the input fields
    *
@@ -154,6 +189,35 @@ private:
    */
   void setTitle(const Licq::User* user);
 
+  /**
+   * Get rich text for a history entry
+   * Entries without highlight are cached so switching dates is cheap.
+   *
+   * @param event History entry
+   * @param highlight Expression to highlight or empty for none
+   * @return Message text formatted for history view
+   */
+  QString renderEntry(const Licq::UserEvent* event, const QRegExp& highlight);
+
+  /**
+   * Add an entry to the date index and mark its date in the calendar
+   *
+   * @param item Entry in myHistoryList
+   */
+  void addToIndex(Licq::HistoryList::iterator item);
+
+  /**
+   * Enable or disable navigation and search controls
+   */
+  void setControlsEnabled(bool enable);
+
+  /**
+   * Start marking dates matching an expression in the calendar
+   *
+   * @param start First entry to check
+   */
+  void startMatchScan(Licq::HistoryList::iterator start);
+
   Licq::UserId myUserId;
   QString myContactName;
   QString myOwnerName;
@@ -163,12 +227,31 @@ private:
   Licq::HistoryList myHistoryList;
   Licq::HistoryList::iterator mySearchPos;
 
+  // Entries for each date, in the order they appear in myHistoryList
+  typedef QMap<QDate, QList<Licq::HistoryList::iterator> > DateIndex;
+  DateIndex myDateIndex;
+
+  HistoryLoader* myLoader;
+  bool myLoading;
+  bool myDateSelected;
+
+  // Events sent or received while loading, added when loading is done
+  Licq::HistoryList myLiveEvents;
+
+  // Background marking of matching dates
+  QRegExp myMatchRegExp;
+  Licq::HistoryList::iterator myMatchPos;
+  bool myMatchScanQueued;
+  QHash<const Licq::UserEvent*, QString> myRenderCache;
+
   Calendar* myCalendar;
   HistoryView* myHistoryView;
   QLabel* myStatusLabel;
   QLineEdit* myPatternEdit;
   QCheckBox* myMatchCaseCheck;
   QCheckBox* myRegExpSearchCheck;
+  QPushButton* myPreviousDateButton;
+  QPushButton* myNextDateButton;
   QPushButton* myFindPrevButton;
   QPushButton* myFindNextButton;
 };
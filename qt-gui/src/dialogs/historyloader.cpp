@@ -0,0 +1,120 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "historyloader.h"
+
+#include <QMutexLocker>
+
+#include <licq/contactlist/usermanager.h>
+
+using namespace LicqQtGui;
+
+// Number of entries to read each time the user is locked
+static const size_t ChunkSize = 500;
+
+HistoryLoader::HistoryLoader(const Licq::UserId& userId, QObject* parent)
+  : QThread(parent),
+    myUserId(userId),
+    myStopping(false),
+    myFailed(false),
+    myTailOnly(false),
+    myTailCount(0),
+    myTailSince(0),
+    myTailEnd(-1)
+{
+  // Empty
+}
+
+HistoryLoader::~HistoryLoader()
+{
+  Licq::User::ClearHistory(myEntries);
+}
+
+void HistoryLoader::setTail(size_t count, time_t since, long end)
+{
+  myTailOnly = true;
+  myTailCount = count;
+  myTailSince = since;
+  myTailEnd = end;
+}
+
+void HistoryLoader::stop()
+{
+  QMutexLocker lock(&myMutex);
+  myStopping = true;
+}
+
+void HistoryLoader::takeEntries(Licq::HistoryList& entries)
+{
+  QMutexLocker lock(&myMutex);
+  entries.splice(entries.end(), myEntries);
+}
+
+bool HistoryLoader::failed() const
+{
+  QMutexLocker lock(&myMutex);
+  return myFailed;
+}
+
+void HistoryLoader::run()
+{
+  long position = 0;
+  while (true)
+  {
+    Licq::HistoryList chunk;
+    bool ok = false;
+    {
+      Licq::UserReadGuard u(myUserId);
+      if (u.isLocked())
+      {
+        if (myTailOnly)
+          ok = u->getHistoryTail(chunk, myTailCount, myTailSince, myTailEnd);
+        else
+          ok = u->getHistoryChunk(chunk, position, ChunkSize);
+      }
+    }
+
+    QMutexLocker lock(&myMutex);
+    if (!ok)
+    {
+      myFailed = true;
+      return;
+    }
+    if (myStopping)
+    {
+      Licq::User::ClearHistory(chunk);
+      return;
+    }
+    if (chunk.empty())
+      return;
+
+    // A short chunk means we've reached the end of the file
+    bool done = (myTailOnly || chunk.size() < ChunkSize);
+
+    // Only notify if GUI has taken the previous entries, it gets all at once
+    bool notify = myEntries.empty();
+    myEntries.splice(myEntries.end(), chunk);
+    lock.unlock();
+
+    if (notify)
+      emit entriesLoaded();
+    if (done)
+      return;
+  }
+}
@@ -0,0 +1,110 @@
+/*
+ * This file is part of Licq, an instant messaging client for UNIX.
+ * Copyright (C) 2013 Licq developers <licq-dev@googlegroups.com>
+ *
+ * Licq is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Licq is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Licq; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef HISTORYLOADER_H
+#define HISTORYLOADER_H
+
+#include <QMutex>
+#include <QThread>
+
+#include <licq/contactlist/user.h>
+#include <licq/userid.h>
+
+namespace LicqQtGui
+{
+
+/**
+ * Thread reading the history for a contact
+ *
+ * History is read in chunks and the user is only locked while each chunk is
+ * read so large history files neither block the GUI nor the daemon.
+ * Alternatively, only the most recent entries can be read.
+ */
+class HistoryLoader : public QThread
+{
+  Q_OBJECT
+
+public:
+  /**
+   * Constructor
+   *
+   * @param userId Contact to read history for
+   * @param parent Parent object
+   */
+  HistoryLoader(const Licq::UserId& userId, QObject* parent = 0);
+
+  /**
+   * Destructor
+   * Thread must have finished before the loader is deleted
+   */
+  ~HistoryLoader();
+
+  /**
+   * Only read the most recent entries instead of the full history
+   * Must be called before thread is started.
+   *
+   * @param count Number of entries to read from end of history
+   * @param since Also read earlier entries that are newer than this
+   * @param end History size from User::getHistorySize() to stop at, -1 to
+   *            read to the end
+   */
+  void setTail(size_t count, time_t since, long end = -1);
+
+  /**
+   * Ask thread to stop after current chunk
+   */
+  void stop();
+
+  /**
+   * Get entries read since last call
+   *
+   * @param entries List to append entries to, caller takes ownership of them
+   */
+  void takeEntries(Licq::HistoryList& entries);
+
+  /**
+   * Check if reading the history failed
+   */
+  bool failed() const;
+
+signals:
+  /**
+   * New entries are available from takeEntries()
+   * Not emitted again until takeEntries() has been called
+   */
+  void entriesLoaded();
+
+protected:
+  void run();
+
+private:
+  const Licq::UserId myUserId;
+  mutable QMutex myMutex;
+  Licq::HistoryList myEntries;
+  bool myStopping;
+  bool myFailed;
+  bool myTailOnly;
+  size_t myTailCount;
+  time_t myTailSince;
+  long myTailEnd;
+};
+
+} // namespace LicqQtGui
+
+#endif
@@ -82,6 +82,7 @@
 #include "dialogs/chatdlg.h"
 #include "dialogs/filedlg.h"
 #include "dialogs/editfilelistdlg.h"
+#include "dialogs/historyloader.h"
 #include "dialogs/joinchatdlg.h"
 #include "dialogs/keyrequestdlg.h"
 #include "dialogs/showawaymsgdlg.h"
@@ -116,7 +117,9 @@ bool orderMessagePairs(const messagePair& mp1, const messagePair& mp2)
 
 UserSendEvent::UserSendEvent(int type, const Licq::UserId& userId, QWidget* parent)
   : UserEventCommon(userId, parent, "UserSendEvent"),
-    myType(type)
+    myType(type),
+    myHistoryLoader(NULL),
+    myHistorySkip(0)
 {
   myPictureLabel = NULL;
   clearDelay = 250;
@@ -228,82 +231,18 @@ UserSendEvent::UserSendEvent(int type, const Licq::UserId& userId, QWidget* pare
     int historyTime = Config::Chat::instance()->showHistoryTime();
     if (u.isLocked() && (historyCount > 0 || historyTime > 0))
     {
-      // Show recent messages in the history
-      Licq::HistoryList lHistoryList;
-      if (u->GetHistory(lHistoryList))
-      {
-        // Rewind to the starting point. This will be the first message shown in the dialog.
-        // Make sure we don't show the new messages waiting.
-        unsigned short nNewMessages = u->NewMessages();
-        Licq::HistoryList::iterator lHistoryIter = lHistoryList.end();
-        for (int i = 0; i < historyCount + nNewMessages && lHistoryIter != lHistoryList.begin(); i++)
-          lHistoryIter--;
-
-        time_t timeLimit = time(NULL) - historyTime;
-        while (lHistoryIter != lHistoryList.begin())
-        {
-          lHistoryIter--;
-
-          if ((*lHistoryIter)->Time() < timeLimit)
-          {
-            // Found a message that is older than we want, go back one step and stop looking
-            lHistoryIter++;
-            break;
-          }
-
-          // One more message from history to show
-          historyCount++;
-        }
-
-        bool bUseHTML = u->protocolId() == ICQ_PPID && !isdigit(u->accountId()[0]);
-        QString contactName = QString::fromUtf8(u->getAlias().c_str());
-        QString ownerName;
-        {
-          Licq::OwnerReadGuard o(u->id().ownerId());
-          if (o.isLocked())
-            ownerName = QString::fromUtf8(o->getAlias().c_str());
-          else
-            ownerName = QString(tr("Error! no owner set"));
-        }
-
-        // Iterate through each message to add
-        // Only show old messages as recent ones. Don't show duplicates.
-        int nMaxNumToShow;
-        if (lHistoryList.size() <= static_cast<size_t>(historyCount))
-          nMaxNumToShow = lHistoryList.size() - nNewMessages;
-        else
-          nMaxNumToShow = historyCount;
-
-        // Safety net
-        if (nMaxNumToShow < 0)
-          nMaxNumToShow = 0;
-
-        QDateTime date;
-
-        for (int i = 0; i < nMaxNumToShow && lHistoryIter != lHistoryList.end(); i++)
-        {
-          QString str;
-          date.setTime_t((*lHistoryIter)->Time());
-          QString messageText = QString::fromUtf8((*lHistoryIter)->text().c_str());
-
-          myHistoryView->addMsg(
-              (*lHistoryIter)->isReceiver(),
-              true,
-              (*lHistoryIter)->eventType() == Licq::UserEvent::TypeMessage ? "" : ((*lHistoryIter)->description() + " ").c_str(),
-              date,
-              (*lHistoryIter)->IsDirect(),
-              (*lHistoryIter)->IsMultiRec(),
-              (*lHistoryIter)->IsUrgent(),
-              (*lHistoryIter)->IsEncrypted(),
-              (*lHistoryIter)->isReceiver() ? contactName : ownerName,
-              MLView::toRichText(messageText, true, bUseHTML));
-          lHistoryIter++;
-        }
-
-        myHistoryView->GotoEnd();
-
-        Licq::User::ClearHistory(lHistoryList);
-      }
+      // Only read the end of the history and do it in the background so the
+      // window can be shown immediately.
+      // New messages waiting are also in the history, read them too so they
+      // can be skipped when the history is shown.
+      // Stop at the current end of the history as anything logged after
+      // this will be added to the view as it arrives.
+      myHistorySkip = u->NewMessages();
+      myHistoryLoader = new HistoryLoader(myUsers.front(), this);
+      myHistoryLoader->setTail(historyCount + myHistorySkip,
+          time(NULL) - historyTime, u->getHistorySize());
+      connect(myHistoryLoader, SIGNAL(finished()), SLOT(historyLoaded()));
+      myHistoryLoader->start(QThread::LowPriority);
     }
 
     // Collect all messages to put them in the correct time order
@@ -514,7 +453,11 @@ UserSendEvent::UserSendEvent(int type, const Licq::UserId& userId, QWidget* pare
 
 UserSendEvent::~UserSendEvent()
 {
-  // Empty
+  if (myHistoryLoader != NULL)
+  {
+    myHistoryLoader->stop();
+    myHistoryLoader->wait();
+  }
 }
 
 void UserSendEvent::closeEvent(QCloseEvent* event)
@@ -1613,8 +1556,7 @@ void UserSendEvent::clearNewEvents()
             idList.push_back(e->Id());
         }
 
-        for (std::vector<int>::size_type i = 0; i < idList.size(); i++)
-          u->EventClearId(idList[i]);
+        u->EventClearIds(idList);
       }
     }
   }
@@ -1672,6 +1614,73 @@ void UserSendEvent::insertEmoticon(const QString& value)
   myMessageEdit->insertPlainText(value);
 }
 
+void UserSendEvent::historyLoaded()
+{
+  Licq::HistoryList history;
+  myHistoryLoader->takeEntries(history);
+  myHistoryLoader->deleteLater();
+  myHistoryLoader = NULL;
+
+  // Don't show duplicates of the new messages waiting, they are already
+  // shown. Messages added while loading are past the end that was read.
+  for (unsigned short i = 0; i < myHistorySkip && !history.empty(); ++i)
+  {
+    delete history.back();
+    history.pop_back();
+  }
+
+  if (history.empty() || myHistoryView == NULL)
+  {
+    Licq::User::ClearHistory(history);
+    return;
+  }
+
+  bool bUseHTML;
+  QString contactName;
+  QString ownerName;
+  {
+    Licq::UserReadGuard u(myUsers.front());
+    if (!u.isLocked())
+    {
+      Licq::User::ClearHistory(history);
+      return;
+    }
+
+    bUseHTML = u->protocolId() == ICQ_PPID && !isdigit(u->accountId()[0]);
+    contactName = QString::fromUtf8(u->getAlias().c_str());
+    Licq::OwnerReadGuard o(u->id().ownerId());
+    if (o.isLocked())
+      ownerName = QString::fromUtf8(o->getAlias().c_str());
+    else
+      ownerName = QString(tr("Error! no owner set"));
+  }
+
+  QDateTime date;
+  myHistoryView->beginPrepend();
+  Licq::HistoryList::iterator item;
+  for (item = history.begin(); item != history.end(); ++item)
+  {
+    date.setTime_t((*item)->Time());
+    QString messageText = QString::fromUtf8((*item)->text().c_str());
+
+    myHistoryView->addMsg(
+        (*item)->isReceiver(),
+        true,
+        (*item)->eventType() == Licq::UserEvent::TypeMessage ? "" : ((*item)->description() + " ").c_str(),
+        date,
+        (*item)->IsDirect(),
+        (*item)->IsMultiRec(),
+        (*item)->IsUrgent(),
+        (*item)->IsEncrypted(),
+        (*item)->isReceiver() ? contactName : ownerName,
+        MLView::toRichText(messageText, true, bUseHTML));
+  }
+  myHistoryView->endPrepend();
+  myHistoryView->GotoEnd();
+
+  Licq::User::ClearHistory(history);
+}
+
 void UserSendEvent::messageAdded()
 {
   UserEventTabDlg* tabDlg = gLicqGui->userEventTabDlg();
@@ -22,6 +22,7 @@
 
 #include "usereventcommon.h"
 
+#include <ctime>
 #include <list>
 #include <string>
 
@@ -39,6 +40,7 @@ class Event;
 
 namespace LicqQtGui
 {
+class HistoryLoader;
 class HistoryView;
 class MLEdit;
 class MMUserView;
@@ -192,6 +194,9 @@ private slots:
   void textChangedTimeout();
   void sendTrySecure();
 
+  /// Recent history has been read, add it to the top of the view
+  void historyLoaded();
+
   /**
    * A dragged object has entered this widget
    * Overloaded to accept files, URLs and users to be sent by dragging them
@@ -247,6 +252,9 @@ private:
   QPushButton* myFileBrowseButton;
   QPushButton* myFileEditButton;
   std::list<std::string> myFileList;
+
+  HistoryLoader* myHistoryLoader;
+  unsigned short myHistorySkip;
 };
 
 } // namespace LicqQtGui
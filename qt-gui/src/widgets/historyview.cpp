@@ -58,7 +58,8 @@ QStringList HistoryView::getStyleNames(bool includeHistoryStyles)
 
 HistoryView::HistoryView(bool historyMode, const Licq::UserId& userId, QWidget* parent)
   : MLView(parent),
-    myUserId(userId)
+    myUserId(userId),
+    myPrepending(false)
 {
   Config::Chat* chatConfig = Config::Chat::instance();
   if (historyMode)
@@ -193,13 +194,51 @@ void HistoryView::updateContent()
   setText(myBuffer);
 }
 
+void HistoryView::beginPrepend()
+{
+  myPrepending = true;
+  myPrependBuffer.clear();
+
+  // Date headers for prepended messages are independent of current contents
+  myPrependLastDate = myLastDate;
+  myLastDate = QDate();
+}
+
+void HistoryView::endPrepend()
+{
+  myPrepending = false;
+  myLastDate = myPrependLastDate;
+  if (myPrependBuffer.isEmpty())
+    return;
+
+  if (myUseBuffer)
+  {
+    // Older messages go last in a reversed buffer
+    if (myReverse)
+      myBuffer.append(myPrependBuffer);
+    else
+      myBuffer.prepend(myPrependBuffer);
+  }
+  else
+  {
+    // Last line break is replaced by the block separating us from old contents
+    if (myPrependBuffer.endsWith("<br>"))
+      myPrependBuffer.chop(4);
+    prepend(myPrependBuffer);
+  }
+  myPrependBuffer.clear();
+}
+
 void HistoryView::internalAddMsg(QString s, const QDate& date)
 {
+  // Prepended messages are collected as a single block like buffered ones
+  bool buffered = (myUseBuffer || myPrepending);
+
   if (myExtraSpacing)
   {
     if (myMsgStyle != 5)
     {
-      if (myUseBuffer)
+      if (buffered)
       {
         s.prepend("<p>");
         s.append("</p>");
@@ -230,7 +269,18 @@ void HistoryView::internalAddMsg(QString s, const QDate& date)
   }
   myLastDate = date;
 
-  if (myUseBuffer)
+  if (myPrepending)
+  {
+    if (!myExtraSpacing && myMsgStyle != 5)
+      s.append("<br>");
+
+    // Keep block in the same order as the buffer it will be added to
+    if (myUseBuffer && myReverse)
+      myPrependBuffer.prepend(s);
+    else
+      myPrependBuffer.append(s);
+  }
+  else if (myUseBuffer)
   {
     if (!myExtraSpacing && myMsgStyle != 5)
       s.append("<br>");
@@ -287,12 +337,18 @@ void HistoryView::addMsg(bool isReceiver, bool fromHistory,
 
   // Extract everything inside <body>...</body>
   // Leaving <html> and <body> messes with our message display
-  QRegExp body("<body[^>]*>(.*)</body>");
-  if (body.indexIn(messageText) != -1)
-    messageText = body.cap(1);
+  // Expressions are compiled once and copied since QRegExp keeps match state
+  static const QRegExp bodyPattern("<body[^>]*>(.*)</body>");
+  static const QRegExp fontPattern("</?font[^>]*>");
+  if (messageText.contains('<'))
+  {
+    QRegExp body(bodyPattern);
+    if (body.indexIn(messageText) != -1)
+      messageText = body.cap(1);
 
-  // Remove all font tags
-  messageText.replace(QRegExp("</?font[^>]*>"), "");
+    // Remove all font tags
+    messageText.replace(fontPattern, "");
+  }
 
   QString dateString = date.toString(myDateFormat);
 
@@ -74,6 +74,19 @@ public:
     const QString& contactName, QString messageText, QString anchor = QString());
   void addNotice(const QDateTime& dateTime, QString messageText);
 
+  /**
+   * Start adding messages before current contents
+   * Messages added until endPrepend() is called are inserted above everything
+   * already in the view, in the order they are added. Used to show history
+   * that was loaded after the view was populated.
+   */
+  void beginPrepend();
+
+  /**
+   * Insert messages added since beginPrepend()
+   */
+  void endPrepend();
+
   virtual QSize sizeHint() const;
 
 public slots:
@@ -103,6 +116,9 @@ private:
   QString myColorNotice;
   QString myBuffer;
   QDate myLastDate;
+  bool myPrepending;
+  QString myPrependBuffer;
+  QDate myPrependLastDate;
 };
 
 } // namespace LicqQtGui
@@ -91,34 +91,79 @@ void MLView::append(const QString& s, bool richText)
     scrollBar->setValue(scrollBar->maximum());
 }
 
-QString MLView::toRichText(const QString& s, bool highlightURLs, bool useHTML, QRegExp highlight)
+void MLView::prepend(const QString& s)
 {
-  // Expressions to match URIs and Mail addresses
-  // If no matching should be done, they will be left empty
-  QRegExp reURL;
-  QRegExp reMail;
-
-  // We must hightlight URLs at this step, before we convert
-  // linebreaks to richtext tags and such.  Also, check to make sure
-  // that the text is not prepared to be highlighted already (by AIM).
-  QRegExp reAHREF("<a href", Qt::CaseInsensitive);
-  if (highlightURLs && s.indexOf(reAHREF) == -1)
+  QTextDocument* doc = document();
+  if (doc->isEmpty())
   {
-    reURL.setPattern(
+    append(s, true);
+    return;
+  }
+
+  // Remember where we are, inserting at top must not move view away from end
+  QScrollBar* scrollBar = verticalScrollBar();
+  bool wasAtEnd = (scrollBar->value() == scrollBar->maximum());
+
+  QTextCursor tc(doc);
+  tc.movePosition(QTextCursor::Start);
+  tc.beginEditBlock();
+  tc.insertHtml(s);
+  // Keep old first block separate from the inserted text
+  tc.insertBlock();
+  tc.endEditBlock();
+
+  if (wasAtEnd)
+    scrollBar->setValue(scrollBar->maximum());
+}
+
+/**
+ * Build expression to match URIs
+ */
+static QRegExp urlRegExp()
+{
+  QRegExp re(
       "(?:(https?|ftp)://(.+(:.+)?@)?|www\\d?\\.)"  // protocoll://[user[:password]@] or www[digit].
       "([\\w.\\-]+|\\[[\\da-fA-F:.]+\\])"           // dotted hostname/ipv4 or [ipv6 address]
       "(:[0-9]+)?"                                  // optional port
       "(/[-\\w%{}|\\\\^~`;/?:@=&$_.+!*'(),#\\[\\]]*)?");
-    reURL.setMinimal(false);
-    reURL.setCaseSensitivity(Qt::CaseInsensitive);
+  re.setMinimal(false);
+  re.setCaseSensitivity(Qt::CaseInsensitive);
+  return re;
+}
 
-    reMail.setPattern(
+/**
+ * Build expression to match mail addresses
+ */
+static QRegExp mailRegExp()
+{
+  QRegExp re(
       "(mailto:)?"
       "[a-z9-0._%+-]+"
       "@"
       "[a-z0-9.-]+\\.(?:[a-z]+|[0-9]+)");
-    reMail.setMinimal(false);
-    reMail.setCaseSensitivity(Qt::CaseInsensitive);
+  re.setMinimal(false);
+  re.setCaseSensitivity(Qt::CaseInsensitive);
+  return re;
+}
+
+QString MLView::toRichText(const QString& s, bool highlightURLs, bool useHTML, QRegExp highlight)
+{
+  // Patterns are only compiled once, copies share the compiled expression
+  static const QRegExp urlPattern(urlRegExp());
+  static const QRegExp mailPattern(mailRegExp());
+
+  // Expressions to match URIs and Mail addresses
+  // If no matching should be done, they will be left empty
+  QRegExp reURL;
+  QRegExp reMail;
+
+  // We must hightlight URLs at this step, before we convert
+  // linebreaks to richtext tags and such.  Also, check to make sure
+  // that the text is not prepared to be highlighted already (by AIM).
+  if (highlightURLs && !s.contains("<a href", Qt::CaseInsensitive))
+  {
+    reURL = urlPattern;
+    reMail = mailPattern;
   }
 
   // The following will parse through the string adding <a> tags to URIs and
@@ -267,21 +312,25 @@ QString MLView::toRichText(const QString& s, bool highlightURLs, bool useHTML, Q
 
   Emoticons::self()->parseMessage(text, Emoticons::NormalMode);
 
-  // convert linebreaks to <br>
-  text.replace(QRegExp("\n"), "<br>\n");
-  // We keep the first space character as-is (to allow line wrapping)
-  // and convert the next characters to &nbsp;s (to preserve multiple
-  // spaces).
-  QRegExp longSpaces(" ([ ]+)");
-  QString cap;
-  int pos = 0;
-  while ((pos = longSpaces.indexIn(text)) > -1)
+  // Convert linebreaks and tabs and keep the first space character of a
+  // sequence as-is (to allow line wrapping) but convert the following ones
+  // to &nbsp;s (to preserve multiple spaces). Done in one pass as this is
+  // called for every message shown.
+  QString result;
+  result.reserve(text.length() + text.length() / 8);
+  for (int i = 0; i < text.length(); ++i)
   {
-    cap = longSpaces.cap(1);
-    cap.replace(QRegExp(" "), "&nbsp;");
-    text.replace(pos+1, longSpaces.matchedLength()-1, cap);
+    const QChar c = text.at(i);
+    if (c == '\n')
+      result.append("<br>\n");
+    else if (c == '\t')
+      result.append(" &nbsp;&nbsp;&nbsp;");
+    else if (c == ' ' && i > 0 && text.at(i - 1) == ' ')
+      result.append("&nbsp;");
+    else
+      result.append(c);
   }
-  text.replace(QRegExp("\t"), " &nbsp;&nbsp;&nbsp;");
+  text = result;
 
   return text;
 }
@@ -81,6 +81,13 @@ public slots:
    */
   void append(const QString& s, bool richText = true);
 
+  /**
+   * Insert rich text before current contents of view area
+   *
+   * @param s Text to add
+   */
+  void prepend(const QString& s);
+
   virtual void setSource(const QUrl& url);
 
   /**